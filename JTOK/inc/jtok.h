@@ -17,6 +17,7 @@ extern "C" {
 #define NO_CHILD_IDX (INVALID_ARRAY_INDEX)
 #define JTOK_STRING_INDEX_NONE (INVALID_ARRAY_INDEX)
 
+/* Nesting limit of jtok_parse, jtok_parse_n and jtok_tape_parse */
 #define JTOK_MAX_RECURSE_DEPTH 25
 
 /**
@@ -108,6 +109,12 @@ typedef enum
 
     JTOK_PARSE_STATUS_NEST_DEPTH_EXCEEDED,
 
+    /* string that is not valid UTF-8, eg overlong, surrogate or > U+10FFFF */
+    JTOK_PARSE_STATUS_INVALID_UTF8,
+
+    /* json longer than INT_MAX bytes, past what token positions can hold */
+    JTOK_PARSE_STATUS_TOO_LONG,
+
 } JTOK_PARSE_STATUS_t;
 
 
@@ -124,32 +131,431 @@ typedef enum
 } JTOK_VALUE_TYPE_t;
 
 
+/* jtok_tkn_t.flags of a string token, recorded while it is scanned */
+#define JTOK_TKN_FLAG_DECODED (1 << 0) /* string escapes decoded in place */
+#define JTOK_TKN_FLAG_ESCAPED (1 << 1) /* text has escape sequences */
+#define JTOK_TKN_FLAG_ASCII (1 << 2)   /* text is all ascii */
+#define JTOK_TKN_FLAG_HASHED (1 << 3)  /* hash is jtok_hash_key of the text */
+
 typedef struct jtok_tkn_struct jtok_tkn_t;
 struct jtok_tkn_struct
 {
 
-    char *      json;    /* json string into which the data structure inserts */
-    jtok_tkn_t *pool;    /* Token pool */
-    JTOK_TYPE_t type;    /* type (object, array, string etc.) */
-    int         start;   /* start position in JTOK data string */
-    int         end;     /* end position in JTOK data string */
-    int         size;    /* number of child tokens */
-    int         parent;  /* index of parent token in the token pool */
-    int         sibling; /* index of next token that shares the same parent */
+    char *      json; /* json string the token points into */
+    jtok_tkn_t *pool; /* Token pool */
+
+    /* Packed into one word to keep the token at 48 bytes */
+    JTOK_TYPE_t       type : 8;       /* type (object, array, string etc.) */
+    JTOK_VALUE_TYPE_t value_type : 8; /* subtype of a string or primitive */
+    unsigned int      flags : 16;     /* JTOK_TKN_FLAG_* */
+
+    int      start;   /* start position in JTOK data string */
+    int      end;     /* end position in JTOK data string */
+    int      size;    /* number of child tokens */
+    int      parent;  /* index of parent token in the token pool */
+    int      sibling; /* index of next token with same parent */
+    uint32_t hash;    /* hash of a key, see JTOK_TKN_FLAG_HASHED */
+    int      next;    /* index one past the token's subtree */
 };
 
+/**
+ * Decoded value of a primitive token. Which member is valid depends on the
+ * value_type of the token: u for uint, i for int, d for real and b for
+ * boolean.
+ */
+typedef union
+{
+    uint64_t u;
+    int64_t  i;
+    double   d;
+    bool     b;
+} jtok_value_t;
+
+/**
+ * Compact 16 byte token used by the jtok tape. The json pointer shared by
+ * all tokens lives once in the jtok_tape_t header instead of in every token.
+ * Use the jtok_tape_* accessors rather than reading the fields directly.
+ */
+typedef struct
+{
+    uint32_t start;  /* start position in JTOK data string */
+    uint32_t info;   /* packed type, key flag and length or child count */
+    uint32_t parent; /* tape index of parent token */
+    uint32_t next;   /* tape index one past this token's subtree */
+} jtok_tape_tkn_t;
+
+typedef struct
+{
+    const char *     json;  /* json string the tape describes */
+    jtok_tape_tkn_t *tkns;  /* caller-provided tape storage */
+    size_t           size;  /* number of entries in tkns */
+    size_t           count; /* number of entries filled by the parser */
+} jtok_tape_t;
+
+/**
+ * One slot of a jtok_keymap_t
+ */
+typedef struct
+{
+    uint32_t hash; /* hash of the key text */
+    int      tkn;  /* pool index of the key, INVALID_ARRAY_INDEX if free */
+} jtok_keymap_slot_t;
+
+/**
+ * Hash index of the keys of one object, see jtok_keymap_build
+ */
+typedef struct
+{
+    const jtok_tkn_t *  obj;   /* object the map describes, NULL if none */
+    jtok_keymap_slot_t *slots; /* caller-provided hash table */
+    size_t              size;  /* number of slots */
+} jtok_keymap_t;
+
+/* Number of slots that gives a keymap of an object of n keys short probes */
+#define JTOK_KEYMAP_SLOTS(n) (2 * (n) + 1)
+
+/**
+ * Element offsets of one array of objects or arrays, see jtok_elemidx_at
+ */
+typedef struct
+{
+    const jtok_tkn_t *arr;   /* array the index describes, NULL if none */
+    int *             elems; /* caller-provided, pool index of each element */
+    size_t            size;  /* number of entries in elems */
+} jtok_elemidx_t;
+
+/**
+ * One reference token of a compiled jtok_path_t
+ */
+typedef struct
+{
+    const char *key;      /* text of the token, points into the path string */
+    size_t      len;      /* length of the text, ~0 and ~1 escapes included */
+    uint32_t    hash;     /* jtok_hash_key of the text, if not escaped */
+    int         index;    /* array index, INVALID_ARRAY_INDEX if not one */
+    bool        escaped;  /* text holds ~0 or ~1 escapes */
+    bool        wildcard; /* "*", matches every member or element */
+} jtok_path_seg_t;
+
+/**
+ * JSON pointer compiled by jtok_path_compile
+ */
+typedef struct
+{
+    jtok_path_seg_t *segs;  /* caller-provided reference tokens */
+    size_t           size;  /* number of entries in segs */
+    size_t           count; /* number of reference tokens in the path */
+} jtok_path_t;
+
+/**
+ * Allocator used by a parser to grow its token pool. Same contract as
+ * realloc: ptr may be NULL, and on failure NULL is returned and ptr is left
+ * alone. ctx is the pointer given to jtok_parser_set_allocator.
+ */
+typedef void *(*jtok_realloc_func)(void *ctx, void *ptr, size_t size);
+
+/**
+ * One level of object/array nesting on the parser stack. The caller only
+ * provides the storage, the parser owns the contents.
+ */
 typedef struct
 {
-    char *       json;      /* ptr to start of json string */
-    jtok_tkn_t * tkn_pool;  /* token pool */
-    unsigned int pool_size; /* pool size */
-    int          json_len;  /* max length of json string   */
-    int          pos;       /* current parsing index in json string */
-    int          toknext;   /* index of next token to allocate */
-    int          toksuper; /* superior token node, e.g parent object or array */
-    int          last_child; /* index of last sibling parsed */
+    int         tkn;          /* index of the object or array token */
+    int         last_child;   /* index of last child parsed, for sibling links */
+    JTOK_TYPE_t type;         /* JTOK_OBJECT or JTOK_ARRAY */
+    int         expecting;    /* next thing the object/array grammar expects */
+    JTOK_TYPE_t element_type; /* type of the first element of an array */
+} jtok_frame_t;
+
+typedef struct
+{
+    char *            json;       /* ptr to start of json string */
+    jtok_tkn_t *      tkn_pool;   /* token pool */
+    jtok_value_t *    values;     /* optional decoded value of each token */
+    jtok_tape_t *     tape;       /* compact tape, filled instead of tkn_pool */
+    bool              validating; /* tkn_pool only holds the open path */
+    bool              unescape;   /* decode string escapes in the json */
+    bool              writable;   /* json may be written, for unescape */
+    bool              hash_keys;  /* hash every key as it is scanned */
+    unsigned int      pool_size;  /* pool size */
+    jtok_realloc_func realloc_fn; /* grows tkn_pool when it is full */
+    void *            alloc_ctx;  /* passed to realloc_fn */
+    int               json_len;   /* max length of json string   */
+    int               pos;        /* current parsing index in json string */
+    int               next_pos;   /* next index the object/array loop checks */
+    int               toknext;    /* index of next token to allocate */
+    int               toksuper;   /* superior token node, e.g parent object */
+    jtok_frame_t *    stack;      /* one frame per open object or array */
+    unsigned int      stack_size; /* number of frames in stack (max nesting) */
+    unsigned int      depth;      /* number of frames in use */
+    int               tok_start;  /* string/primitive cut off by end of json, */
+    int               tok_resume; /* where its scan resumes */
+    int               tok_flags;  /* and the scanner state to resume with */
+    uint64_t          tok_digits; /* integer digits of a number read so far */
+    uint64_t          idx_bits;   /* structural bitmap of current json block */
+    int               idx_base;   /* json position of bit 0 of idx_bits */
+    int               idx_end;    /* one past the last position in idx_bits */
 } jtok_parser_t;
 
+/**
+ * Position and status of one document of a batch parsed by jtok_parse_many
+ */
+typedef struct
+{
+    size_t              start;  /* offset of the document in the buffer */
+    size_t              end;    /* offset one past the end of the document */
+    JTOK_PARSE_STATUS_t status; /* parse status of the document */
+} jtok_doc_t;
+
+
+/**
+ * @brief Set up a parser with a caller-provided token pool and nesting stack.
+ *
+ * @param parser the parser to initialize
+ * @param tkns caller-provided pool of tokens. If NULL (and no allocator is
+ * set) jtok_parser_parse runs in counting mode: it only counts the tokens the
+ * json needs into parser->toknext, using a fast structural pre-scan that does
+ * not check the grammar.
+ * @param size number of tokens in the token pool
+ * @param stack caller-provided nesting stack
+ * @param depth number of frames in stack. This is the maximum nesting depth
+ * of the json, counting the top-level object.
+ *
+ * @note The parser never recurses, so the stack is the only memory that
+ * grows with the nesting depth of the json.
+ */
+void jtok_parser_init(jtok_parser_t *parser, jtok_tkn_t *tkns, size_t size,
+                      jtok_frame_t *stack, size_t depth);
+
+
+/**
+ * @brief Let a parser grow its token pool instead of failing with
+ * JTOK_PARSE_STATUS_NOMEM when the pool is full. The pool size is doubled on
+ * every growth, so the pool passed to jtok_parser_init (which may be NULL)
+ * must have been allocated with realloc_fn as well.
+ *
+ * @param parser the parser
+ * @param realloc_fn the allocator, NULL to keep the pool at a fixed size
+ * @param ctx passed to every call of realloc_fn
+ *
+ * @note The pool may move. After parsing, the tokens are at parser->tkn_pool
+ * and there are parser->pool_size of them.
+ */
+void jtok_parser_set_allocator(jtok_parser_t *parser,
+                               jtok_realloc_func realloc_fn, void *ctx);
+
+
+/**
+ * @brief Have a parser decode every primitive as it is tokenized. The value
+ * of primitive token i is written to values[i], so the number is only parsed
+ * once. Entries for other tokens are left alone.
+ *
+ * @param parser the parser
+ * @param values array with one entry per token in the pool (or tape), NULL
+ * to only record the value_type of each token. If the parser has an
+ * allocator the array has to be allocated with it too, and grows with the
+ * pool.
+ *
+ * @note After parsing, the values are at parser->values
+ */
+void jtok_parser_set_values(jtok_parser_t *parser, jtok_value_t *values);
+
+
+/**
+ * @brief Have a parser decode the escape sequences of every string (and
+ * key) in place as it is tokenized. \uXXXX escapes, surrogate pairs included,
+ * become UTF-8, and a lone surrogate becomes U+FFFD. The string tokens then
+ * describe the decoded text and are flagged JTOK_TKN_FLAG_DECODED, so
+ * jtok_tokview gives the string with no copy.
+ *
+ * @param parser the parser
+ * @param unescape true to decode, false to leave the json alone (default)
+ *
+ * @note Only jtok_parser_parse_inplace decodes, since it is given writable
+ * json. jtok_parser_parse and jtok_parser_feed never write to their json and
+ * leave the strings as they are. Decoding never makes a string longer, and
+ * the bytes between the decoded text and the closing quote are left
+ * unspecified. Tapes are not decoded.
+ */
+void jtok_parser_set_unescape(jtok_parser_t *parser, bool unescape);
+
+
+/**
+ * @brief Have a parser hash the text of every key while it is still in
+ * cache from the scan. The hash goes in the hash field of the key token,
+ * which is flagged JTOK_TKN_FLAG_HASHED, and lets key comparisons
+ * (jtok_obj_has_key, jtok_tokcmp_hash, jtok_keymap_build, ...) reject a
+ * mismatch without reading the json.
+ *
+ * @param parser the parser
+ * @param hash_keys true to hash keys, false to leave the hash unset (default)
+ *
+ * @note The hash is of the text the token describes, so of the decoded text
+ * if the parser unescapes strings. Tapes have no room for the hash.
+ */
+void jtok_parser_set_hash_keys(jtok_parser_t *parser, bool hash_keys);
+
+
+/**
+ * @brief Parse len bytes of json with a parser set up by jtok_parser_init
+ *
+ * @param parser the parser
+ * @param json json to parse (does not have to be nul-terminated)
+ * @param len number of bytes of json
+ * @return JTOK_PARSE_STATUS_t parse status. JTOK_PARSE_STATUS_OK == success.
+ * JTOK_PARSE_STATUS_NEST_DEPTH_EXCEEDED if the json nests deeper than the
+ * parser stack. JTOK_PARSE_STATUS_TOO_LONG if len is over INT_MAX.
+ */
+JTOK_PARSE_STATUS_t jtok_parser_parse(jtok_parser_t *parser, const char *json,
+                                      size_t len);
+
+
+/**
+ * @brief Same as jtok_parser_parse, but the json is writable, so a parser
+ * set up with jtok_parser_set_unescape decodes the strings in place
+ *
+ * @param parser the parser
+ * @param json json to parse (does not have to be nul-terminated). String
+ * escapes are decoded in it if the parser unescapes.
+ * @param len number of bytes of json
+ * @return JTOK_PARSE_STATUS_t same as jtok_parser_parse
+ */
+JTOK_PARSE_STATUS_t jtok_parser_parse_inplace(jtok_parser_t *parser,
+                                              char *json, size_t len);
+
+
+/**
+ * @brief Feed the next chunk of json to a parser set up by jtok_parser_init.
+ * Parsing continues exactly where the previous chunk ran out, including
+ * partway through a string or a number, so no byte is parsed twice.
+ *
+ * @param parser the parser
+ * @param chunk the new json bytes. The first chunk fed after
+ * jtok_parser_init sets the start of the json. Every later chunk must
+ * directly follow the previous one in the same buffer, because tokens store
+ * positions in the json rather than copies of it.
+ * @param len number of bytes in chunk
+ * @return JTOK_PARSE_STATUS_t JTOK_PARSE_STATUS_PARTIAL_TOKEN if the
+ * top-level object is not complete yet and more json should be fed,
+ * JTOK_PARSE_STATUS_OK once it is complete, or the parse error. After an
+ * error the parser has to be set up again with jtok_parser_init.
+ */
+JTOK_PARSE_STATUS_t jtok_parser_feed(jtok_parser_t *parser, const char *chunk,
+                                     size_t len);
+
+
+/**
+ * @brief Parse the next document of a buffer holding many json documents,
+ * either newline delimited (NDJSON) or simply concatenated.
+ *
+ * Each call parses one document into the token sink of the parser, starting
+ * over at token 0, so one pool serves the whole batch. The tokens of the
+ * document are parser->tkn_pool[0] to parser->tkn_pool[parser->toknext - 1]
+ * and stay valid until the next call. Token positions are offsets into the
+ * whole buffer.
+ *
+ * A document that fails to parse doesn't end the batch. Its status is
+ * reported in doc->status, and the next document is looked for on the next
+ * line after the start of the bad one.
+ *
+ * @param parser parser set up by jtok_parser_init. Counting mode is not
+ * supported.
+ * @param json the buffer. Does not need to be nul-terminated.
+ * @param len number of bytes in the buffer, at most INT_MAX
+ * @param offset in: where to look for the next document, 0 for the first.
+ * out: where to look for the one after it.
+ * @param doc receives the position and parse status of the document
+ * @return true if a document was found
+ * @return false once only whitespace is left (or on a bad parameter)
+ *
+ * @code
+ * size_t     offset = 0;
+ * jtok_doc_t doc;
+ * while (jtok_parse_many(&parser, buf, len, &offset, &doc))
+ * {
+ *     if (doc.status == JTOK_PARSE_STATUS_OK)
+ *     {
+ *         handle(parser.tkn_pool, parser.toknext);
+ *     }
+ * }
+ * @endcode
+ */
+bool jtok_parse_many(jtok_parser_t *parser, const char *json, size_t len,
+                     size_t *offset, jtok_doc_t *doc);
+
+
+/**
+ * Handler for the documents parsed by jtok_parse_parallel. tkns holds the
+ * count tokens of the document and is only valid during the call. doc gives
+ * offsets into the whole buffer, but token positions are relative to the json
+ * pointer of the tokens, which is the start of the chunk they were parsed in.
+ */
+typedef void (*jtok_doc_func)(void *ctx, const jtok_doc_t *doc,
+                              const jtok_tkn_t *tkns, int count);
+
+
+/**
+ * @brief Parse a newline delimited (NDJSON) buffer on several threads.
+ *
+ * The buffer is cut into chunks at newlines, and a fixed pool of workers
+ * parses the chunks with jtok_parse_many, each worker into its own tokens.
+ * The documents are handed to handler one at a time and in the order they
+ * appear in the buffer, no matter which worker parsed them.
+ *
+ * @param json the buffer (eg: an mmapped file). Does not need to be
+ * nul-terminated. Every document has to fit on one line.
+ * @param len number of bytes in the buffer. The buffer may be any size, but a
+ * line longer than INT_MAX bytes is reported as one document with status
+ * JTOK_PARSE_STATUS_TOO_LONG.
+ * @param threads number of workers, including the calling thread. 0 for one
+ * per online cpu.
+ * @param pool_size max number of tokens in one document. A bigger document
+ * is reported with status JTOK_PARSE_STATUS_NOMEM.
+ * @param handler called for every document, from the calling thread or a
+ * worker, but never from two threads at once
+ * @param ctx passed to every call of handler
+ * @return JTOK_PARSE_STATUS_t JTOK_PARSE_STATUS_OK once every document was
+ * handled (whatever their own status), JTOK_PARSE_STATUS_NULL_PARAM on a bad
+ * parameter, or JTOK_PARSE_STATUS_NOMEM if a worker ran out of memory. On
+ * JTOK_PARSE_STATUS_NOMEM the documents handled are a prefix of the buffer.
+ *
+ * @note Needs POSIX threads. Builds without them can leave out
+ * jtok_parallel.c.
+ */
+JTOK_PARSE_STATUS_t jtok_parse_parallel(const char *json, size_t len,
+                                        unsigned int threads, size_t pool_size,
+                                        jtok_doc_func handler, void *ctx);
+
+
+/**
+ * @brief Parse len bytes of one big json document on several threads
+ *
+ * The document is cut into one slice per thread. A first pass over the
+ * slices finds their unmatched brackets for both string states each one
+ * could start in, and chaining the slices together tells which state is
+ * right and which objects and arrays are open where each slice starts. Each
+ * slice is then parsed on its own from just past a comma, with stand-ins for
+ * those objects and arrays, and the slices are stitched into one token pool
+ * with the same parent, sibling and size links jtok_parse_n gives.
+ *
+ * @param json json to parse (does not have to be nul-terminated)
+ * @param len number of bytes of json, at most INT_MAX (2 GiB - 1) since
+ * token positions are ints
+ * @param tkns caller-provided pool of tokens
+ * @param size number of tokens in the token pool
+ * @param threads number of threads, including the calling thread. 0 for one
+ * per online cpu.
+ * @return JTOK_PARSE_STATUS_t the same status as jtok_parse_n, which also
+ * gives the same tokens. JTOK_PARSE_STATUS_TOO_LONG if len is over INT_MAX.
+ *
+ * @note Invalid json, and json that can't be cut up (eg: one huge string),
+ * is parsed again on the calling thread, so errors are reported exactly as
+ * jtok_parse_n reports them. Needs POSIX threads, like jtok_parse_parallel.
+ */
+JTOK_PARSE_STATUS_t jtok_parse_n_parallel(const char *json, size_t len,
+                                          jtok_tkn_t *tkns, size_t size,
+                                          unsigned int threads);
+
 
 /**
  * @brief Parse a json string into its JTOK token representation
@@ -163,6 +569,222 @@ typedef struct
 JTOK_PARSE_STATUS_t jtok_parse(const char *json, jtok_tkn_t *tkns, size_t size);
 
 
+/**
+ * @brief Parse len bytes of json into its JTOK token representation
+ *
+ * @param json json to parse. Does not have to be nul-terminated, and no byte
+ * at or past json[len] is ever read.
+ * @param len number of bytes of json, at most INT_MAX
+ * @param tkns caller-provided pool of tokens
+ * @param size number of tokens in the token pool (max number of tokens that can
+ * be parsed)
+ * @return JTOK_PARSE_STATUS_t parse status. JTOK_PARSE_STATUS_OK == success
+ */
+JTOK_PARSE_STATUS_t jtok_parse_n(const char *json, size_t len, jtok_tkn_t *tkns,
+                                 size_t size);
+
+
+/**
+ * @brief Check that len bytes of json would parse, without producing tokens
+ *
+ * Runs the same grammar as jtok_parse_n (top-level object, one value per
+ * key, arrays of one element type, ...) but only keeps the tokens of the
+ * open path in a small internal pool, so no token pool is needed and the
+ * json can have any number of tokens.
+ *
+ * @param json json to check (does not have to be nul-terminated)
+ * @param len number of bytes of json
+ * @return JTOK_PARSE_STATUS_t the status jtok_parse_n would return with a
+ * big enough token pool. JTOK_PARSE_STATUS_OK == valid
+ */
+JTOK_PARSE_STATUS_t jtok_validate(const char *json, size_t len);
+
+
+/**
+ * @brief Parse len bytes of json into the compact tape representation
+ *
+ * @param tape tape to fill. tkns and size must be set by the caller. On
+ * return json points at the parsed json and count holds the number of tokens.
+ * @param json json to parse (does not have to be nul-terminated)
+ * @param len number of bytes of json
+ * @return JTOK_PARSE_STATUS_t parse status. JTOK_PARSE_STATUS_OK == success
+ *
+ * @note A tape token can describe strings and primitives of up to 256 MiB
+ * and aggregates of up to 256 Mi children.
+ */
+JTOK_PARSE_STATUS_t jtok_tape_parse(jtok_tape_t *tape, const char *json,
+                                    size_t len);
+
+
+/**
+ * @brief Get the type of a tape token
+ *
+ * @param tape the parsed tape
+ * @param idx index of the token in the tape
+ * @return JTOK_TYPE_t the token type
+ */
+JTOK_TYPE_t jtok_tape_type(const jtok_tape_t *tape, int idx);
+
+
+/**
+ * @brief Get the number of child tokens of a tape token
+ *
+ * @param tape the parsed tape
+ * @param idx index of the token in the tape
+ * @return int number of child tokens (1 for a key, which owns its value)
+ */
+int jtok_tape_size(const jtok_tape_t *tape, int idx);
+
+
+/**
+ * @brief Get the start position of a tape token in the json
+ *
+ * @param tape the parsed tape
+ * @param idx index of the token in the tape
+ * @return int start position
+ */
+int jtok_tape_start(const jtok_tape_t *tape, int idx);
+
+
+/**
+ * @brief Get the end position of a tape token in the json
+ *
+ * @param tape the parsed tape
+ * @param idx index of the token in the tape
+ * @return int end position (one past the last character)
+ *
+ * @note For objects and arrays the end is not stored, it is found from the
+ * token's last descendant, which costs O(nesting depth).
+ */
+int jtok_tape_end(const jtok_tape_t *tape, int idx);
+
+
+/**
+ * @brief Get the parent of a tape token
+ *
+ * @param tape the parsed tape
+ * @param idx index of the token in the tape
+ * @return int tape index of the parent, NO_PARENT_IDX for the top-level object
+ */
+int jtok_tape_parent(const jtok_tape_t *tape, int idx);
+
+
+/**
+ * @brief Get the tape index one past the subtree of a token. This is where
+ * the next sibling is, if the token has one.
+ *
+ * @param tape the parsed tape
+ * @param idx index of the token in the tape
+ * @return int tape index one past the last descendant of idx
+ */
+int jtok_tape_next(const jtok_tape_t *tape, int idx);
+
+
+/**
+ * @brief Get the next sibling of a tape token
+ *
+ * @param tape the parsed tape
+ * @param idx index of the token in the tape
+ * @return int tape index of the next sibling, or NO_SIBLING_IDX
+ */
+int jtok_tape_sibling(const jtok_tape_t *tape, int idx);
+
+
+/**
+ * @brief Expand a tape token into a jtok_tkn_t so the jtok_tok* helpers
+ * (jtok_tokcmp, jtok_tokcpy, ...) can be used on it.
+ *
+ * @param tape the parsed tape
+ * @param idx index of the token in the tape
+ * @return jtok_tkn_t the expanded token
+ *
+ * @note The expanded token has no pool. Helpers that walk the token pool
+ * (jtok_obj_has_key, jtok_toktokcmp) cannot be used on it.
+ */
+jtok_tkn_t jtok_tape_tkn(const jtok_tape_t *tape, int idx);
+
+
+/**
+ * @brief Compare a tape token with a nul-terminated string
+ *
+ * @param str char array
+ * @param tape the parsed tape
+ * @param idx index of the token in the tape
+ * @return true if equal
+ * @return false if not equal
+ */
+bool jtok_tape_tokcmp(const char *str, const jtok_tape_t *tape, int idx);
+
+
+/**
+ * @brief Copy a tape token into a buffer
+ *
+ * @param dst the destination byte buffer
+ * @param bufsize size of desintation buffer
+ * @param tape the parsed tape
+ * @param idx index of the token in the tape
+ * @return char* NULL on error, otherwise, address of destination
+ */
+char *jtok_tape_tokcpy(char *dst, uint_least16_t bufsize,
+                       const jtok_tape_t *tape, int idx);
+
+
+/**
+ * @brief Get the value of an integer token
+ *
+ * @param tkn the token
+ * @param value receives the value
+ * @return true if tkn is a JTOK_VALUE_TYPE_uint or JTOK_VALUE_TYPE_int
+ * primitive that fits in an int64_t
+ * @return false otherwise (value is left alone)
+ */
+bool jtok_tok_to_int64(const jtok_tkn_t *tkn, int64_t *value);
+
+
+/**
+ * @brief Get the value of an unsigned integer token
+ *
+ * @param tkn the token
+ * @param value receives the value
+ * @return true if tkn is a JTOK_VALUE_TYPE_uint primitive
+ * @return false otherwise (value is left alone)
+ */
+bool jtok_tok_to_uint64(const jtok_tkn_t *tkn, uint64_t *value);
+
+
+/**
+ * @brief Get the value of a number token as the nearest double
+ *
+ * The token is converted straight from the json, so the json does not need
+ * to be nul-terminated, and the result does not depend on the locale.
+ *
+ * @param tkn the token
+ * @param value receives the value. Numbers out of the range of a double
+ * become +-infinity or +-0.
+ * @return true if tkn is a number primitive
+ * @return false otherwise (value is left alone)
+ */
+bool jtok_tok_to_double(const jtok_tkn_t *tkn, double *value);
+
+
+/**
+ * @brief Get the decoded value of a primitive token. With the values array
+ * of a parser set up by jtok_parser_set_values this is a lookup, the number
+ * is not parsed again.
+ *
+ * @param tkn the token, in its token pool
+ * @param values the values array the token pool was parsed with, or NULL to
+ * decode the token from the json
+ * @param value receives the value
+ * @return JTOK_VALUE_TYPE_t the value_type, which says which member of value
+ * is valid. JTOK_VALUE_TYPE_not_a_value_tkn if tkn is not a primitive
+ * (value is left alone).
+ */
+JTOK_VALUE_TYPE_t jtok_tok_value(const jtok_tkn_t *tkn,
+                                 const jtok_value_t *values,
+                                 jtok_value_t *value);
+
+
 /**
  * @brief get the token length of a jtok_tkn_t;
  *
@@ -172,6 +794,42 @@ JTOK_PARSE_STATUS_t jtok_parse(const char *json, jtok_tkn_t *tkns, size_t size);
 uint_least16_t jtok_toklen(const jtok_tkn_t *tok);
 
 
+/**
+ * @brief Decode the escape sequences of a string token in place, the same
+ * way jtok_parser_set_unescape does while parsing. Does nothing if the token
+ * is already flagged JTOK_TKN_FLAG_DECODED.
+ *
+ * @param tkn the string token. Its json must be writable.
+ * @return JTOK_PARSE_STATUS_t JTOK_PARSE_STATUS_OK, or
+ * JTOK_PARSE_STATUS_NULL_PARAM / JTOK_PARSE_STATUS_INVAL if tkn is not a
+ * string token
+ */
+JTOK_PARSE_STATUS_t jtok_tok_unescape(jtok_tkn_t *tkn);
+
+
+/**
+ * @brief Get the text of a token without copying it
+ *
+ * @param tkn the token
+ * @param len receives the number of bytes of text
+ * @return const char* start of the text (not nul-terminated)
+ */
+const char *jtok_tokview(const jtok_tkn_t *tkn, size_t *len);
+
+
+/**
+ * @brief Get the index one past the subtree of a token (a key's subtree
+ * holds its value). Skipping a value, copying a subtree or going to the next
+ * key is a jump to this index, with no walk over the tokens in between.
+ *
+ * @param tkn the token, in its token pool
+ * @return int pool index one past the last descendant of tkn. For an object
+ * or array (or a key of one) that the parser has not closed yet, this is
+ * the index right after tkn.
+ */
+int jtok_tok_next(const jtok_tkn_t *tkn);
+
+
 /**
  * @brief Compare a jtok token with a nul-terminated string
  *
@@ -183,6 +841,46 @@ uint_least16_t jtok_toklen(const jtok_tkn_t *tok);
 bool jtok_tokcmp(const char *str, const jtok_tkn_t *tok);
 
 
+/**
+ * @brief Compare a string token, with its escape sequences decoded, to a
+ * nul-terminated string. Tokens without JTOK_TKN_FLAG_ESCAPED are compared
+ * with memcmp, like jtok_tokcmp.
+ *
+ * @param str the nul-terminated string (UTF-8)
+ * @param tok the string token
+ * @return true if the decoded text of tok is str
+ * @return false if not, or if it holds a \u0000
+ */
+bool jtok_tokcmp_unescaped(const char *str, const jtok_tkn_t *tok);
+
+
+/**
+ * @brief Hash key text the way a parser set up with
+ * jtok_parser_set_hash_keys hashes keys
+ *
+ * @param key the text
+ * @param len its length
+ * @return uint32_t the hash
+ */
+uint32_t jtok_hash_key(const char *key, size_t len);
+
+
+/**
+ * @brief Compare a token with text whose hash is already known. If the
+ * token is flagged JTOK_TKN_FLAG_HASHED a different hash rejects it without
+ * reading the json, which pays off when one text is compared to many keys.
+ *
+ * @param str the text (does not have to be nul-terminated)
+ * @param len length of str
+ * @param hash jtok_hash_key(str, len)
+ * @param tok the token
+ * @return true if the text of tok is str
+ * @return false if not
+ */
+bool jtok_tokcmp_hash(const char *str, size_t len, uint32_t hash,
+                      const jtok_tkn_t *tok);
+
+
 /**
  * @brief Compare no more than n bytes between a string and a json token
  *
@@ -218,6 +916,19 @@ char *jtok_tokncpy(char *dst, uint_least16_t bufsize, const jtok_tkn_t *tkn,
                    uint_least16_t n);
 
 
+/**
+ * @brief Copy the text of a string token, with its escape sequences decoded,
+ * into a buffer as a nul-terminated string. Tokens without
+ * JTOK_TKN_FLAG_ESCAPED are copied with memcpy.
+ *
+ * @param dst the destination buffer
+ * @param bufsize size of the destination buffer
+ * @param tkn the string token
+ * @return char* dst, or NULL if the text and its nul do not fit
+ */
+char *jtok_tokcpy_unescaped(char *dst, size_t bufsize, const jtok_tkn_t *tkn);
+
+
 /**
  * @brief Check if a jtoktok array constitutes a valid jtok structure
  *
@@ -313,6 +1024,187 @@ jtok_keyval_pair_node_t *jtok_get_children(const jtok_tkn_t *obj);
 int jtok_obj_has_key(const jtok_tkn_t *obj, const char *key_str);
 
 
+/**
+ * @brief Set up an empty key map with caller-provided slots
+ *
+ * @param map the key map
+ * @param slots the hash table
+ * @param size number of slots. Must be more than the number of keys of the
+ * objects the map is used on, JTOK_KEYMAP_SLOTS(keys) is a good size.
+ */
+void jtok_keymap_init(jtok_keymap_t *map, jtok_keymap_slot_t *slots,
+                      size_t size);
+
+
+/**
+ * @brief Index the keys of a parsed object, so jtok_keymap_find can look
+ * them up in O(1) expected time instead of walking the object
+ *
+ * @param map key map set up by jtok_keymap_init. Whatever it held before is
+ * dropped.
+ * @param obj the object token, in its token pool
+ * @return JTOK_PARSE_STATUS_t JTOK_PARSE_STATUS_OK,
+ * JTOK_PARSE_STATUS_NULL_PARAM, JTOK_PARSE_STATUS_NON_OBJECT if obj is not an
+ * object, or JTOK_PARSE_STATUS_NOMEM if the map has too few slots
+ */
+JTOK_PARSE_STATUS_t jtok_keymap_build(jtok_keymap_t *map,
+                                      const jtok_tkn_t *obj);
+
+
+/**
+ * @brief Look up a key of an object with a key map. The map is built first
+ * if it does not describe obj yet.
+ *
+ * @param map key map set up by jtok_keymap_init
+ * @param obj the object token, in its token pool
+ * @param key the key text, as it is in the json
+ * @param len length of key
+ * @return int pool index of the first key of obj that matches, or
+ * INVALID_ARRAY_INDEX. Same result as jtok_obj_has_key. If the map has too
+ * few slots for obj the object is walked instead.
+ *
+ * @note The map has to be built again (or dropped with jtok_keymap_init)
+ * when the token pool is parsed into again.
+ */
+int jtok_keymap_find(jtok_keymap_t *map, const jtok_tkn_t *obj,
+                     const char *key, size_t len);
+
+
+
+/**
+ * @brief Get element i of an array
+ *
+ * Arrays hold one type of element, and strings and primitives have no
+ * children, so their elements are the tokens right after the array and the
+ * lookup is O(1). Elements that are objects or arrays are found by following
+ * sibling links, which is O(i); use jtok_elemidx_at for those.
+ *
+ * @param arr the array token, in its token pool
+ * @param i index of the element
+ * @return int pool index of the element, or INVALID_ARRAY_INDEX if arr is
+ * not an array or has no element i
+ */
+int jtok_array_at(const jtok_tkn_t *arr, int i);
+
+
+/**
+ * @brief Set up an empty element index with caller-provided storage
+ *
+ * @param idx the element index
+ * @param elems storage for the pool index of each element
+ * @param size number of entries in elems. Must be at least the size of the
+ * arrays the index is used on.
+ */
+void jtok_elemidx_init(jtok_elemidx_t *idx, int *elems, size_t size);
+
+
+/**
+ * @brief Record where each element of a parsed array is, with one walk over
+ * the elements, so jtok_elemidx_at can find any of them in O(1)
+ *
+ * @param idx element index set up by jtok_elemidx_init. Whatever it held
+ * before is dropped.
+ * @param arr the array token, in its token pool
+ * @return JTOK_PARSE_STATUS_t JTOK_PARSE_STATUS_OK,
+ * JTOK_PARSE_STATUS_NULL_PARAM, JTOK_PARSE_STATUS_NON_ARRAY if arr is not an
+ * array, or JTOK_PARSE_STATUS_NOMEM if idx is too small
+ */
+JTOK_PARSE_STATUS_t jtok_elemidx_build(jtok_elemidx_t *idx,
+                                       const jtok_tkn_t *arr);
+
+
+/**
+ * @brief Get element i of an array in O(1). An array of objects or arrays
+ * is indexed first if idx does not describe it yet, other arrays don't need
+ * the index at all.
+ *
+ * @param idx element index set up by jtok_elemidx_init
+ * @param arr the array token, in its token pool
+ * @param i index of the element
+ * @return int pool index of the element, or INVALID_ARRAY_INDEX. Same
+ * result as jtok_array_at. If idx is too small for arr the elements are
+ * walked instead.
+ *
+ * @note The index has to be built again (or dropped with jtok_elemidx_init)
+ * when the token pool is parsed into again.
+ */
+int jtok_elemidx_at(jtok_elemidx_t *idx, const jtok_tkn_t *arr, int i);
+
+
+/**
+ * @brief Set up an empty path with caller-provided storage
+ *
+ * @param path the path
+ * @param segs storage for the reference tokens of the path
+ * @param size number of entries in segs
+ */
+void jtok_path_init(jtok_path_t *path, jtok_path_seg_t *segs, size_t size);
+
+
+/**
+ * @brief Compile a JSON pointer (RFC 6901), such as "/wheels/0/pwm", so it
+ * can be matched against any number of parsed jsons with no further work on
+ * the path text.
+ *
+ * Each reference token is split out, hashed, and checked for an array index
+ * once. A reference token of just "*" is a wildcard that matches every
+ * member or element, so the pwm of every wheel is "/wheels/" "*" "/pwm".
+ *
+ * @param path path set up by jtok_path_init. Whatever it held before is
+ * dropped.
+ * @param str the pointer. "" is the whole json, anything else starts with
+ * '/'. Does not have to be nul-terminated.
+ * @param len length of str
+ * @return JTOK_PARSE_STATUS_t JTOK_PARSE_STATUS_OK,
+ * JTOK_PARSE_STATUS_NULL_PARAM, JTOK_PARSE_STATUS_INVAL if str is not a
+ * JSON pointer, or JTOK_PARSE_STATUS_NOMEM if path has too few segs
+ *
+ * @note The compiled path points into str, so str must outlive it. A key
+ * that is really "*" is matched by the wildcard along with the other keys.
+ */
+JTOK_PARSE_STATUS_t jtok_path_compile(jtok_path_t *path, const char *str,
+                                      size_t len);
+
+
+/**
+ * @brief Find the tokens a compiled path points to
+ *
+ * Keys are compared by hash first, so a parser set up with
+ * jtok_parser_set_hash_keys lets mismatched keys be skipped without reading
+ * the json. Elements of arrays of strings or primitives are found in O(1).
+ * No memory is allocated and nothing recurses: wildcards are backtracked
+ * through the parent links of the tokens.
+ *
+ * @param path path compiled by jtok_path_compile
+ * @param root the object or array the path starts from, in its token pool
+ * @param keys optional key map. If it describes an object on the way (it
+ * was built or used on it already) the key is looked up in it instead of
+ * walking the object. May be NULL.
+ * @param elems optional element index, used the same way for arrays of
+ * objects or arrays. May be NULL.
+ * @param matches receives the pool index of each match, in json order
+ * @param size number of entries in matches
+ * @return size_t number of matches written. Matching stops once matches is
+ * full, so a return of size means there may be more.
+ *
+ * @note As in jtok_obj_has_key, keys are compared with their text as it is
+ * in the json.
+ */
+size_t jtok_path_find(const jtok_path_t *path, const jtok_tkn_t *root,
+                      jtok_keymap_t *keys, jtok_elemidx_t *elems,
+                      int *matches, size_t size);
+
+
+/**
+ * @brief Find the first token a compiled path points to
+ *
+ * @param path path compiled by jtok_path_compile
+ * @param root the object or array the path starts from, in its token pool
+ * @return int pool index of the first match, or INVALID_ARRAY_INDEX
+ */
+int jtok_path_get(const jtok_path_t *path, const jtok_tkn_t *root);
+
+
 #ifdef __cplusplus
 }
 #endif
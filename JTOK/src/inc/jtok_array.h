@@ -8,24 +8,41 @@ extern "C"
 #endif /* Start C linkage */
 
 #include "../../inc/jtok.h"
+
 /**
- * @brief Parse and fill the next available jtok token as a jtok array,
- * recursing into sub-objects
+ * @brief Fill the next available jtok token as a jtok array and push a new
+ * frame onto the parser stack for it. The members of the array are parsed by
+ * jtok_array_step.
+ *
+ * @param parser the json parser, positioned on the opening '['
+ * @return JTOK_PARSE_STATUS_t parser status
+ */
+JTOK_PARSE_STATUS_t jtok_parse_array(jtok_parser_t *parser);
+
+
+/**
+ * @brief Handle the structural character at parser->pos for the array on top
+ * of the parser stack. Opening a nested object or array pushes a frame and
+ * the closing ']' pops this one.
  *
  * @param parser the json parser
- * @param depth the parse nesting depth
+ * @param frame the top frame of the parser stack
  * @return JTOK_PARSE_STATUS_t parser status
  */
-JTOK_PARSE_STATUS_t jtok_parse_array(jtok_parser_t *parser, int depth);
+JTOK_PARSE_STATUS_t jtok_array_step(jtok_parser_t *parser, jtok_frame_t *frame);
+
 
 /**
- * @brief Compare two jtok tokens with type JTOK_ARRAY for equality
+ * @brief Attach a nested object or array to the array once it has been closed
  *
- * @param tkn1 first token
- * @param tkn2 second token
- * @return true if equal
- * @return false if not equal
+ * @param parser the json parser
+ * @param frame the frame of the array
+ * @param child index of the nested token that was just closed
  */
+void jtok_array_child_closed(jtok_parser_t *parser, jtok_frame_t *frame,
+                             int child);
+
+
 bool jtok_toktokcmp_array(const jtok_tkn_t *tkn1, const jtok_tkn_t *tkn2);
 
 
@@ -0,0 +1,36 @@
+#ifndef __JTOK_DOUBLE_H__
+#define __JTOK_DOUBLE_H__
+#ifdef __cplusplus
+/* clang-format off */
+extern "C"
+{
+/* clang-format on */
+#endif /* Start C linkage */
+
+#include <stdbool.h>
+
+#include "../../inc/jtok.h"
+
+
+/**
+ * @brief Convert a json number to the nearest double
+ *
+ * The result is correctly rounded (round half to even) and does not depend
+ * on the locale. Numbers too large for a double become +-infinity and
+ * numbers too small become +-0.
+ *
+ * @param str the number. Does not need to be nul-terminated.
+ * @param len number of bytes in the number
+ * @param value receives the value
+ * @return true if all len bytes form a number
+ * @return false otherwise (value is left alone)
+ */
+bool jtok_atod(const char *str, int len, double *value);
+
+
+#ifdef __cplusplus
+/* clang-format off */
+}
+/* clang-format on */
+#endif /* End C linkage */
+#endif /* __JTOK_DOUBLE_H__ */
@@ -0,0 +1,115 @@
+#ifndef __JTOK_FSM_H__
+#define __JTOK_FSM_H__
+#ifdef __cplusplus
+/* clang-format off */
+extern "C"
+{
+/* clang-format on */
+#endif /* Start C linkage */
+
+#include <stdint.h>
+
+#include "../../inc/jtok.h"
+
+
+/* Classes of character the object and array state machines tell apart */
+typedef enum
+{
+    JTOK_CLASS_OTHER,        /* anything that can't appear here */
+    JTOK_CLASS_OBJECT_OPEN,  /* { */
+    JTOK_CLASS_ARRAY_OPEN,   /* [ */
+    JTOK_CLASS_OBJECT_CLOSE, /* } */
+    JTOK_CLASS_ARRAY_CLOSE,  /* ] */
+    JTOK_CLASS_QUOTE,        /* " */
+    JTOK_CLASS_COLON,        /* : */
+    JTOK_CLASS_COMMA,        /* , */
+    JTOK_CLASS_PRIMITIVE,    /* + - 0-9 t f n */
+    JTOK_CLASS_COUNT,
+} JTOK_CLASS_t;
+
+
+/* What an object or array expects to find next (jtok_frame_t.expecting) */
+typedef enum
+{
+    JTOK_STATE_OBJECT_KEY,
+    JTOK_STATE_OBJECT_COLON,
+    JTOK_STATE_OBJECT_VALUE,
+    JTOK_STATE_OBJECT_COMMA,
+    JTOK_STATE_ARRAY_START,
+    JTOK_STATE_ARRAY_VALUE,
+    JTOK_STATE_ARRAY_COMMA,
+    JTOK_STATE_COUNT,
+} JTOK_STATE_t;
+
+
+/* What to do with the character */
+typedef enum
+{
+    JTOK_ACTION_ERROR,          /* fail with the status of the transition */
+    JTOK_ACTION_ERROR_AT_START, /* same, with pos moved to the aggregate */
+    JTOK_ACTION_ERROR_AT_SUPER, /* same, with pos moved to parser->toksuper */
+    JTOK_ACTION_OPEN_OBJECT,    /* enter a nested object */
+    JTOK_ACTION_OPEN_ARRAY,     /* enter a nested array */
+    JTOK_ACTION_CLOSE,          /* close the aggregate */
+    JTOK_ACTION_KEY,            /* parse an object key */
+    JTOK_ACTION_STRING,         /* parse a string value */
+    JTOK_ACTION_PRIMITIVE,      /* parse a primitive value */
+    JTOK_ACTION_COLON,          /* key/value separator */
+    JTOK_ACTION_COMMA,          /* element separator */
+} JTOK_ACTION_t;
+
+
+typedef struct
+{
+    uint8_t action; /* JTOK_ACTION_t */
+    uint8_t status; /* JTOK_PARSE_STATUS_t of an error action */
+} jtok_transition_t;
+
+
+extern const uint8_t jtok_char_class[256];
+extern const jtok_transition_t
+    jtok_transitions[JTOK_STATE_COUNT][JTOK_CLASS_COUNT];
+
+
+/**
+ * @brief Look up what the state machine does with character c in a state
+ *
+ * @param state the JTOK_STATE_t of the object or array
+ * @param c the character at parser->pos
+ * @return jtok_transition_t the transition
+ */
+static inline jtok_transition_t jtok_fsm_next(int state, char c)
+{
+    return jtok_transitions[state][jtok_char_class[(unsigned char)c]];
+}
+
+
+/**
+ * @brief Report the status of an error transition, moving parser->pos to
+ * where the action says the error is
+ *
+ * @param parser the json parser
+ * @param frame the object or array being parsed
+ * @param next the error transition
+ * @return JTOK_PARSE_STATUS_t the status of the transition
+ */
+JTOK_PARSE_STATUS_t jtok_fsm_error(jtok_parser_t *parser,
+                                   const jtok_frame_t *frame,
+                                   jtok_transition_t next);
+
+
+/**
+ * @brief Close the object or array on top of the stack at parser->pos
+ *
+ * @param parser the json parser
+ * @param frame the object or array being closed
+ */
+void jtok_fsm_close(jtok_parser_t *parser, const jtok_frame_t *frame);
+
+
+#ifdef __cplusplus
+/* clang-format off */
+}
+/* clang-format on */
+#endif /* End C linkage */
+#endif /* __JTOK_FSM_H__ */
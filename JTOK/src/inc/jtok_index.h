@@ -0,0 +1,115 @@
+#ifndef __JTOK_INDEX_H__
+#define __JTOK_INDEX_H__
+#ifdef __cplusplus
+/* clang-format off */
+extern "C"
+{
+/* clang-format on */
+#endif /* Start C linkage */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../../inc/jtok.h"
+#include "jtok_shared.h"
+
+#define JTOK_INDEX_BLOCK_SIZE 64 /* bytes classified per structural bitmap */
+
+
+/* Brackets of a slice of json that are not matched inside the slice */
+typedef struct
+{
+    int closes; /* closing brackets of objects/arrays opened before the slice */
+    int opens;  /* brackets still open at the end of the slice */
+} jtok_index_nesting_t;
+
+
+/**
+ * @brief Classify a block of json into a bitmap of positions the parser
+ * has to visit.
+ *
+ * Bit i is set if buf[i] is a structural character ({}[]:,), an opening
+ * quote, or the first byte of a primitive (or of any other run of
+ * non-whitespace bytes). Whitespace and string bodies are masked out.
+ *
+ * @param buf start of the block. Must be outside of a string.
+ * @param n number of bytes to classify (at most JTOK_INDEX_BLOCK_SIZE).
+ * No byte past buf[n - 1] is read.
+ * @return uint64_t the structural bitmap
+ */
+uint64_t jtok_index_block(const char *buf, unsigned int n);
+
+
+/**
+ * @brief Count the tokens in a json document without parsing it, by
+ * counting the bytes that start a token: '{', '[', opening quotes and the
+ * first byte of each primitive outside of strings.
+ *
+ * @param json the json
+ * @param len number of bytes of json
+ * @return size_t number of tokens. Exact for valid json. For invalid json
+ * it is only an estimate, since the grammar is not checked.
+ */
+size_t jtok_index_count(const char *json, size_t len);
+
+
+/**
+ * @brief Find the next position at or after from that the parser has to
+ * look at, classifying the json one block at a time as the parser advances.
+ *
+ * @param parser the json parser
+ * @param from first candidate position. Must be outside of a string.
+ * @return int the next indexed position, or parser->json_len if there is none
+ */
+int jtok_index_scan(jtok_parser_t *parser, int from);
+
+
+/**
+ * @brief Find the brackets of a slice cut from anywhere in a json document
+ * that are not matched inside the slice. Whether the slice starts inside a
+ * string isn't known until the slices before it have been looked at, so the
+ * brackets are found for both cases in the same pass.
+ *
+ * @param json the json the slice is cut from
+ * @param start offset of the first byte of the slice
+ * @param end offset one past the last byte of the slice
+ * @param nest receives the unmatched brackets. nest[0] is for a slice that
+ * starts outside of a string and nest[1] for one that starts inside.
+ * @param open_pos receives the positions of the brackets left open, oldest
+ * first, open_pos[s] for nest[s]. Each has room for max_open positions.
+ * @param max_open room in each open_pos. If nest[s].opens ends up bigger,
+ * open_pos[s] is incomplete.
+ * @return true if the slice holds an odd number of unescaped quotes, so the
+ * string state at its end is the opposite of the one at its start
+ * @return false otherwise
+ */
+bool jtok_index_nesting(const char *json, size_t start, size_t end,
+                        jtok_index_nesting_t nest[2], int *open_pos[2],
+                        int max_open);
+
+
+/**
+ * @brief Same as jtok_index_scan, but answers from the current block without
+ * a function call when it can.
+ */
+static inline int jtok_index_next(jtok_parser_t *parser, int from)
+{
+    if (from >= parser->idx_base && from < parser->idx_end)
+    {
+        uint64_t bits = parser->idx_bits >> (from - parser->idx_base);
+        if (bits != 0)
+        {
+            return from + jtok_ctz64(bits);
+        }
+    }
+    return jtok_index_scan(parser, from);
+}
+
+
+#ifdef __cplusplus
+/* clang-format off */
+}
+/* clang-format on */
+#endif /* End C linkage */
+#endif /* __JTOK_INDEX_H__ */
@@ -12,14 +12,37 @@ extern "C"
 #include "../../inc/jtok.h"
 
 /**
- * @brief Parse and fill the next available jtok token as a jtok object,
- * recursing into sub-objects
+ * @brief Fill the next available jtok token as a jtok object and push a new
+ * frame onto the parser stack for it. The members of the object are parsed by
+ * jtok_object_step.
+ *
+ * @param parser the json parser, positioned on the opening '{'
+ * @return JTOK_PARSE_STATUS_t parser status
+ */
+JTOK_PARSE_STATUS_t jtok_parse_object(jtok_parser_t *parser);
+
+
+/**
+ * @brief Handle the structural character at parser->pos for the object on top
+ * of the parser stack. Opening a nested object or array pushes a frame and
+ * the closing '}' pops this one.
  *
  * @param parser the json parser
- * @param depth the parse nesting depth
+ * @param frame the top frame of the parser stack
  * @return JTOK_PARSE_STATUS_t parser status
  */
-JTOK_PARSE_STATUS_t jtok_parse_object(jtok_parser_t *parser, int depth);
+JTOK_PARSE_STATUS_t jtok_object_step(jtok_parser_t *parser, jtok_frame_t *frame);
+
+
+/**
+ * @brief Attach a nested object or array to the object once it has been closed
+ *
+ * @param parser the json parser
+ * @param frame the frame of the object
+ * @param child index of the nested token that was just closed
+ */
+void jtok_object_child_closed(jtok_parser_t *parser, jtok_frame_t *frame,
+                              int child);
 
 
 /**
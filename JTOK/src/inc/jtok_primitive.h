@@ -19,6 +19,18 @@ extern "C"
  */
 JTOK_PARSE_STATUS_t jtok_parse_primitive(jtok_parser_t *parser);
 
+/**
+ * @brief Work out the value subtype of a primitive and decode it
+ *
+ * @param js the json
+ * @param start start of the primitive
+ * @param end end of the primitive
+ * @param value receives the value
+ * @return JTOK_VALUE_TYPE_t the value subtype
+ */
+JTOK_VALUE_TYPE_t jtok_primitive_value(const char *js, int start, int end,
+                                       jtok_value_t *value);
+
 /**
  * @brief Compare two jtok tokens with type JTOK_PRIMITIVE for equality
  *
@@ -8,6 +8,8 @@ extern "C"
 #endif /* Start C linkage */
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 
 #include "../../inc/jtok.h"
 
@@ -17,15 +19,151 @@ extern "C"
 
 #define HEXCHAR_ESCAPE_SEQ_COUNT 4 /* can escape 4 hex chars such as \uffea */
 
+/* Vector instruction set used by the scanning fast paths.
+ * Define JTOK_NO_SIMD to force the portable scalar code */
+#if !defined(JTOK_NO_SIMD) && defined(__AVX2__)
+#define JTOK_SIMD_AVX2
+#include <immintrin.h>
+#elif !defined(JTOK_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#define JTOK_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+
+/* Without -mavx2, gcc and clang on x86-64 still build the AVX2 string
+ * scanner, for CPUs that turn out to have it at run time */
+#if defined(JTOK_SIMD_SSE2) && defined(__x86_64__) &&                          \
+    (defined(__GNUC__) || defined(__clang__))
+#define JTOK_SIMD_AVX2_DISPATCH
+#include <immintrin.h>
+#define JTOK_AVX2_FN __attribute__((target("avx2")))
+#define jtok_cpu_has_avx2() __builtin_cpu_supports("avx2")
+#else
+#define JTOK_AVX2_FN
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define jtok_ctz64(x) __builtin_ctzll(x)
+#define jtok_clz64(x) __builtin_clzll(x)
+#define jtok_popcount64(x) __builtin_popcountll(x)
+#else
+static inline int jtok_ctz64(uint64_t x)
+{
+    int n = 0;
+    while ((x & 1) == 0)
+    {
+        x >>= 1;
+        n++;
+    }
+    return n;
+}
+
+static inline int jtok_clz64(uint64_t x)
+{
+    int n = 0;
+    while ((x & ((uint64_t)1 << 63)) == 0)
+    {
+        x <<= 1;
+        n++;
+    }
+    return n;
+}
+
+static inline int jtok_popcount64(uint64_t x)
+{
+    int n = 0;
+    while (x != 0)
+    {
+        x &= x - 1;
+        n++;
+    }
+    return n;
+}
+#endif
+
+
 /**
- * @brief Allocate fresh token from the token pool
+ * @brief Check for json whitespace: space, tab, newline and carriage return,
+ * the same bytes the structural indexer skips. Unlike isspace this takes
+ * any char and does not depend on the locale.
+ */
+static inline bool jtok_is_whitespace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+/* Pool size of the first allocation when a parser grows its pool */
+#define JTOK_POOL_GROW_MIN 16
+
+/* Pool slots per nesting level of a validating parser: the object or array,
+ * its current key and the value after it */
+#define JTOK_PATH_SLOTS_PER_LEVEL 3
+
+/* Layout of jtok_tape_tkn_t.info */
+#define JTOK_TAPE_TYPE_SHIFT 29
+#define JTOK_TAPE_KEYVAL_FLAG ((uint32_t)1 << 28) /* string key has a value */
+#define JTOK_TAPE_VALUE_MASK (JTOK_TAPE_KEYVAL_FLAG - 1) /* length or size */
+
+
+/**
+ * @brief Load 8 bytes as a little-endian word, whatever the byte order of
+ * the machine, so hashes can be worked out on one machine and used on
+ * another
+ */
+static inline uint64_t jtok_load_le64(const char *str, size_t len)
+{
+    uint64_t w = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(&w, str, len);
+#else
+    size_t i;
+    for (i = 0; i < len; i++)
+    {
+        w |= (uint64_t)(unsigned char)str[i] << (8 * i);
+    }
+#endif
+    return w;
+}
+
+
+/**
+ * @brief Hash len bytes of key text, 8 bytes at a time. The hash is the
+ * same on every machine.
+ *
+ * @param str the text
+ * @param len its length
+ * @return uint32_t the hash
+ */
+static inline uint32_t jtok_hash(const char *str, size_t len)
+{
+    const uint64_t mul = 0x9E3779B97F4A7C15ull;
+    uint64_t       h   = len * mul;
+    while (len >= sizeof(uint64_t))
+    {
+        h = (h ^ jtok_load_le64(str, sizeof(uint64_t))) * mul;
+        h ^= h >> 29;
+        str += sizeof(uint64_t);
+        len -= sizeof(uint64_t);
+    }
+    if (len > 0)
+    {
+        h = (h ^ jtok_load_le64(str, len)) * mul;
+        h ^= h >> 29;
+    }
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+
+/**
+ * @brief Allocate fresh token from the token pool (or tape) and fill it.
+ * The parent of the new token is the parser's current superior token.
  *
- * @param parser
- * @param tokens
- * @param num_tokens
- * @return jtok_tkn_t*
+ * @param parser the json parser
+ * @param type the token type
+ * @param start start index
+ * @param end end index (INVALID_ARRAY_INDEX if not known yet)
+ * @return int index of the new token, INVALID_ARRAY_INDEX if out of tokens
  */
-jtok_tkn_t *jtok_alloc_token(jtok_parser_t *parser);
+int jtok_new_token(jtok_parser_t *parser, JTOK_TYPE_t type, int start, int end);
 
 /**
  * @brief Fill jtok_token type and boundaries
@@ -40,6 +178,188 @@ jtok_tkn_t *jtok_alloc_token(jtok_parser_t *parser);
 int jtok_fill_token(jtok_tkn_t *token, JTOK_TYPE_t type, int start, int end);
 
 
+/*
+ * The parser only touches tokens through the accessors below, so the same
+ * state machine can fill either a jtok_tkn_t pool or a compact jtok tape.
+ */
+
+static inline JTOK_TYPE_t jtok_token_type(const jtok_parser_t *parser, int idx)
+{
+    if (parser->tape != NULL)
+    {
+        return (JTOK_TYPE_t)(parser->tape->tkns[idx].info >>
+                             JTOK_TAPE_TYPE_SHIFT);
+    }
+    return parser->tkn_pool[idx].type;
+}
+
+static inline int jtok_token_size(const jtok_parser_t *parser, int idx)
+{
+    if (parser->tape != NULL)
+    {
+        uint32_t info = parser->tape->tkns[idx].info;
+        if ((JTOK_TYPE_t)(info >> JTOK_TAPE_TYPE_SHIFT) == JTOK_STRING)
+        {
+            return (info & JTOK_TAPE_KEYVAL_FLAG) ? 1 : 0;
+        }
+        else
+        {
+            return info & JTOK_TAPE_VALUE_MASK;
+        }
+    }
+    return parser->tkn_pool[idx].size;
+}
+
+static inline int jtok_token_start(const jtok_parser_t *parser, int idx)
+{
+    if (parser->tape != NULL)
+    {
+        return parser->tape->tkns[idx].start;
+    }
+    return parser->tkn_pool[idx].start;
+}
+
+static inline int jtok_token_parent(const jtok_parser_t *parser, int idx)
+{
+    if (parser->tape != NULL)
+    {
+        return (int)parser->tape->tkns[idx].parent;
+    }
+    return parser->tkn_pool[idx].parent;
+}
+
+/**
+ * @brief Record the value subtype of token idx. The tape has no room for it.
+ */
+static inline void jtok_token_set_value_type(jtok_parser_t *parser, int idx,
+                                             JTOK_VALUE_TYPE_t value_type)
+{
+    if (parser->tape == NULL)
+    {
+        parser->tkn_pool[idx].value_type = value_type;
+    }
+}
+
+/**
+ * @brief Count a new child (or, for a key, its value) under token idx
+ */
+static inline void jtok_token_add_child(jtok_parser_t *parser, int idx)
+{
+    if (parser->tape != NULL)
+    {
+        jtok_tape_tkn_t *tkn = &parser->tape->tkns[idx];
+        if ((JTOK_TYPE_t)(tkn->info >> JTOK_TAPE_TYPE_SHIFT) == JTOK_STRING)
+        {
+            tkn->info |= JTOK_TAPE_KEYVAL_FLAG;
+        }
+        else
+        {
+            tkn->info++;
+        }
+    }
+    else
+    {
+        parser->tkn_pool[idx].size++;
+    }
+}
+
+/**
+ * @brief Record the end of an object or array once its closing bracket has
+ * been found. The subtree of the token ends here too.
+ */
+static inline void jtok_token_close(jtok_parser_t *parser, int idx, int end)
+{
+    if (parser->tape != NULL)
+    {
+        parser->tape->tkns[idx].next = parser->toknext;
+    }
+    else
+    {
+        parser->tkn_pool[idx].end  = end;
+        parser->tkn_pool[idx].next = parser->toknext;
+    }
+}
+
+/**
+ * @brief Link token idx to its next sibling (NO_SIBLING_IDX if it is the
+ * last child of its parent). Either way the subtree of idx is complete.
+ */
+static inline void jtok_token_link(jtok_parser_t *parser, int idx, int sibling)
+{
+    /* The next sibling starts where the subtree of idx ends */
+    int next = (sibling == NO_SIBLING_IDX) ? parser->toknext : sibling;
+    if (parser->tape != NULL)
+    {
+        parser->tape->tkns[idx].next = next;
+    }
+    else
+    {
+        parser->tkn_pool[idx].sibling = sibling;
+        parser->tkn_pool[idx].next    = next;
+    }
+}
+
+
+/**
+ * @brief Push a frame for the object or array token tkn onto the parser stack.
+ * The caller must have checked that the stack has room.
+ */
+static inline jtok_frame_t *jtok_push_frame(jtok_parser_t *parser,
+                                            JTOK_TYPE_t type, int tkn)
+{
+    jtok_frame_t *frame = &parser->stack[parser->depth++];
+    frame->tkn          = tkn;
+    frame->last_child   = NO_CHILD_IDX;
+    frame->type         = type;
+    frame->expecting    = 0;
+    frame->element_type = JTOK_UNASSIGNED_TOKEN;
+    return frame;
+}
+
+
+/**
+ * @brief Pick up the scan of a string or primitive that starts at
+ * parser->pos and was cut off by the end of the json on an earlier call.
+ *
+ * @param parser the json parser
+ * @param flags if not NULL, receives the scanner flags saved with the token
+ * @return int position to continue scanning from, or INVALID_ARRAY_INDEX if
+ * the token at parser->pos has to be scanned from the start
+ */
+static inline int jtok_resume_token(jtok_parser_t *parser, int *flags)
+{
+    int resume = INVALID_ARRAY_INDEX;
+    if (parser->tok_start == parser->pos)
+    {
+        resume = parser->tok_resume;
+        if (flags != NULL)
+        {
+            *flags = parser->tok_flags;
+        }
+    }
+    parser->tok_start = INVALID_ARRAY_INDEX;
+    return resume;
+}
+
+
+/**
+ * @brief Save how far the scan of a string or primitive got when it ran
+ * into the end of the json, so jtok_parser_feed can continue it.
+ *
+ * @param parser the json parser
+ * @param start position of the first character of the token
+ * @param resume position to continue scanning from
+ * @param flags scanner flags to restore when the scan continues
+ */
+static inline void jtok_suspend_token(jtok_parser_t *parser, int start,
+                                      int resume, int flags)
+{
+    parser->tok_start  = start;
+    parser->tok_resume = resume;
+    parser->tok_flags  = flags;
+}
+
+
 #ifdef __cplusplus
 /* clang-format off */
 }
@@ -18,6 +18,17 @@ extern "C"
 JTOK_PARSE_STATUS_t jtok_parse_string(jtok_parser_t *parser);
 
 
+/**
+ * @brief Work out the JTOK_TKN_FLAG_ESCAPED and JTOK_TKN_FLAG_ASCII flags of
+ * string text the parser did not record them for
+ *
+ * @param str the string (between the quotes)
+ * @param len its length
+ * @return unsigned int the flags
+ */
+unsigned int jtok_string_flags(const char *str, int len);
+
+
 /**
  * @brief Compare two jtok tokens with type JTOK_STRING for equality
  *
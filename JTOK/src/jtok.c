@@ -13,7 +13,6 @@
 #include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <ctype.h>
 #include <string.h>
 
 #include "../inc/jtok.h"
@@ -22,13 +21,16 @@
 #include "inc/jtok_primitive.h"
 #include "inc/jtok_string.h"
 #include "inc/jtok_shared.h"
+#include "inc/jtok_index.h"
 
 typedef bool (*tkn_comparison_func)(const jtok_tkn_t *const,
                                     const jtok_tkn_t *const);
 
-static jtok_parser_t jtok_new_parser(const char *json_str, jtok_tkn_t *tokens,
-                                     unsigned int poolsize);
-static bool          jtok_is_type_aggregate(const jtok_tkn_t *const tkn);
+static void jtok_reset_parser(jtok_parser_t *parser, const char *json_str,
+                              size_t len);
+static bool jtok_is_type_aggregate(const jtok_tkn_t *const tkn);
+static bool jtok_parser_counting(const jtok_parser_t *parser);
+static JTOK_PARSE_STATUS_t jtok_parse_top(jtok_parser_t *parser, bool last);
 
 
 char *jtok_toktypename(JTOK_TYPE_t type)
@@ -90,6 +92,8 @@ static const char *jtokerr_messages[] = {
     [JTOK_PARSE_STATUS_VAL_NO_COMMA]     = "JTOK_PARSE_STATUS_VAL_NO_COMMA",
     [JTOK_PARSE_STATUS_NON_ARRAY]        = "JTOK_PARSE_STATUS_NON_ARRAY",
     [JTOK_PARSE_STATUS_EMPTY_KEY]        = "JTOK_PARSE_STATUS_EMPTY_KEY",
+    [JTOK_PARSE_STATUS_INVALID_UTF8]     = "JTOK_PARSE_STATUS_INVALID_UTF8",
+    [JTOK_PARSE_STATUS_TOO_LONG]         = "JTOK_PARSE_STATUS_TOO_LONG",
 };
 
 char *jtok_jtokerr_messages(JTOK_PARSE_STATUS_t err)
@@ -119,6 +123,8 @@ char *jtok_jtokerr_messages(JTOK_PARSE_STATUS_t err)
         case JTOK_PARSE_STATUS_VAL_NO_COMMA:
         case JTOK_PARSE_STATUS_NON_ARRAY:
         case JTOK_PARSE_STATUS_EMPTY_KEY:
+        case JTOK_PARSE_STATUS_INVALID_UTF8:
+        case JTOK_PARSE_STATUS_TOO_LONG:
         {
             retval = (char *)jtokerr_messages[err];
         }
@@ -148,6 +154,29 @@ uint_least16_t jtok_toklen(const jtok_tkn_t *tok)
 }
 
 
+const char *jtok_tokview(const jtok_tkn_t *tkn, size_t *len)
+{
+    const char *view = NULL;
+    if (tkn != NULL && len != NULL)
+    {
+        view = &tkn->json[tkn->start];
+        *len = (size_t)(tkn->end - tkn->start);
+    }
+    return view;
+}
+
+
+int jtok_tok_next(const jtok_tkn_t *tkn)
+{
+    int next = INVALID_ARRAY_INDEX;
+    if (tkn != NULL)
+    {
+        next = tkn->next;
+    }
+    return next;
+}
+
+
 bool jtok_tokcmp(const char *str, const jtok_tkn_t *tok)
 {
     bool result = false;
@@ -167,47 +196,69 @@ bool jtok_tokcmp(const char *str, const jtok_tkn_t *tok)
     }
     else
     {
-        uint_least16_t least_size = jtok_toklen(tok);
-        uint_least16_t slen       = strlen(str);
-        if (least_size < slen)
+        /* Only look at the token's own bytes. The json after the token may
+         * not be ours to read */
+        uint_least16_t toklen = jtok_toklen(tok);
+        size_t         slen   = strlen(str);
+        if (slen == toklen &&
+            memcmp(str, &tok->json[tok->start], toklen) == 0)
+        {
+            result = true;
+        }
+        else
         {
-            least_size = slen;
+            result = false;
         }
+    }
+    return result;
+}
+
+uint32_t jtok_hash_key(const char *key, size_t len)
+{
+    return (key != NULL) ? jtok_hash(key, len) : 0;
+}
 
-        /* actually compare them */
-        if (strncmp((const char *)str, (char *)&tok->json[tok->start],
-                    least_size) == 0)
+
+bool jtok_tokcmp_hash(const char *str, size_t len, uint32_t hash,
+                      const jtok_tkn_t *tok)
+{
+    bool result = false;
+    if (str != NULL && tok != NULL && tok->json != NULL)
+    {
+        if ((tok->flags & JTOK_TKN_FLAG_HASHED) && tok->hash != hash)
         {
-            result = true;
+            result = false;
         }
         else
         {
-            result = false;
+            result = (size_t)(tok->end - tok->start) == len &&
+                     memcmp(str, &tok->json[tok->start], len) == 0;
         }
     }
     return result;
 }
 
+
 bool jtok_tokncmp(const char *str, const jtok_tkn_t *tok, uint_least16_t n)
 {
     bool result = false;
     if (str != NULL && tok != NULL && tok->json != NULL)
     {
-        uint_least16_t least_size = jtok_toklen(tok);
-        uint_least16_t slen       = strlen(str);
-        if (least_size < slen)
+        uint_least16_t toklen = jtok_toklen(tok);
+        size_t         slen   = strlen(str);
+        if (toklen > n)
         {
-            least_size = slen;
+            toklen = n;
         }
 
-        if (least_size < n)
+        if (slen > n)
         {
-            least_size = n;
+            slen = n;
         }
 
-        /* actually compare them */
-        if (strncmp((const char *)str, (char *)&tok->json[tok->start],
-                    least_size) == 0)
+        /* Same as strncmp against the token, without reading past it */
+        if (slen == toklen &&
+            memcmp(str, &tok->json[tok->start], toklen) == 0)
         {
             result = true;
         }
@@ -230,7 +281,7 @@ char *jtok_tokcpy(char *dst, uint_least16_t bufsize, const jtok_tkn_t *tkn)
         {
             copy_count = bufsize;
         }
-        result = strncpy(dst, (char *)&tkn->json[tkn->start], copy_count);
+        result = memcpy(dst, &tkn->json[tkn->start], copy_count);
     }
     return result;
 }
@@ -287,6 +338,22 @@ bool isValidJson(const jtok_tkn_t *tokens, uint_least8_t tcnt)
 
 
 JTOK_PARSE_STATUS_t jtok_parse(const char *json, jtok_tkn_t *tkns, size_t size)
+{
+    JTOK_PARSE_STATUS_t status;
+    if (NULL == json)
+    {
+        status = JTOK_PARSE_STATUS_NULL_PARAM;
+    }
+    else
+    {
+        status = jtok_parse_n(json, strlen(json), tkns, size);
+    }
+    return status;
+}
+
+
+JTOK_PARSE_STATUS_t jtok_parse_n(const char *json, size_t len, jtok_tkn_t *tkns,
+                                 size_t size)
 {
     JTOK_PARSE_STATUS_t status;
     if (NULL == json)
@@ -303,19 +370,265 @@ JTOK_PARSE_STATUS_t jtok_parse(const char *json, jtok_tkn_t *tkns, size_t size)
     }
     else
     {
-        jtok_parser_t parser = jtok_new_parser(json, tkns, size);
+        jtok_frame_t  stack[JTOK_MAX_RECURSE_DEPTH + 1];
+        jtok_parser_t parser;
+        jtok_parser_init(&parser, tkns, size, stack,
+                         sizeof(stack) / sizeof(*stack));
+        status = jtok_parser_parse(&parser, json, len);
+    }
+    return status;
+}
 
-        /* Skip leading whitespace */
-        while (isspace((int)json[parser.pos]))
+
+JTOK_PARSE_STATUS_t jtok_validate(const char *json, size_t len)
+{
+    JTOK_PARSE_STATUS_t status;
+    if (NULL == json)
+    {
+        status = JTOK_PARSE_STATUS_NULL_PARAM;
+    }
+    else
+    {
+        jtok_frame_t  stack[JTOK_MAX_RECURSE_DEPTH + 1];
+        jtok_tkn_t    path[(JTOK_MAX_RECURSE_DEPTH + 1) *
+                           JTOK_PATH_SLOTS_PER_LEVEL];
+        jtok_parser_t parser;
+        jtok_parser_init(&parser, path, sizeof(path) / sizeof(*path), stack,
+                         sizeof(stack) / sizeof(*stack));
+        parser.validating = true;
+        status            = jtok_parser_parse(&parser, json, len);
+    }
+    return status;
+}
+
+
+JTOK_PARSE_STATUS_t jtok_tape_parse(jtok_tape_t *tape, const char *json,
+                                    size_t len)
+{
+    JTOK_PARSE_STATUS_t status;
+    if (NULL == json || NULL == tape || NULL == tape->tkns)
+    {
+        status = JTOK_PARSE_STATUS_NULL_PARAM;
+    }
+    else if (tape->size < 1)
+    {
+        status = JTOK_PARSE_STATUS_NOMEM;
+    }
+    else
+    {
+        jtok_frame_t  stack[JTOK_MAX_RECURSE_DEPTH + 1];
+        jtok_parser_t parser;
+        jtok_parser_init(&parser, NULL, 0, stack,
+                         sizeof(stack) / sizeof(*stack));
+        parser.tape = tape;
+        tape->json  = json;
+        tape->count = 0;
+        status      = jtok_parser_parse(&parser, json, len);
+    }
+    return status;
+}
+
+
+void jtok_parser_init(jtok_parser_t *parser, jtok_tkn_t *tkns, size_t size,
+                      jtok_frame_t *stack, size_t depth)
+{
+    if (parser != NULL)
+    {
+        parser->tkn_pool   = tkns;
+        parser->values     = NULL;
+        parser->tape       = NULL;
+        parser->validating = false;
+        parser->unescape   = false;
+        parser->hash_keys  = false;
+        parser->pool_size  = size;
+        parser->realloc_fn = NULL;
+        parser->alloc_ctx  = NULL;
+        parser->stack      = stack;
+        parser->stack_size = depth;
+        jtok_reset_parser(parser, NULL, 0);
+    }
+}
+
+
+void jtok_parser_set_allocator(jtok_parser_t *parser,
+                               jtok_realloc_func realloc_fn, void *ctx)
+{
+    if (parser != NULL)
+    {
+        parser->realloc_fn = realloc_fn;
+        parser->alloc_ctx  = ctx;
+    }
+}
+
+
+void jtok_parser_set_values(jtok_parser_t *parser, jtok_value_t *values)
+{
+    if (parser != NULL)
+    {
+        parser->values = values;
+    }
+}
+
+
+void jtok_parser_set_unescape(jtok_parser_t *parser, bool unescape)
+{
+    if (parser != NULL)
+    {
+        parser->unescape = unescape;
+    }
+}
+
+
+void jtok_parser_set_hash_keys(jtok_parser_t *parser, bool hash_keys)
+{
+    if (parser != NULL)
+    {
+        parser->hash_keys = hash_keys;
+    }
+}
+
+
+/**
+ * @brief Parse the whole json in one call
+ *
+ * @param parser the json parser
+ * @param json the json
+ * @param len number of bytes of json
+ * @param writable the caller handed over writable json, so strings may be
+ * decoded in it
+ * @return JTOK_PARSE_STATUS_t parse status
+ */
+static JTOK_PARSE_STATUS_t jtok_parser_run(jtok_parser_t *parser,
+                                           const char *json, size_t len,
+                                           bool writable)
+{
+    JTOK_PARSE_STATUS_t status;
+    if (NULL == parser || NULL == json || NULL == parser->stack)
+    {
+        status = JTOK_PARSE_STATUS_NULL_PARAM;
+    }
+    else if (len > INT_MAX)
+    {
+        /* Token boundaries are stored as int */
+        status = JTOK_PARSE_STATUS_TOO_LONG;
+    }
+    else if (jtok_parser_counting(parser))
+    {
+        jtok_reset_parser(parser, json, len);
+        parser->toknext = jtok_index_count(json, len);
+        status          = JTOK_PARSE_STATUS_OK;
+    }
+    else
+    {
+        jtok_reset_parser(parser, json, len);
+        parser->writable = writable;
+        status           = jtok_parse_top(parser, true);
+    }
+    return status;
+}
+
+
+JTOK_PARSE_STATUS_t jtok_parser_parse(jtok_parser_t *parser, const char *json,
+                                      size_t len)
+{
+    return jtok_parser_run(parser, json, len, false);
+}
+
+
+JTOK_PARSE_STATUS_t jtok_parser_parse_inplace(jtok_parser_t *parser,
+                                              char *json, size_t len)
+{
+    return jtok_parser_run(parser, json, len, true);
+}
+
+
+JTOK_PARSE_STATUS_t jtok_parser_feed(jtok_parser_t *parser, const char *chunk,
+                                     size_t len)
+{
+    JTOK_PARSE_STATUS_t status;
+    if (NULL == parser || NULL == chunk || NULL == parser->stack)
+    {
+        status = JTOK_PARSE_STATUS_NULL_PARAM;
+    }
+    else if (jtok_parser_counting(parser))
+    {
+        /* Counting mode needs the whole json at once */
+        status = JTOK_PARSE_STATUS_NULL_PARAM;
+    }
+    else if (parser->json != NULL &&
+             chunk != parser->json + parser->json_len)
+    {
+        /* Tokens are positions in one buffer, so chunks cannot be moved */
+        status = JTOK_PARSE_STATUS_INVAL;
+    }
+    else if (len > (size_t)(INT_MAX - parser->json_len))
+    {
+        /* Token boundaries are stored as int */
+        status = JTOK_PARSE_STATUS_TOO_LONG;
+    }
+    else
+    {
+        if (parser->json == NULL)
         {
-            parser.pos++;
+            parser->json = (char *)chunk;
         }
-        status = jtok_parse_object(&parser, 0);
+        parser->json_len += len;
+        status = jtok_parse_top(parser, false);
     }
     return status;
 }
 
 
+bool jtok_parse_many(jtok_parser_t *parser, const char *json, size_t len,
+                     size_t *offset, jtok_doc_t *doc)
+{
+    if (NULL == parser || NULL == json || NULL == offset || NULL == doc ||
+        NULL == parser->stack || jtok_parser_counting(parser) ||
+        len > INT_MAX)
+    {
+        return false;
+    }
+
+    /* Skip the whitespace (and newlines) between documents */
+    size_t start = *offset;
+    while (start < len && jtok_is_whitespace(json[start]))
+    {
+        start++;
+    }
+
+    if (start >= len)
+    {
+        *offset = len;
+        return false;
+    }
+
+    /* Every document restarts the token sink, but keeps its positions
+     * relative to the whole buffer */
+    jtok_reset_parser(parser, json, len);
+    if (parser->tape != NULL)
+    {
+        parser->tape->json  = json;
+        parser->tape->count = 0;
+    }
+    parser->next_pos = (int)start;
+
+    doc->start  = start;
+    doc->status = jtok_parse_top(parser, true);
+    if (doc->status == JTOK_PARSE_STATUS_OK)
+    {
+        doc->end = (size_t)parser->next_pos;
+    }
+    else
+    {
+        /* Resynchronize on the next line */
+        const char *newline = memchr(&json[start], '\n', len - start);
+        doc->end = (newline != NULL) ? (size_t)(newline - json) : len;
+    }
+    *offset = doc->end;
+    return true;
+}
+
+
 bool jtok_tokenIsKey(jtok_tkn_t token)
 {
     if (token.type == JTOK_STRING)
@@ -362,9 +675,9 @@ int jtok_token_tostr(char *buf, unsigned int size, const char *json,
 bool jtok_toktokcmp(const jtok_tkn_t *tkn1, const jtok_tkn_t *tkn2)
 {
     bool is_equal = false;
-    if (tkn1->type == tkn2->type)
+    if (tkn1->type == tkn2->type && tkn1->type != JTOK_UNASSIGNED_TOKEN)
     {
-        return tokcmp_funcs[tkn1->type];
+        is_equal = tokcmp_funcs[tkn1->type](tkn1, tkn2);
     }
     return is_equal;
 }
@@ -376,7 +689,9 @@ int jtok_obj_has_key(const jtok_tkn_t *obj, const char *key_str)
     if (obj->type == JTOK_OBJECT)
     {
         size_t      i;
-        jtok_tkn_t *tkns = obj->pool;
+        size_t      key_len  = strlen(key_str);
+        uint32_t    key_hash = jtok_hash(key_str, key_len);
+        jtok_tkn_t *tkns     = obj->pool;
         jtok_tkn_t *key_tkn;
         if (obj->size > 0)
         {
@@ -385,10 +700,9 @@ int jtok_obj_has_key(const jtok_tkn_t *obj, const char *key_str)
             {
                 /* If size is nonzero, first key of object will be RIGHT AFTER
                  */
-                if (jtok_tokcmp(key_str, key_tkn))
+                if (jtok_tokcmp_hash(key_str, key_len, key_hash, key_tkn))
                 {
                     key_idx = key_tkn - tkns;
-                    key_idx = key_idx / sizeof(*key_tkn);
                     break;
                 }
                 else
@@ -409,19 +723,125 @@ int jtok_obj_has_key(const jtok_tkn_t *obj, const char *key_str)
 }
 
 
-static jtok_parser_t jtok_new_parser(const char *json_str, jtok_tkn_t *tokens,
-                                     unsigned int poolsize)
+/**
+ * @brief Point the parser at new json and forget any previous parse. The
+ * token sink and the stack are left alone.
+ */
+static void jtok_reset_parser(jtok_parser_t *parser, const char *json_str,
+                              size_t len)
+{
+    parser->pos       = 0;
+    parser->next_pos  = 0;
+    parser->toknext   = 0;
+    parser->toksuper  = NO_PARENT_IDX;
+    parser->json      = (char *)json_str;
+    parser->json_len  = len;
+    parser->writable  = false;
+    parser->depth     = 0;
+    parser->tok_start = INVALID_ARRAY_INDEX;
+    parser->idx_bits  = 0;
+    parser->idx_base  = 0;
+    parser->idx_end   = 0;
+}
+
+
+/**
+ * @brief Check if a parser has nowhere to put tokens, so it only counts them
+ */
+static bool jtok_parser_counting(const jtok_parser_t *parser)
+{
+    return parser->tkn_pool == NULL && parser->tape == NULL &&
+           parser->realloc_fn == NULL;
+}
+
+
+/**
+ * @brief Parse the top-level object of the json the parser was set up with,
+ * continuing from wherever the previous call ran out of json.
+ *
+ * Objects and arrays are not parsed by recursion. Each open one has a frame
+ * on the parser stack and the structural character at the current position
+ * is handed to the state machine of the innermost one.
+ *
+ * @param parser the json parser
+ * @param last true if no more json will follow
+ * @return JTOK_PARSE_STATUS_t parse status
+ */
+static JTOK_PARSE_STATUS_t jtok_parse_top(jtok_parser_t *parser, bool last)
 {
-    jtok_parser_t parser;
-    parser.pos        = 0;
-    parser.toknext    = 0;
-    parser.toksuper   = NO_PARENT_IDX;
-    parser.json       = (char *)json_str;
-    parser.json_len   = strlen(json_str);
-    parser.last_child = NO_CHILD_IDX;
-    parser.tkn_pool   = tokens;
-    parser.pool_size  = poolsize;
-    return parser;
+    JTOK_PARSE_STATUS_t status = JTOK_PARSE_STATUS_OK;
+
+    if (parser->depth == 0 && parser->toknext == 0)
+    {
+        /* Skip leading whitespace */
+        while (parser->next_pos < parser->json_len &&
+               jtok_is_whitespace(parser->json[parser->next_pos]))
+        {
+            parser->next_pos++;
+        }
+
+        parser->pos = parser->next_pos;
+        if (parser->pos < parser->json_len)
+        {
+            status           = jtok_parse_object(parser);
+            parser->next_pos = parser->pos + 1;
+        }
+        else if (last)
+        {
+            status = JTOK_PARSE_STATUS_NON_OBJECT;
+        }
+        else
+        {
+            status = JTOK_PARSE_STATUS_PARTIAL_TOKEN;
+        }
+    }
+
+    while (status == JTOK_PARSE_STATUS_OK && parser->depth > 0)
+    {
+        unsigned int  depth = parser->depth;
+        jtok_frame_t *frame = &parser->stack[depth - 1];
+
+        /* Jump straight to the next structural character */
+        parser->pos = jtok_index_next(parser, parser->next_pos);
+        if (parser->pos >= parser->json_len)
+        {
+            /* Didn't find the closing bracket, so we have partial json */
+            parser->next_pos = parser->pos;
+            parser->pos      = jtok_token_start(parser, frame->tkn);
+            status           = JTOK_PARSE_STATUS_PARTIAL_TOKEN;
+            break;
+        }
+        else if (frame->type == JTOK_OBJECT)
+        {
+            status = jtok_object_step(parser, frame);
+        }
+        else
+        {
+            status = jtok_array_step(parser, frame);
+        }
+
+        /* A string or primitive cut off by the end of the json leaves
+         * next_pos on its first character, so it is handled again from
+         * there when more json is fed */
+        if (status == JTOK_PARSE_STATUS_OK)
+        {
+            parser->next_pos = parser->pos + 1;
+            if (parser->depth < depth && parser->depth > 0)
+            {
+                /* frame was closed, so attach it to the enclosing container */
+                jtok_frame_t *outer = frame - 1;
+                if (outer->type == JTOK_OBJECT)
+                {
+                    jtok_object_child_closed(parser, outer, frame->tkn);
+                }
+                else
+                {
+                    jtok_array_child_closed(parser, outer, frame->tkn);
+                }
+            }
+        }
+    }
+    return status;
 }
 
 
@@ -16,23 +16,54 @@
 #include "inc/jtok_shared.h"
 #include "inc/jtok_string.h"
 #include "inc/jtok_primitive.h"
+#include "inc/jtok_fsm.h"
 
-JTOK_PARSE_STATUS_t jtok_parse_array(jtok_parser_t *parser, int depth)
+
+/**
+ * @brief Check that the next element of an array has the same type as the
+ * ones before it
+ */
+static JTOK_PARSE_STATUS_t jtok_array_check_element(jtok_frame_t *frame,
+                                                    JTOK_TYPE_t   type)
 {
-    JTOK_PARSE_STATUS_t status             = JTOK_PARSE_STATUS_OK;
-    jtok_tkn_t *        tokens             = parser->tkn_pool;
-    unsigned int        start              = parser->pos;
-    const char *        json               = parser->json;
-    bool                element_type_found = false;
-    JTOK_TYPE_t         element_type       = JTOK_UNASSIGNED_TOKEN;
-    enum
+    JTOK_PARSE_STATUS_t status = JTOK_PARSE_STATUS_OK;
+    if (frame->element_type == JTOK_UNASSIGNED_TOKEN)
+    {
+        frame->element_type = type;
+    }
+    else if (frame->element_type != type)
     {
-        ARRAY_START,
-        ARRAY_VALUE,
-        ARRAY_COMMA
-    } expecting = ARRAY_START;
+        status = JTOK_STATUS_MIXED_ARRAY;
+    }
+    return status;
+}
+
 
-    if (depth > JTOK_MAX_RECURSE_DEPTH)
+/**
+ * @brief Attach the element the parser just created to the array
+ */
+static void jtok_array_add_element(jtok_parser_t *parser, jtok_frame_t *frame,
+                                   int element)
+{
+    if (frame->last_child != NO_CHILD_IDX)
+    {
+        /* Link previous child to current child */
+        jtok_token_link(parser, frame->last_child, element);
+    }
+
+    /* Update last child and increase parent size */
+    frame->last_child = element;
+    jtok_token_add_child(parser, frame->tkn);
+    frame->expecting = JTOK_STATE_ARRAY_COMMA;
+}
+
+
+JTOK_PARSE_STATUS_t jtok_parse_array(jtok_parser_t *parser)
+{
+    JTOK_PARSE_STATUS_t status = JTOK_PARSE_STATUS_OK;
+    const char *        json   = parser->json;
+
+    if (parser->depth >= parser->stack_size)
     {
         status = JTOK_PARSE_STATUS_NEST_DEPTH_EXCEEDED;
         return status;
@@ -43,8 +74,10 @@ JTOK_PARSE_STATUS_t jtok_parse_array(jtok_parser_t *parser, int depth)
         return JTOK_PARSE_STATUS_NON_ARRAY;
     }
 
-    jtok_tkn_t *token = jtok_alloc_token(parser);
-    if (token == NULL)
+    /* end of token will be populated when we find the closing brace */
+    int array_token_index =
+        jtok_new_token(parser, JTOK_ARRAY, parser->pos, INVALID_ARRAY_INDEX);
+    if (array_token_index == INVALID_ARRAY_INDEX)
     {
         /*
          * Do not reset parser->pos because we want
@@ -55,351 +88,105 @@ JTOK_PARSE_STATUS_t jtok_parse_array(jtok_parser_t *parser, int depth)
         return status;
     }
 
-    token->parent    = parser->toksuper;
-    parser->toksuper = parser->toknext - 1;
+    /* The array is the superior token of its elements */
+    parser->toksuper = array_token_index;
 
-    /* Index of current top level token is the current superior token */
-    /* We need to preserve the index of top level token in the currenet
-     * stack frame because parsing a sub-object changes the value of
-     * parser->toksuper
-     */
-    int array_token_index = parser->toksuper;
-
-    /* end of token will be populated when we find the closing brace */
-    jtok_fill_token(token, JTOK_ARRAY, parser->pos, INVALID_ARRAY_INDEX);
+    /* all arrays start with no children (since they can be empty) */
+    jtok_frame_t *frame = jtok_push_frame(parser, JTOK_ARRAY,
+                                          array_token_index);
+    frame->expecting    = JTOK_STATE_ARRAY_START;
+    return status;
+}
 
-    /* go inside the object */
-    parser->pos++;
 
-    /* all arrays start with no children (since they can be empty) */
-    parser->last_child = NO_CHILD_IDX;
+JTOK_PARSE_STATUS_t jtok_array_step(jtok_parser_t *parser, jtok_frame_t *frame)
+{
+    JTOK_PARSE_STATUS_t status = JTOK_PARSE_STATUS_OK;
+    jtok_transition_t   next =
+        jtok_fsm_next(frame->expecting, parser->json[parser->pos]);
 
-    for (; parser->pos < parser->json_len && json[parser->pos] != '\0' &&
-           status == JTOK_PARSE_STATUS_OK;
-         parser->pos++)
+    switch (next.action)
     {
-        switch (json[parser->pos])
+        case JTOK_ACTION_OPEN_OBJECT:
         {
-            case '{':
+            status = jtok_array_check_element(frame, JTOK_OBJECT);
+            if (status == JTOK_PARSE_STATUS_OK)
             {
-                switch (expecting)
-                {
-                    case ARRAY_START:
-                    case ARRAY_VALUE:
-                    {
-                        if (element_type_found)
-                        {
-                            if (element_type != JTOK_OBJECT)
-                            {
-                                status = JTOK_STATUS_MIXED_ARRAY;
-                            }
-                        }
-                        else
-                        {
-                            element_type_found = true;
-                            element_type       = JTOK_OBJECT;
-                        }
-
-                        int parent_array_idx = parser->toksuper;
-                        status = jtok_parse_object(parser, depth + 1);
-                        if (status == JTOK_PARSE_STATUS_OK)
-                        {
-                            if (parser->last_child != NO_CHILD_IDX)
-                            {
-                                /* Link previous child to current child */
-                                tokens[parser->last_child].sibling =
-                                    parser->toknext - 1;
-                            }
-
-                            /* Update last child and increase parent size */
-                            parser->last_child = parser->toknext - 1;
-                            tokens[parent_array_idx].size++;
-
-                            expecting = ARRAY_COMMA;
-
-                            /* Restore superior token node */
-                            parser->toksuper = parent_array_idx;
-                        }
-                    }
-                    break;
-                    case ARRAY_COMMA:
-                    {
-                        status = JTOK_PARSE_STATUS_ARRAY_SEPARATOR;
-                    }
-                    break;
-                    default:
-                    {
-                        status = JTOK_PARSE_STATUS_INVAL;
-                    }
-                    break;
-                }
+                status = jtok_parse_object(parser);
             }
-            break;
-            case '[':
+        }
+        break;
+        case JTOK_ACTION_OPEN_ARRAY:
+        {
+            status = jtok_array_check_element(frame, JTOK_ARRAY);
+            if (status == JTOK_PARSE_STATUS_OK)
             {
-                switch (expecting)
-                {
-                    case ARRAY_START:
-                    case ARRAY_VALUE:
-                    {
-                        if (element_type_found)
-                        {
-                            if (element_type != JTOK_ARRAY)
-                            {
-                                status = JTOK_STATUS_MIXED_ARRAY;
-                            }
-                        }
-                        else
-                        {
-                            element_type_found = true;
-                            element_type       = JTOK_ARRAY;
-                        }
-
-                        int parent_array_idx = parser->toksuper;
-                        status = jtok_parse_array(parser, depth + 1);
-                        if (status == JTOK_PARSE_STATUS_OK)
-                        {
-                            if (parser->last_child != NO_CHILD_IDX)
-                            {
-                                /* Link previous child to current child */
-                                tokens[parser->last_child].sibling =
-                                    parser->toknext - 1;
-                            }
-
-                            /* Update last child and increase parent size */
-                            parser->last_child = parser->toknext - 1;
-                            tokens[parent_array_idx].size++;
-
-                            expecting = ARRAY_COMMA;
-
-                            /* Restore superior token node */
-                            parser->toksuper = parent_array_idx;
-                        }
-                    }
-                    break;
-                    case ARRAY_COMMA:
-                    {
-                        status = JTOK_PARSE_STATUS_ARRAY_SEPARATOR;
-                    }
-                    break;
-                    default:
-                    {
-                        status = JTOK_PARSE_STATUS_INVAL;
-                    }
-                    break;
-                }
+                status = jtok_parse_array(parser);
             }
-            break;
-            case ']':
+        }
+        break;
+        case JTOK_ACTION_CLOSE:
+        {
+            jtok_fsm_close(parser, frame);
+        }
+        break;
+        case JTOK_ACTION_STRING:
+        {
+            status = jtok_array_check_element(frame, JTOK_STRING);
+            if (status == JTOK_PARSE_STATUS_OK)
             {
-                switch (expecting)
-                {
-                    case ARRAY_COMMA:
-                    case ARRAY_START:
-                    {
-                        jtok_tkn_t *parent_arr = &tokens[array_token_index];
-                        if (parent_arr->type != JTOK_ARRAY ||
-                            parser->toknext == 0)
-                        {
-                            parser->pos = start;
-                            status      = JTOK_PARSE_STATUS_INVAL;
-                        }
-                        else
-                        {
-                            parent_arr->end  = parser->pos + 1;
-                            parser->toksuper = parent_arr->parent;
-                        }
-
-                        return status;
-                    }
-                    break;
-                    default:
-                    {
-                        status = JTOK_PARSE_STATUS_ARRAY_SEPARATOR;
-                    }
-                    break;
-                }
-                return status;
+                status = jtok_parse_string(parser);
             }
-            break;
-            case '\"':
+            if (status == JTOK_PARSE_STATUS_OK)
             {
-                switch (expecting)
-                {
-                    case ARRAY_START:
-                    case ARRAY_VALUE:
-                    {
-                        if (element_type_found)
-                        {
-                            if (element_type != JTOK_OBJECT)
-                            {
-                                status = JTOK_STATUS_MIXED_ARRAY;
-                            }
-                        }
-                        else
-                        {
-                            element_type_found = true;
-                            element_type       = JTOK_OBJECT;
-                        }
-
-                        int super = parser->toksuper;
-                        status    = jtok_parse_string(parser);
-                        if (status == JTOK_PARSE_STATUS_OK)
-                        {
-                            if (parser->last_child != NO_CHILD_IDX)
-                            {
-                                /* Link previous child to current child */
-                                tokens[parser->last_child].sibling =
-                                    parser->toknext - 1;
-                            }
-
-                            /* Update last child and increase parent size */
-                            parser->last_child = parser->toknext - 1;
-                            if (super != NO_PARENT_IDX)
-                            {
-                                tokens[super].size++;
-                            }
-
-                            expecting = ARRAY_COMMA;
-                        }
-                    }
-                    break;
-                    case ARRAY_COMMA:
-                    {
-                        status = JTOK_PARSE_STATUS_ARRAY_SEPARATOR;
-                    }
-                    break;
-                    default:
-                    {
-                        status = JTOK_PARSE_STATUS_INVAL;
-                    }
-                    break;
-                }
+                jtok_array_add_element(parser, frame, parser->toknext - 1);
             }
-            break;
-            case '\t':
-            case '\r':
-            case '\n':
-            case ' ':
-                continue; /* skip whitespce */
-            case ',':
+        }
+        break;
+        case JTOK_ACTION_PRIMITIVE:
+        {
+            status = jtok_array_check_element(frame, JTOK_PRIMITIVE);
+            if (status == JTOK_PARSE_STATUS_OK)
             {
-                switch (expecting)
-                {
-                    case ARRAY_COMMA:
-                    {
-                        expecting = ARRAY_VALUE;
-                    }
-                    break;
-                    case ARRAY_START:
-                    case ARRAY_VALUE:
-                    {
-                        status = JTOK_PARSE_STATUS_STRAY_COMMA;
-                    }
-                    break;
-                    default:
-                    {
-                        status = JTOK_PARSE_STATUS_INVAL;
-                    }
-                    break;
-                }
+                status = jtok_parse_primitive(parser);
             }
-            break;
-            case '+':
-            case '-':
-            case '0':
-            case '1':
-            case '2':
-            case '3':
-            case '4':
-            case '5':
-            case '6':
-            case '7':
-            case '8':
-            case '9':
-            case 't':
-            case 'f':
-            case 'n':
+            if (status == JTOK_PARSE_STATUS_OK)
             {
-                switch (expecting)
-                {
-                    case ARRAY_START:
-                    case ARRAY_VALUE:
-                    {
-                        if (element_type_found)
-                        {
-                            if (element_type != JTOK_PRIMITIVE)
-                            {
-                                status = JTOK_STATUS_MIXED_ARRAY;
-                            }
-                        }
-                        else
-                        {
-                            element_type_found = true;
-                            element_type       = JTOK_PRIMITIVE;
-                        }
-
-                        if (status == JTOK_PARSE_STATUS_OK)
-                        {
-                            int super = parser->toksuper;
-                            status    = jtok_parse_primitive(parser);
-                            if (status == JTOK_PARSE_STATUS_OK)
-                            {
-                                if (parser->last_child != NO_CHILD_IDX)
-                                {
-                                    /* Link previous child to current child
-                                     */
-                                    tokens[parser->last_child].sibling =
-                                        parser->toknext - 1;
-                                }
-
-                                /* Update last child and increase parent
-                                 * size */
-                                parser->last_child = parser->toknext - 1;
-                                if (super != NO_PARENT_IDX)
-                                {
-                                    tokens[super].size++;
-                                }
-
-                                expecting = ARRAY_COMMA;
-                            }
-                            parser->toksuper = super;
-                        }
-                    }
-                    break;
-                    case ARRAY_COMMA:
-                    {
-                        status = JTOK_PARSE_STATUS_STRAY_COMMA;
-                    }
-                    break;
-                    default:
-                    {
-                        status = JTOK_PARSE_STATUS_INVAL;
-                    }
-                    break;
-                }
+                jtok_array_add_element(parser, frame, parser->toknext - 1);
             }
-            break;
         }
-    }
-
-    if (status == JTOK_PARSE_STATUS_OK)
-    {
-        parser->pos = start;
-        status      = JTOK_PARSE_STATUS_PARTIAL_TOKEN;
+        break;
+        case JTOK_ACTION_COMMA:
+        {
+            frame->expecting = JTOK_STATE_ARRAY_VALUE;
+        }
+        break;
+        default:
+        {
+            status = jtok_fsm_error(parser, frame, next);
+        }
+        break;
     }
 
     return status;
 }
 
 
+void jtok_array_child_closed(jtok_parser_t *parser, jtok_frame_t *frame,
+                             int child)
+{
+    jtok_array_add_element(parser, frame, child);
+    parser->toksuper = frame->tkn;
+}
+
+
 bool jtok_toktokcmp_array(const jtok_tkn_t *arr1, const jtok_tkn_t *arr2)
 {
     bool                    is_equal = true;
     const jtok_tkn_t *const pool1    = arr1->pool;
     const jtok_tkn_t *const pool2    = arr2->pool;
-    assert(pool1->type == JTOK_OBJECT);
-    assert(pool2->type == JTOK_OBJECT);
+    assert(pool1->type == JTOK_OBJECT || pool1->type == JTOK_ARRAY);
+    assert(pool2->type == JTOK_OBJECT || pool2->type == JTOK_ARRAY);
     if (arr1->type != JTOK_ARRAY || arr2->type != JTOK_ARRAY)
     {
         is_equal = false;
@@ -452,3 +239,110 @@ bool jtok_toktokcmp_array(const jtok_tkn_t *arr1, const jtok_tkn_t *arr2)
 
     return is_equal;
 }
+
+
+/**
+ * @brief Check if the elements of a non-empty array have no children, so
+ * element i is the token i places after the first
+ */
+static bool jtok_array_is_flat(const jtok_tkn_t *arr)
+{
+    return arr[1].type == JTOK_STRING || arr[1].type == JTOK_PRIMITIVE;
+}
+
+
+int jtok_array_at(const jtok_tkn_t *arr, int i)
+{
+    int idx = INVALID_ARRAY_INDEX;
+    if (arr != NULL && arr->pool != NULL && arr->type == JTOK_ARRAY &&
+        i >= 0 && i < arr->size)
+    {
+        const jtok_tkn_t *tkns = arr->pool;
+
+        /* First element is right after the array */
+        idx = (int)(arr - tkns) + 1;
+        if (jtok_array_is_flat(arr))
+        {
+            idx += i;
+        }
+        else
+        {
+            while (i-- > 0 && idx != NO_SIBLING_IDX)
+            {
+                idx = tkns[idx].sibling;
+            }
+        }
+    }
+    return idx;
+}
+
+
+void jtok_elemidx_init(jtok_elemidx_t *idx, int *elems, size_t size)
+{
+    if (idx != NULL)
+    {
+        idx->arr   = NULL;
+        idx->elems = elems;
+        idx->size  = size;
+    }
+}
+
+
+JTOK_PARSE_STATUS_t jtok_elemidx_build(jtok_elemidx_t *idx,
+                                       const jtok_tkn_t *arr)
+{
+    JTOK_PARSE_STATUS_t status = JTOK_PARSE_STATUS_OK;
+    if (idx == NULL || arr == NULL || idx->elems == NULL || arr->pool == NULL)
+    {
+        status = JTOK_PARSE_STATUS_NULL_PARAM;
+    }
+    else if (arr->type != JTOK_ARRAY)
+    {
+        status = JTOK_PARSE_STATUS_NON_ARRAY;
+    }
+    else if (idx->size < (size_t)arr->size)
+    {
+        idx->arr = NULL;
+        status   = JTOK_PARSE_STATUS_NOMEM;
+    }
+    else
+    {
+        const jtok_tkn_t *tkns = arr->pool;
+        int               elem = (arr->size > 0) ? (int)(arr - tkns) + 1
+                                                 : NO_SIBLING_IDX;
+        int               i;
+        for (i = 0; i < arr->size && elem != NO_SIBLING_IDX; i++)
+        {
+            idx->elems[i] = elem;
+            elem          = tkns[elem].sibling;
+        }
+        idx->arr = arr;
+    }
+    return status;
+}
+
+
+int jtok_elemidx_at(jtok_elemidx_t *idx, const jtok_tkn_t *arr, int i)
+{
+    int elem = INVALID_ARRAY_INDEX;
+    if (idx == NULL || arr == NULL || arr->pool == NULL ||
+        arr->type != JTOK_ARRAY || i < 0 || i >= arr->size)
+    {
+        elem = INVALID_ARRAY_INDEX;
+    }
+    else if (jtok_array_is_flat(arr))
+    {
+        /* Already O(1) */
+        elem = jtok_array_at(arr, i);
+    }
+    else if (idx->arr != arr &&
+             jtok_elemidx_build(idx, arr) != JTOK_PARSE_STATUS_OK)
+    {
+        elem = jtok_array_at(arr, i);
+    }
+    else
+    {
+        elem = idx->elems[i];
+    }
+    return elem;
+}
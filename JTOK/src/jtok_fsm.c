@@ -0,0 +1,169 @@
+/**
+ * @file jtok_fsm.c
+ * @author Carl Mattatall (cmattatall2@gmail.com)
+ * @brief Character class and transition tables shared by the object and
+ * array state machines. Each step is one class lookup and one transition
+ * lookup instead of a switch on the character nested in a switch on the
+ * state.
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2020 Carl Mattatall
+ *
+ */
+
+#include "inc/jtok_fsm.h"
+#include "inc/jtok_shared.h"
+
+
+const uint8_t jtok_char_class[256] = {
+    ['{'] = JTOK_CLASS_OBJECT_OPEN,  ['['] = JTOK_CLASS_ARRAY_OPEN,
+    ['}'] = JTOK_CLASS_OBJECT_CLOSE, [']'] = JTOK_CLASS_ARRAY_CLOSE,
+    ['"'] = JTOK_CLASS_QUOTE,        [':'] = JTOK_CLASS_COLON,
+    [','] = JTOK_CLASS_COMMA,        ['+'] = JTOK_CLASS_PRIMITIVE,
+    ['-'] = JTOK_CLASS_PRIMITIVE,    ['0'] = JTOK_CLASS_PRIMITIVE,
+    ['1'] = JTOK_CLASS_PRIMITIVE,    ['2'] = JTOK_CLASS_PRIMITIVE,
+    ['3'] = JTOK_CLASS_PRIMITIVE,    ['4'] = JTOK_CLASS_PRIMITIVE,
+    ['5'] = JTOK_CLASS_PRIMITIVE,    ['6'] = JTOK_CLASS_PRIMITIVE,
+    ['7'] = JTOK_CLASS_PRIMITIVE,    ['8'] = JTOK_CLASS_PRIMITIVE,
+    ['9'] = JTOK_CLASS_PRIMITIVE,    ['t'] = JTOK_CLASS_PRIMITIVE,
+    ['f'] = JTOK_CLASS_PRIMITIVE,    ['n'] = JTOK_CLASS_PRIMITIVE,
+};
+
+
+/* clang-format off */
+#define GO(action)      {JTOK_ACTION_##action, JTOK_PARSE_STATUS_OK}
+#define FAIL(status)    {JTOK_ACTION_ERROR, JTOK_PARSE_STATUS_##status}
+#define FAIL_AT_START   {JTOK_ACTION_ERROR_AT_START, JTOK_PARSE_STATUS_INVAL}
+#define FAIL_AT_SUPER   {JTOK_ACTION_ERROR_AT_SUPER, \
+                         JTOK_PARSE_STATUS_KEY_NO_VAL}
+
+const jtok_transition_t jtok_transitions[JTOK_STATE_COUNT][JTOK_CLASS_COUNT] = {
+    [JTOK_STATE_OBJECT_KEY] = {
+        [JTOK_CLASS_OTHER]        = FAIL_AT_START,
+        [JTOK_CLASS_OBJECT_OPEN]  = FAIL(OBJ_NOKEY),
+        [JTOK_CLASS_ARRAY_OPEN]   = FAIL(OBJ_NOKEY),
+        [JTOK_CLASS_OBJECT_CLOSE] = GO(CLOSE),          /* {} */
+        [JTOK_CLASS_ARRAY_CLOSE]  = FAIL_AT_START,
+        [JTOK_CLASS_QUOTE]        = GO(KEY),
+        [JTOK_CLASS_COLON]        = FAIL_AT_START,
+        [JTOK_CLASS_COMMA]        = FAIL(OBJ_NOKEY),
+        [JTOK_CLASS_PRIMITIVE]    = FAIL_AT_SUPER,
+    },
+    [JTOK_STATE_OBJECT_COLON] = {
+        [JTOK_CLASS_OTHER]        = FAIL_AT_START,
+        [JTOK_CLASS_OBJECT_OPEN]  = FAIL(VAL_NO_COLON),
+        [JTOK_CLASS_ARRAY_OPEN]   = FAIL(VAL_NO_COLON),
+        [JTOK_CLASS_OBJECT_CLOSE] = FAIL(KEY_NO_VAL),
+        [JTOK_CLASS_ARRAY_CLOSE]  = FAIL_AT_START,
+        [JTOK_CLASS_QUOTE]        = FAIL(VAL_NO_COLON),
+        [JTOK_CLASS_COLON]        = GO(COLON),
+        [JTOK_CLASS_COMMA]        = FAIL(OBJ_NOKEY),
+        [JTOK_CLASS_PRIMITIVE]    = FAIL_AT_SUPER,
+    },
+    [JTOK_STATE_OBJECT_VALUE] = {
+        [JTOK_CLASS_OTHER]        = FAIL_AT_START,
+        [JTOK_CLASS_OBJECT_OPEN]  = GO(OPEN_OBJECT),
+        [JTOK_CLASS_ARRAY_OPEN]   = GO(OPEN_ARRAY),
+        [JTOK_CLASS_OBJECT_CLOSE] = FAIL(KEY_NO_VAL),
+        [JTOK_CLASS_ARRAY_CLOSE]  = FAIL_AT_START,
+        [JTOK_CLASS_QUOTE]        = GO(STRING),
+        [JTOK_CLASS_COLON]        = FAIL_AT_START,
+        [JTOK_CLASS_COMMA]        = FAIL(OBJ_NOKEY),
+        [JTOK_CLASS_PRIMITIVE]    = GO(PRIMITIVE),
+    },
+    [JTOK_STATE_OBJECT_COMMA] = {
+        [JTOK_CLASS_OTHER]        = FAIL_AT_START,
+        [JTOK_CLASS_OBJECT_OPEN]  = FAIL(INVAL),
+        [JTOK_CLASS_ARRAY_OPEN]   = FAIL(INVAL),
+        [JTOK_CLASS_OBJECT_CLOSE] = GO(CLOSE),
+        [JTOK_CLASS_ARRAY_CLOSE]  = FAIL_AT_START,
+        [JTOK_CLASS_QUOTE]        = FAIL(VAL_NO_COMMA),
+        [JTOK_CLASS_COLON]        = FAIL_AT_START,
+        [JTOK_CLASS_COMMA]        = GO(COMMA),
+        [JTOK_CLASS_PRIMITIVE]    = FAIL_AT_SUPER,
+    },
+    [JTOK_STATE_ARRAY_START] = {
+        [JTOK_CLASS_OTHER]        = FAIL_AT_START,
+        [JTOK_CLASS_OBJECT_OPEN]  = GO(OPEN_OBJECT),
+        [JTOK_CLASS_ARRAY_OPEN]   = GO(OPEN_ARRAY),
+        [JTOK_CLASS_OBJECT_CLOSE] = FAIL_AT_START,
+        [JTOK_CLASS_ARRAY_CLOSE]  = GO(CLOSE),          /* [] */
+        [JTOK_CLASS_QUOTE]        = GO(STRING),
+        [JTOK_CLASS_COLON]        = FAIL_AT_START,
+        [JTOK_CLASS_COMMA]        = FAIL(STRAY_COMMA),
+        [JTOK_CLASS_PRIMITIVE]    = GO(PRIMITIVE),
+    },
+    [JTOK_STATE_ARRAY_VALUE] = {
+        [JTOK_CLASS_OTHER]        = FAIL_AT_START,
+        [JTOK_CLASS_OBJECT_OPEN]  = GO(OPEN_OBJECT),
+        [JTOK_CLASS_ARRAY_OPEN]   = GO(OPEN_ARRAY),
+        [JTOK_CLASS_OBJECT_CLOSE] = FAIL_AT_START,
+        [JTOK_CLASS_ARRAY_CLOSE]  = FAIL(ARRAY_SEPARATOR), /* [1,] */
+        [JTOK_CLASS_QUOTE]        = GO(STRING),
+        [JTOK_CLASS_COLON]        = FAIL_AT_START,
+        [JTOK_CLASS_COMMA]        = FAIL(STRAY_COMMA),
+        [JTOK_CLASS_PRIMITIVE]    = GO(PRIMITIVE),
+    },
+    [JTOK_STATE_ARRAY_COMMA] = {
+        [JTOK_CLASS_OTHER]        = FAIL_AT_START,
+        [JTOK_CLASS_OBJECT_OPEN]  = FAIL(ARRAY_SEPARATOR),
+        [JTOK_CLASS_ARRAY_OPEN]   = FAIL(ARRAY_SEPARATOR),
+        [JTOK_CLASS_OBJECT_CLOSE] = FAIL_AT_START,
+        [JTOK_CLASS_ARRAY_CLOSE]  = GO(CLOSE),
+        [JTOK_CLASS_QUOTE]        = FAIL(ARRAY_SEPARATOR),
+        [JTOK_CLASS_COLON]        = FAIL_AT_START,
+        [JTOK_CLASS_COMMA]        = GO(COMMA),
+        [JTOK_CLASS_PRIMITIVE]    = FAIL(STRAY_COMMA),
+    },
+};
+
+#undef GO
+#undef FAIL
+#undef FAIL_AT_START
+#undef FAIL_AT_SUPER
+/* clang-format on */
+
+
+JTOK_PARSE_STATUS_t jtok_fsm_error(jtok_parser_t *     parser,
+                                   const jtok_frame_t *frame,
+                                   jtok_transition_t   next)
+{
+    switch (next.action)
+    {
+        case JTOK_ACTION_ERROR_AT_START:
+        {
+            parser->pos = jtok_token_start(parser, frame->tkn);
+        }
+        break;
+        case JTOK_ACTION_ERROR_AT_SUPER:
+        {
+            /* move pos to the start of the key that's missing the value */
+            parser->pos = jtok_token_start(parser, parser->toksuper);
+        }
+        break;
+        default:
+        {
+        }
+        break;
+    }
+    return (JTOK_PARSE_STATUS_t)next.status;
+}
+
+
+void jtok_fsm_close(jtok_parser_t *parser, const jtok_frame_t *frame)
+{
+    int tkn = frame->tkn;
+    jtok_token_close(parser, tkn, parser->pos + 1);
+
+    /* Final child has no sibling */
+    if (frame->last_child != NO_CHILD_IDX)
+    {
+        jtok_token_link(parser, frame->last_child, NO_SIBLING_IDX);
+    }
+
+    /* Update superior token to the key (or array) that owns the aggregate
+     * and leave it */
+    parser->toksuper = jtok_token_parent(parser, tkn);
+    parser->depth--;
+}
@@ -0,0 +1,416 @@
+/**
+ * @file jtok_index.c
+ * @author Carl Mattatall (cmattatall2@gmail.com)
+ * @brief Structural indexer. Classifies json 64 bytes at a time so the
+ * object and array state machines can jump from one structural character to
+ * the next instead of dispatching on every whitespace byte.
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2020 Carl Mattatall
+ *
+ */
+
+#include <string.h>
+
+#include "inc/jtok_index.h"
+#include "inc/jtok_shared.h"
+
+typedef struct
+{
+    uint64_t structural; /* {}[]:,        */
+    uint64_t open;       /* {[            */
+    uint64_t close;      /* }]            */
+    uint64_t whitespace; /* ' ' \t \r \n  */
+    uint64_t quote;      /* "             */
+    uint64_t backslash;  /* \             */
+} jtok_index_masks_t;
+
+
+#if defined(JTOK_SIMD_AVX2)
+
+static inline uint64_t jtok_index_movemask(__m256i v)
+{
+    return (uint32_t)_mm256_movemask_epi8(v);
+}
+
+static void jtok_index_classify(const char *buf, jtok_index_masks_t *m)
+{
+    int i;
+    memset(m, 0, sizeof(*m));
+    for (i = 0; i < JTOK_INDEX_BLOCK_SIZE; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)&buf[i]);
+
+        /* '[' | 0x20 == '{' and ']' | 0x20 == '}' */
+        __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+        __m256i open  = _mm256_cmpeq_epi8(lower, _mm256_set1_epi8('{'));
+        __m256i open_close =
+            _mm256_or_si256(open,
+                            _mm256_cmpeq_epi8(lower, _mm256_set1_epi8('}')));
+        __m256i separator =
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(':')),
+                            _mm256_cmpeq_epi8(v, _mm256_set1_epi8(',')));
+        __m256i structural = _mm256_or_si256(open_close, separator);
+        __m256i blank =
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')));
+        __m256i newline =
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')),
+                            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+        __m256i whitespace = _mm256_or_si256(blank, newline);
+        __m256i quote     = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\"'));
+        __m256i backslash = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'));
+
+        m->structural |= jtok_index_movemask(structural) << i;
+        m->open |= jtok_index_movemask(open) << i;
+        m->close |= jtok_index_movemask(open_close) << i;
+        m->whitespace |= jtok_index_movemask(whitespace) << i;
+        m->quote |= jtok_index_movemask(quote) << i;
+        m->backslash |= jtok_index_movemask(backslash) << i;
+    }
+    m->close &= ~m->open;
+}
+
+#elif defined(JTOK_SIMD_SSE2)
+
+static inline uint64_t jtok_index_movemask(__m128i v)
+{
+    return (uint16_t)_mm_movemask_epi8(v);
+}
+
+static void jtok_index_classify(const char *buf, jtok_index_masks_t *m)
+{
+    int i;
+    memset(m, 0, sizeof(*m));
+    for (i = 0; i < JTOK_INDEX_BLOCK_SIZE; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)&buf[i]);
+
+        /* '[' | 0x20 == '{' and ']' | 0x20 == '}' */
+        __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+        __m128i open  = _mm_cmpeq_epi8(lower, _mm_set1_epi8('{'));
+        __m128i open_close =
+            _mm_or_si128(open, _mm_cmpeq_epi8(lower, _mm_set1_epi8('}')));
+        __m128i separator = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(':')),
+                                         _mm_cmpeq_epi8(v, _mm_set1_epi8(',')));
+        __m128i structural = _mm_or_si128(open_close, separator);
+        __m128i blank = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                                     _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+        __m128i newline = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')),
+                                       _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+        __m128i whitespace = _mm_or_si128(blank, newline);
+        __m128i quote     = _mm_cmpeq_epi8(v, _mm_set1_epi8('\"'));
+        __m128i backslash = _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'));
+
+        m->structural |= jtok_index_movemask(structural) << i;
+        m->open |= jtok_index_movemask(open) << i;
+        m->close |= jtok_index_movemask(open_close) << i;
+        m->whitespace |= jtok_index_movemask(whitespace) << i;
+        m->quote |= jtok_index_movemask(quote) << i;
+        m->backslash |= jtok_index_movemask(backslash) << i;
+    }
+    m->close &= ~m->open;
+}
+
+#else
+
+static void jtok_index_classify(const char *buf, jtok_index_masks_t *m)
+{
+    int i;
+    memset(m, 0, sizeof(*m));
+    for (i = 0; i < JTOK_INDEX_BLOCK_SIZE; i++)
+    {
+        uint64_t bit = (uint64_t)1 << i;
+        switch (buf[i])
+        {
+            case '{':
+            case '[':
+            {
+                m->structural |= bit;
+                m->open |= bit;
+            }
+            break;
+            case '}':
+            case ']':
+            {
+                m->structural |= bit;
+                m->close |= bit;
+            }
+            break;
+            case ':':
+            case ',':
+            {
+                m->structural |= bit;
+            }
+            break;
+            case ' ':
+            case '\t':
+            case '\r':
+            case '\n':
+            {
+                m->whitespace |= bit;
+            }
+            break;
+            case '\"':
+            {
+                m->quote |= bit;
+            }
+            break;
+            case '\\':
+            {
+                m->backslash |= bit;
+            }
+            break;
+            default:
+            {
+            }
+            break;
+        }
+    }
+}
+
+#endif /* JTOK_SIMD_AVX2 */
+
+
+/**
+ * @brief Find the characters that are escaped by a backslash.
+ * Escapes are rare, so this just walks the backslash bits.
+ *
+ * @param backslash the backslash mask of the block
+ * @param carry in: 1 if the first byte of the block is escaped by a
+ * backslash at the end of the previous block. out: 1 if the last byte of this
+ * block is a backslash that escapes the first byte of the next block.
+ */
+static uint64_t jtok_index_escaped(uint64_t backslash, uint64_t *carry)
+{
+    uint64_t escaped = *carry;
+    backslash &= ~escaped;
+    *carry = 0;
+    while (backslash != 0)
+    {
+        int      i   = jtok_ctz64(backslash);
+        uint64_t bit = (uint64_t)1 << i;
+
+        /* The escaped character cannot itself start an escape */
+        escaped |= bit << 1;
+        backslash &= ~(bit | (bit << 1));
+        if (i == JTOK_INDEX_BLOCK_SIZE - 1)
+        {
+            *carry = 1;
+        }
+    }
+    return escaped;
+}
+
+
+/**
+ * @brief Turn a mask of quotes into a mask of string bodies. Every bit from an
+ * opening quote up to (but not including) its closing quote is set.
+ */
+static uint64_t jtok_index_prefix_xor(uint64_t bits)
+{
+    bits ^= bits << 1;
+    bits ^= bits << 2;
+    bits ^= bits << 4;
+    bits ^= bits << 8;
+    bits ^= bits << 16;
+    bits ^= bits << 32;
+    return bits;
+}
+
+
+/**
+ * @brief Classify a block, padding a short one with whitespace so we never
+ * read past the json
+ */
+static void jtok_index_load(const char *buf, unsigned int n,
+                            jtok_index_masks_t *m)
+{
+    if (n < JTOK_INDEX_BLOCK_SIZE)
+    {
+        char block[JTOK_INDEX_BLOCK_SIZE];
+        memset(block, ' ', sizeof(block));
+        memcpy(block, buf, n);
+        jtok_index_classify(block, m);
+    }
+    else
+    {
+        jtok_index_classify(buf, m);
+    }
+}
+
+
+uint64_t jtok_index_block(const char *buf, unsigned int n)
+{
+    jtok_index_masks_t m;
+    jtok_index_load(buf, n, &m);
+
+    uint64_t quotes = m.quote;
+    if (m.backslash != 0)
+    {
+        uint64_t carry = 0;
+        quotes &= ~jtok_index_escaped(m.backslash, &carry);
+    }
+    uint64_t in_string = jtok_index_prefix_xor(quotes);
+
+    /* Anything that isn't structural, whitespace or a quote belongs to a
+     * primitive (or is garbage). The parser only has to see the first byte
+     * of each such run. The byte before the block is treated as whitespace.
+     */
+    uint64_t scalar = ~(m.structural | m.whitespace | m.quote);
+    uint64_t scalar_start = scalar & ~(scalar << 1);
+
+    return ((m.structural | scalar_start) & ~in_string) | (quotes & in_string);
+}
+
+
+size_t jtok_index_count(const char *json, size_t len)
+{
+    size_t   count          = 0;
+    uint64_t escape_carry   = 0; /* first byte of the block is escaped */
+    uint64_t string_carry   = 0; /* all ones if block starts inside a string */
+    uint64_t scalar_carry   = 0; /* block starts inside a primitive */
+    size_t   pos;
+
+    /* Unlike jtok_index_scan, the blocks are not anchored outside of
+     * strings, so the string and escape state is carried between them */
+    for (pos = 0; pos < len; pos += JTOK_INDEX_BLOCK_SIZE)
+    {
+        jtok_index_masks_t m;
+        size_t             n = len - pos;
+        if (n > JTOK_INDEX_BLOCK_SIZE)
+        {
+            n = JTOK_INDEX_BLOCK_SIZE;
+        }
+        jtok_index_load(&json[pos], n, &m);
+
+        uint64_t quotes = m.quote;
+        if ((m.backslash | escape_carry) != 0)
+        {
+            quotes &= ~jtok_index_escaped(m.backslash, &escape_carry);
+        }
+        uint64_t in_string = jtok_index_prefix_xor(quotes) ^ string_carry;
+        string_carry       = (uint64_t)0 - (in_string >> 63);
+
+        uint64_t scalar = ~(m.structural | m.whitespace | m.quote);
+        uint64_t scalar_start = scalar & ~((scalar << 1) | scalar_carry);
+        scalar_carry          = scalar >> 63;
+
+        /* Every token starts with '{', '[', an opening quote or the first
+         * byte of a primitive */
+        count += jtok_popcount64(((m.open | scalar_start) & ~in_string) |
+                                 (quotes & in_string));
+    }
+    return count;
+}
+
+
+int jtok_index_scan(jtok_parser_t *parser, int from)
+{
+    int len = parser->json_len;
+    while (from < len)
+    {
+        if (from < parser->idx_base || from >= parser->idx_end)
+        {
+            /* Left the current block, so classify the next one. Anchoring it
+             * at from is safe because the parser is never inside a string
+             * when it asks for the next position */
+            int n = len - from;
+            if (n > JTOK_INDEX_BLOCK_SIZE)
+            {
+                n = JTOK_INDEX_BLOCK_SIZE;
+            }
+            parser->idx_bits = jtok_index_block(&parser->json[from], n);
+            parser->idx_base = from;
+            parser->idx_end  = from + n;
+        }
+
+        uint64_t bits = parser->idx_bits >> (from - parser->idx_base);
+        if (bits != 0)
+        {
+            return from + jtok_ctz64(bits);
+        }
+
+        /* Rest of the block is whitespace */
+        from = parser->idx_end;
+    }
+    return len;
+}
+
+
+bool jtok_index_nesting(const char *json, size_t start, size_t end,
+                        jtok_index_nesting_t nest[2], int *open_pos[2],
+                        int max_open)
+{
+    uint64_t escape_carry = 0;
+    uint64_t string_carry = 0;
+    size_t   pos;
+    int      s;
+
+    /* The first byte is escaped by an odd run of backslashes before the
+     * slice. Outside of a string that is invalid json anyway */
+    size_t run = start;
+    while (run > 0 && json[run - 1] == '\\')
+    {
+        run--;
+    }
+    escape_carry = (start - run) & 1;
+
+    for (s = 0; s < 2; s++)
+    {
+        nest[s].closes = 0;
+        nest[s].opens  = 0;
+    }
+
+    for (pos = start; pos < end; pos += JTOK_INDEX_BLOCK_SIZE)
+    {
+        jtok_index_masks_t m;
+        size_t             n = end - pos;
+        if (n > JTOK_INDEX_BLOCK_SIZE)
+        {
+            n = JTOK_INDEX_BLOCK_SIZE;
+        }
+        jtok_index_load(&json[pos], n, &m);
+
+        uint64_t quotes = m.quote;
+        if ((m.backslash | escape_carry) != 0)
+        {
+            quotes &= ~jtok_index_escaped(m.backslash, &escape_carry);
+        }
+        uint64_t in_string = jtok_index_prefix_xor(quotes) ^ string_carry;
+        string_carry       = (uint64_t)0 - (in_string >> 63);
+
+        for (s = 0; s < 2; s++)
+        {
+            /* in_string assumes the slice starts outside of a string, so
+             * it is flipped for a slice that starts inside one */
+            uint64_t outside = ~(in_string ^ ((uint64_t)0 - (uint64_t)s));
+            uint64_t bits    = (m.open | m.close) & outside;
+            while (bits != 0)
+            {
+                int i = jtok_ctz64(bits);
+                bits &= bits - 1;
+                if ((m.open >> i) & 1)
+                {
+                    /* Only the positions that fit are kept, but the count
+                     * stays exact so the caller can tell */
+                    if (nest[s].opens < max_open)
+                    {
+                        open_pos[s][nest[s].opens] = (int)(pos + i);
+                    }
+                    nest[s].opens++;
+                }
+                else if (nest[s].opens > 0)
+                {
+                    nest[s].opens--;
+                }
+                else
+                {
+                    nest[s].closes++;
+                }
+            }
+        }
+    }
+    return string_carry != 0;
+}
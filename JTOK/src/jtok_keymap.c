@@ -0,0 +1,159 @@
+/**
+ * @file jtok_keymap.c
+ * @author Carl Mattatall (cmattatall2@gmail.com)
+ * @brief Hash index of the keys of a parsed jtok object
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2020 Carl Mattatall
+ *
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "../inc/jtok.h"
+#include "inc/jtok_shared.h"
+
+
+/**
+ * @brief First slot to probe for a hash. Any number of slots works, so the
+ * caller doesn't have to round up to a power of 2.
+ */
+static inline size_t jtok_keymap_home(const jtok_keymap_t *map, uint32_t hash)
+{
+    return (size_t)(((uint64_t)hash * map->size) >> 32);
+}
+
+
+/**
+ * @brief Check if key token tkn has the text key
+ */
+static inline bool jtok_keymap_match(const jtok_tkn_t *tkn, const char *key,
+                                     size_t len)
+{
+    return (size_t)(tkn->end - tkn->start) == len &&
+           memcmp(&tkn->json[tkn->start], key, len) == 0;
+}
+
+
+/**
+ * @brief Walk the keys of obj, for maps too small to hold them
+ */
+static int jtok_keymap_scan(const jtok_tkn_t *obj, const char *key, size_t len)
+{
+    const jtok_tkn_t *tkns = obj->pool;
+    int               idx  = (obj->size > 0) ? (int)(obj - tkns) + 1
+                                             : NO_SIBLING_IDX;
+    while (idx != NO_SIBLING_IDX && !jtok_keymap_match(&tkns[idx], key, len))
+    {
+        idx = tkns[idx].sibling;
+    }
+    return idx;
+}
+
+
+void jtok_keymap_init(jtok_keymap_t *map, jtok_keymap_slot_t *slots,
+                      size_t size)
+{
+    if (map != NULL)
+    {
+        map->obj   = NULL;
+        map->slots = slots;
+        map->size  = size;
+    }
+}
+
+
+JTOK_PARSE_STATUS_t jtok_keymap_build(jtok_keymap_t *map,
+                                      const jtok_tkn_t *obj)
+{
+    JTOK_PARSE_STATUS_t status = JTOK_PARSE_STATUS_OK;
+    if (map == NULL || obj == NULL || map->slots == NULL || obj->pool == NULL)
+    {
+        status = JTOK_PARSE_STATUS_NULL_PARAM;
+    }
+    else if (obj->type != JTOK_OBJECT)
+    {
+        status = JTOK_PARSE_STATUS_NON_OBJECT;
+    }
+    else if (map->size <= (size_t)obj->size || map->size > UINT32_MAX)
+    {
+        /* Probing needs at least one free slot */
+        map->obj = NULL;
+        status   = JTOK_PARSE_STATUS_NOMEM;
+    }
+    else
+    {
+        const jtok_tkn_t *tkns = obj->pool;
+        size_t            i;
+        int               idx;
+        for (i = 0; i < map->size; i++)
+        {
+            map->slots[i].tkn = INVALID_ARRAY_INDEX;
+        }
+
+        /* Keys go in in order, so the first of two equal keys is always the
+         * one found first on their common probe sequence */
+        idx = (obj->size > 0) ? (int)(obj - tkns) + 1 : NO_SIBLING_IDX;
+        while (idx != NO_SIBLING_IDX)
+        {
+            const jtok_tkn_t *key = &tkns[idx];
+            uint32_t          hash;
+            if (key->flags & JTOK_TKN_FLAG_HASHED)
+            {
+                /* Hashed by the parser, no need to read the json */
+                hash = key->hash;
+            }
+            else
+            {
+                hash = jtok_hash(&key->json[key->start], key->end - key->start);
+            }
+            size_t slot = jtok_keymap_home(map, hash);
+            while (map->slots[slot].tkn != INVALID_ARRAY_INDEX)
+            {
+                slot = (slot + 1 < map->size) ? slot + 1 : 0;
+            }
+            map->slots[slot].hash = hash;
+            map->slots[slot].tkn  = idx;
+            idx                   = key->sibling;
+        }
+        map->obj = obj;
+    }
+    return status;
+}
+
+
+int jtok_keymap_find(jtok_keymap_t *map, const jtok_tkn_t *obj,
+                     const char *key, size_t len)
+{
+    int key_idx = INVALID_ARRAY_INDEX;
+    if (map == NULL || obj == NULL || key == NULL ||
+        obj->type != JTOK_OBJECT || obj->pool == NULL)
+    {
+        key_idx = INVALID_ARRAY_INDEX;
+    }
+    else if (map->obj != obj &&
+             jtok_keymap_build(map, obj) != JTOK_PARSE_STATUS_OK)
+    {
+        key_idx = jtok_keymap_scan(obj, key, len);
+    }
+    else
+    {
+        const jtok_tkn_t *tkns = obj->pool;
+        uint32_t          hash = jtok_hash(key, len);
+        size_t            slot = jtok_keymap_home(map, hash);
+        while (map->slots[slot].tkn != INVALID_ARRAY_INDEX)
+        {
+            if (map->slots[slot].hash == hash &&
+                jtok_keymap_match(&tkns[map->slots[slot].tkn], key, len))
+            {
+                key_idx = map->slots[slot].tkn;
+                break;
+            }
+            slot = (slot + 1 < map->size) ? slot + 1 : 0;
+        }
+    }
+    return key_idx;
+}
@@ -17,32 +17,22 @@
 #include "inc/jtok_primitive.h"
 #include "inc/jtok_string.h"
 #include "inc/jtok_shared.h"
+#include "inc/jtok_fsm.h"
 
 
-JTOK_PARSE_STATUS_t jtok_parse_object(jtok_parser_t *parser, int depth)
+JTOK_PARSE_STATUS_t jtok_parse_object(jtok_parser_t *parser)
 {
     JTOK_PARSE_STATUS_t status = JTOK_PARSE_STATUS_OK;
+    const char *        json   = parser->json;
 
-    int         start  = parser->pos;
-    const char *json   = parser->json;
-    int         len    = parser->json_len;
-    jtok_tkn_t *tokens = parser->tkn_pool;
-
-    if (depth > JTOK_MAX_RECURSE_DEPTH)
+    if (parser->depth >= parser->stack_size)
     {
         status = JTOK_PARSE_STATUS_NEST_DEPTH_EXCEEDED;
         return status;
     }
 
-    enum
-    {
-        OBJECT_KEY,
-        OBJECT_COLON,
-        OBJECT_VALUE,
-        OBJECT_COMMA,
-    } expecting = OBJECT_KEY;
-
-    if (tokens == NULL) /* Check for caller API error */
+    if (parser->tkn_pool == NULL && parser->tape == NULL &&
+        parser->realloc_fn == NULL) /* API error */
     {
         return status;
     }
@@ -51,8 +41,10 @@ JTOK_PARSE_STATUS_t jtok_parse_object(jtok_parser_t *parser, int depth)
         return JTOK_PARSE_STATUS_NON_OBJECT;
     }
 
-    jtok_tkn_t *token = jtok_alloc_token(parser);
-    if (token == NULL)
+    /* end of token will be populated when we find the closing brace */
+    int object_token_index =
+        jtok_new_token(parser, JTOK_OBJECT, parser->pos, INVALID_ARRAY_INDEX);
+    if (object_token_index == INVALID_ARRAY_INDEX)
     {
         /*
          * Do not reset parser->pos because we want
@@ -63,456 +55,197 @@ JTOK_PARSE_STATUS_t jtok_parse_object(jtok_parser_t *parser, int depth)
         return status;
     }
 
-    /* If the object has a parent key, increase that key's size */
-    token->parent = parser->toksuper;
-
     /* new superior token becomes the one we JUST processed */
-    parser->toksuper = parser->toknext - 1;
+    parser->toksuper = object_token_index;
 
-    /* Index of current top level token is the current superior token */
-    /* We need to preserve the index of top level token in the currenet
-     * stack frame because parsing a sub-object changes the value of
-     * parser->toksuper
-     */
-    int object_token_index = parser->toksuper;
-
-    /* end of token will be populated when we find the closing brace */
-    jtok_fill_token(token, JTOK_OBJECT, parser->pos, INVALID_ARRAY_INDEX);
+    /* all objects start with no children (since they can be empty) */
+    jtok_frame_t *frame = jtok_push_frame(parser, JTOK_OBJECT,
+                                          object_token_index);
+    frame->expecting    = JTOK_STATE_OBJECT_KEY;
+    return status;
+}
 
-    /* go inside the object */
-    parser->pos++;
 
-    /* all objects start with no children (since they can be empty) */
-    parser->last_child = NO_CHILD_IDX;
+JTOK_PARSE_STATUS_t jtok_object_step(jtok_parser_t *parser, jtok_frame_t *frame)
+{
+    JTOK_PARSE_STATUS_t status = JTOK_PARSE_STATUS_OK;
+    jtok_transition_t   next =
+        jtok_fsm_next(frame->expecting, parser->json[parser->pos]);
 
-    for (; parser->pos < len && json[parser->pos] != '\0' &&
-           status == JTOK_PARSE_STATUS_OK;
-         parser->pos++)
+    switch (next.action)
     {
-        switch (json[parser->pos])
+        case JTOK_ACTION_OPEN_OBJECT: /* Enter the sub-object */
+        {
+            status = jtok_parse_object(parser);
+        }
+        break;
+        case JTOK_ACTION_OPEN_ARRAY: /* Enter the sub-array */
+        {
+            status = jtok_parse_array(parser);
+        }
+        break;
+        case JTOK_ACTION_CLOSE:
+        {
+            /* Found where a key or comma is expected. A comma goes back
+             * to expecting a key, so a trailing comma such as
+             * {"key1" : "value1",} isn't caught here */
+            jtok_fsm_close(parser, frame);
+        }
+        break;
+        case JTOK_ACTION_KEY:
         {
-            case '{':
+            int obj = parser->toksuper;
+            if (jtok_token_type(parser, obj) == JTOK_OBJECT)
             {
-                switch (expecting)
+                status = jtok_parse_string(parser);
+                if (status == JTOK_PARSE_STATUS_OK)
                 {
-                    case OBJECT_KEY:
+                    if (frame->last_child != NO_CHILD_IDX)
                     {
-                        status = JTOK_PARSE_STATUS_OBJ_NOKEY;
+                        /* Link previous child to current child */
+                        jtok_token_link(parser, frame->last_child,
+                                        parser->toknext - 1);
                     }
-                    break;
-                    case OBJECT_COLON:
-                    {
-                        status = JTOK_PARSE_STATUS_VAL_NO_COLON;
-                    }
-                    break;
-                    case OBJECT_VALUE: /* Enter and parse the sub-object */
-                    {
-                        /* Index of the key that owns this object */
-                        int key_idx = parser->toksuper;
 
+                    /* Update last child and increase parent size */
+                    frame->last_child = parser->toknext - 1;
+                    jtok_token_add_child(parser, obj);
+                    frame->expecting = JTOK_STATE_OBJECT_COLON;
 
-                        status = jtok_parse_object(parser, depth + 1);
-                        if (status == JTOK_PARSE_STATUS_OK)
-                        {
-                            if (key_idx != NO_PARENT_IDX)
-                            {
-                                tokens[key_idx].size++;
-                            }
-                            parser->toksuper   = key_idx;
-                            expecting          = OBJECT_COMMA;
-                            parser->last_child = key_idx;
-                        }
-                    }
-                    break;
-                    case OBJECT_COMMA:
-                    default:
-                    {
-                        status = JTOK_PARSE_STATUS_INVAL;
-                    }
-                    break;
+                    /* Keys are not values */
+                    jtok_token_set_value_type(parser, frame->last_child,
+                                              JTOK_VALUE_TYPE_not_a_value_tkn);
                 }
             }
-            break;
-            case '[':
+            else
             {
-                switch (expecting)
-                {
-                    case OBJECT_KEY:
-                    {
-                        status = JTOK_PARSE_STATUS_OBJ_NOKEY;
-                    }
-                    break;
-                    case OBJECT_COLON:
-                    {
-                        status = JTOK_PARSE_STATUS_VAL_NO_COLON;
-                    }
-                    break;
-                    case OBJECT_VALUE:
-                    {
-                        /* Index of key that "owns" the array */
-                        int key_idx = parser->toksuper;
-                        status      = jtok_parse_array(parser, depth + 1);
-
-                        if (status == JTOK_PARSE_STATUS_OK)
-                        {
-                            if (key_idx != NO_PARENT_IDX)
-                            {
-                                tokens[key_idx].size++;
-                            }
-                            else
-                            {
-                                /* Keys must have a parent token */
-                                status = JTOK_PARSE_STATUS_INVALID_PARENT;
-                            }
-                            parser->last_child = key_idx;
-
-                            expecting = OBJECT_COMMA;
-                        }
-                    }
-                    break;
-                    case OBJECT_COMMA:
-                    {
-                        status = JTOK_PARSE_STATUS_INVAL;
-                    }
-                    break;
-                    default:
-                    {
-                        status = JTOK_PARSE_STATUS_INVAL;
-                    }
-                    break;
-                }
+                status = JTOK_PARSE_STATUS_INVALID_PARENT;
             }
-            break;
-            case '}':
+        }
+        break;
+        case JTOK_ACTION_STRING:
+        {
+            int key = parser->toksuper;
+            if (jtok_token_type(parser, key) == JTOK_STRING)
             {
-                switch (expecting)
+                if (jtok_token_size(parser, key) != 0)
                 {
-                    /* Technically we should be checking if this is the very
-                     * first token in the object, because
-                     * {"key1" : "value1", "key2" : "value2",} is invalid
-                     * from the trailing comma
-                     * (transition to expecting==key only occurs when finding
-                     * comma or when we START parsing the object)
-                     *
-                     * So in cases where we have transitioned from a comma,
-                     * if we find '}' then it means we have a trailing
-                     * comma inside the object
-                     */
-
-                    /********************************
-                     * Case where we find end of    *
-                     * object instead of key        *
-                     * (aka: empty object)          *
-                     *                              *
-                     * eg: {     }                  *
-                     *           ^ Right here       *
-                     *******************************/
-                    case OBJECT_KEY:
-                    {
-                        jtok_tkn_t *parent_obj = &tokens[object_token_index];
-                        if (parent_obj->type != JTOK_OBJECT ||
-                            parser->toknext == 0)
-                        {
-                            parser->pos = start;
-                            status      = JTOK_PARSE_STATUS_INVAL;
-                        }
-                        else
-                        {
-                            parent_obj->end  = parser->pos + 1;
-                            parser->toksuper = parent_obj->parent;
-
-                            /* Don't have to update children->sibling link
-                             * because there are no children in the object */
-                        }
-                        return status;
-                    }
-                    break;
-
-                    /****************************************************
-                     * Case wherein, instead of comma,                  *
-                     * we find end of object '}'                        *
-                     * eg : {\"key\":true, \"blah\":false   }           *
-                     *                                      ^           *
-                     *                                      Right here  *
-                     ***************************************************/
-                    case OBJECT_COMMA:
-                    {
-                        jtok_tkn_t *parent_obj = &tokens[object_token_index];
-                        if (parent_obj->type != JTOK_OBJECT ||
-                            parser->toknext == 0)
-                        {
-                            parser->pos = start;
-                            status      = JTOK_PARSE_STATUS_INVAL;
-                        }
-                        else
-                        {
-                            parent_obj->end = parser->pos + 1;
-
-                            /* Update superior token to the key that owns
-                             * the current object */
-                            parser->toksuper = parent_obj->parent;
-
-                            /* Final item in object has no sibling key */
-                            if (parser->last_child != NO_CHILD_IDX)
-                            {
-                                tokens[parser->last_child].sibling =
-                                    NO_SIBLING_IDX;
-                            }
-
-                            /* Update last child */
-                            parser->last_child = NO_CHILD_IDX;
-                        }
-                        return status;
-                    }
-                    break;
-                    case OBJECT_COLON:
-                    {
-                        status = JTOK_PARSE_STATUS_KEY_NO_VAL;
-                    }
-                    break;
-                    case OBJECT_VALUE:
-                    {
-                        status = JTOK_PARSE_STATUS_KEY_NO_VAL;
-                    }
-                    break;
-                    default:
-                    {
-                        status = JTOK_PARSE_STATUS_INVAL;
-                    }
-                    break;
+                    /* an object key can only have 1 value */
+                    status = JTOK_PARSE_STATUS_KEY_MULTIPLE_VAL;
                 }
-            }
-            break;
-            case '\"':
-            {
-                switch (expecting)
+                else
                 {
-                    case OBJECT_KEY:
-                    {
-                        jtok_tkn_t *parent_obj = &tokens[parser->toksuper];
-                        if (parent_obj->type == JTOK_OBJECT)
-                        {
-                            status = jtok_parse_string(parser);
-                            if (status == JTOK_PARSE_STATUS_OK)
-                            {
-                                if (parser->last_child != NO_CHILD_IDX)
-                                {
-                                    /* Link previous child to current child */
-                                    tokens[parser->last_child].sibling =
-                                        parser->toknext - 1;
-                                }
-
-                                /* Update last child and increase parent size */
-                                parser->last_child = parser->toknext - 1;
-                                parent_obj->size++;
-                            }
-                            expecting = OBJECT_COLON;
-                        }
-                        else
-                        {
-                            status = JTOK_PARSE_STATUS_INVALID_PARENT;
-                        }
-                    }
-                    break;
-                    case OBJECT_VALUE:
-                    {
-                        jtok_tkn_t *key_tkn = &tokens[parser->toksuper];
-                        if (key_tkn->type == JTOK_STRING)
-                        {
-                            if (key_tkn->size != 0)
-                            {
-                                /* an object key can only have 1 value */
-                                status = JTOK_PARSE_STATUS_KEY_MULTIPLE_VAL;
-                            }
-                            else
-                            {
-                                status = jtok_parse_string(parser);
-                                if (status == JTOK_PARSE_STATUS_OK)
-                                {
-                                    key_tkn->size++;
-                                }
-                                expecting = OBJECT_COMMA;
-                            }
-                        }
-                        else
-                        {
-                            status = JTOK_PARSE_STATUS_INVALID_PARENT;
-                        }
-                    }
-                    break;
-                    case OBJECT_COLON: /* found " when expecting ':' */
-                    {
-                        status = JTOK_PARSE_STATUS_VAL_NO_COLON;
-                    }
-                    break;
-                    case OBJECT_COMMA: /* found " when expecting ',' */
-                    {
-                        status = JTOK_PARSE_STATUS_VAL_NO_COMMA;
-                    }
-                    break;
-                    default:
+                    status = jtok_parse_string(parser);
+                    if (status == JTOK_PARSE_STATUS_OK)
                     {
-                        status = JTOK_PARSE_STATUS_INVAL;
+                        jtok_token_add_child(parser, key);
+                        frame->expecting = JTOK_STATE_OBJECT_COMMA;
                     }
-                    break;
                 }
             }
-            break;
-            case '\t':
-            case '\r':
-            case '\n':
-            case ' ':
-                continue; /* skip whitespce */
-            case ':':
+            else
             {
-                if (expecting == OBJECT_COLON)
-                {
-                    expecting = OBJECT_VALUE;
-
-                    /* Superior token becomes the key we just processed */
-                    parser->toksuper = parser->toknext - 1;
-                }
-                else
+                status = JTOK_PARSE_STATUS_INVALID_PARENT;
+            }
+        }
+        break;
+        case JTOK_ACTION_PRIMITIVE:
+        {
+            /* We're at the start of a primitive so validate parent type */
+            int start  = jtok_token_start(parser, frame->tkn);
+            int parent = parser->toksuper;
+            switch (jtok_token_type(parser, parent))
+            {
+                case JTOK_OBJECT:
                 {
+                    /* primitives cannot be keys (they are not quoted) */
                     parser->pos = start;
                     status      = JTOK_PARSE_STATUS_INVAL;
                 }
-            }
-            break;
-            case ',':
-            {
-                if (expecting == OBJECT_COMMA)
+                break;
+                case JTOK_STRING:
                 {
-                    expecting              = OBJECT_KEY;
-                    jtok_tkn_t *parent_key = &tokens[parser->toksuper];
-                    parser->toksuper       = parent_key->parent;
+                    if (jtok_token_size(parser, parent) != 0)
+                    {
+                        /* an object key can only have 1 value */
+                        parser->pos = start;
+                        status      = JTOK_PARSE_STATUS_INVAL;
+                    }
                 }
-                else
+                break;
+                default:
                 {
-                    status = JTOK_PARSE_STATUS_OBJ_NOKEY;
+                    /*
+                     * If we're inside an object,
+                     * other types cannot be parent tokens
+                     */
+                    status = JTOK_PARSE_STATUS_INVAL;
                 }
+                break;
             }
-            break;
-            case '+':
-            case '-':
-            case '0':
-            case '1':
-            case '2':
-            case '3':
-            case '4':
-            case '5':
-            case '6':
-            case '7':
-            case '8':
-            case '9':
-            case 't':
-            case 'f':
-            case 'n':
+
+            if (status == JTOK_PARSE_STATUS_OK)
             {
-                /* We must be expecting a value */
-                if (expecting == OBJECT_VALUE)
+                status = jtok_parse_primitive(parser);
+                if (status == JTOK_PARSE_STATUS_OK)
                 {
-                    /* We're at the start of a primitive so validate parent type
-                     */
-                    jtok_tkn_t *parent = &tokens[parser->toksuper];
-                    switch (parent->type)
+                    if (parser->toksuper != NO_PARENT_IDX)
                     {
-                        case JTOK_OBJECT:
-                        {
-                            /* primitives cannot be keys (they are not
-                             * quoted)
-                             */
-                            parser->pos = start;
-                            status      = JTOK_PARSE_STATUS_INVAL;
-                        }
-                        break;
-                        case JTOK_STRING:
-                        {
-                            if (parent->size != 0)
-                            {
-                                /* an object key can only have 1 value */
-                                parser->pos = start;
-                                status      = JTOK_PARSE_STATUS_INVAL;
-                            }
-                        }
-                        break;
-                        default:
-                        {
-                            /*
-                             * If we're inside parse_object,
-                             * other types cannot be parent tokens
-                             */
-                            status = JTOK_PARSE_STATUS_INVAL;
-                        }
-                        break;
-                    }
-
-                    if (status == JTOK_PARSE_STATUS_OK)
-                    {
-                        status = jtok_parse_primitive(parser);
-                        if (status == JTOK_PARSE_STATUS_OK)
-                        {
-                            if (parser->toksuper != NO_PARENT_IDX)
-                            {
-                                tokens[parser->toksuper].size++;
-                            }
-                            expecting = OBJECT_COMMA;
-                        }
+                        jtok_token_add_child(parser, parser->toksuper);
                     }
+                    frame->expecting = JTOK_STATE_OBJECT_COMMA;
                 }
-                else
-                {
-                    /* move pos to start of the key that's missing the value */
-                    parser->pos = tokens[parser->toksuper].start;
-                    status      = JTOK_PARSE_STATUS_KEY_NO_VAL;
-                }
-            }
-            break;
-            default: /* unexpected character */
-            {
-                parser->pos = start;
-                status      = JTOK_PARSE_STATUS_INVAL;
             }
-            break;
-        } /* end of character switch statement */
-    }
+        }
+        break;
+        case JTOK_ACTION_COLON:
+        {
+            frame->expecting = JTOK_STATE_OBJECT_VALUE;
 
-    if (status == JTOK_PARSE_STATUS_OK)
-    {
-        /* If we didnt find the } to close current object, we have partial JSON
-         */
-        parser->pos = start;
-        status      = JTOK_PARSE_STATUS_PARTIAL_TOKEN;
+            /* Superior token becomes the key we just processed */
+            parser->toksuper = parser->toknext - 1;
+        }
+        break;
+        case JTOK_ACTION_COMMA:
+        {
+            int key          = parser->toksuper;
+            frame->expecting = JTOK_STATE_OBJECT_KEY;
+            parser->toksuper = jtok_token_parent(parser, key);
+        }
+        break;
+        default:
+        {
+            status = jtok_fsm_error(parser, frame, next);
+        }
+        break;
     }
 
     return status;
 }
 
 
+void jtok_object_child_closed(jtok_parser_t *parser, jtok_frame_t *frame,
+                              int child)
+{
+    /* The object or array we just left is the value of the current key */
+    int key = jtok_token_parent(parser, child);
+    jtok_token_add_child(parser, key);
+    parser->toksuper = key;
+    frame->expecting = JTOK_STATE_OBJECT_COMMA;
+}
+
+
 bool jtok_toktokcmp_object(const jtok_tkn_t *obj1, const jtok_tkn_t *obj2)
 {
     const jtok_tkn_t *const pool1 = obj1->pool;
     assert(pool1 != NULL);
-    assert(pool1->type == JTOK_OBJECT);
+    assert(pool1->type == JTOK_OBJECT || pool1->type == JTOK_ARRAY);
     assert(pool1->json == obj1->json);
-    if (pool1 != obj1)
-    {
-        /* Greater than 1 because if it's non-empty, it must AT LEAST
-         * have a key inside it as well as the value for that key */
-        assert(pool1->size > 1);
-    }
 
     const jtok_tkn_t *const pool2 = obj2->pool;
     assert(pool2 != NULL);
-    assert(pool2->type == JTOK_OBJECT);
+    assert(pool2->type == JTOK_OBJECT || pool2->type == JTOK_ARRAY);
     assert(pool2->json == obj2->json);
-    if (pool2 != obj2)
-    {
-        /* Greater than 1 because if it's non-empty, it must AT LEAST
-         * have a key inside it as well as the value for that key */
-        assert(pool2->size > 1);
-    }
-
 
     bool is_equal = true;
     if (obj1->type != JTOK_OBJECT || obj2->type != JTOK_OBJECT)
@@ -0,0 +1,1168 @@
+/**
+ * @file jtok_parallel.c
+ * @author Carl Mattatall (cmattatall2@gmail.com)
+ * @brief Multi-threaded drivers. jtok_parse_parallel cuts an NDJSON buffer
+ * into chunks at newlines, parses the chunks on a fixed pool of POSIX threads
+ * and hands the documents to the caller in the order they appear in the
+ * buffer. jtok_parse_n_parallel cuts a single big document into slices,
+ * parses the slices on their own and stitches the tokens back together.
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2020 Carl Mattatall
+ *
+ */
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../inc/jtok.h"
+#include "inc/jtok_fsm.h"
+#include "inc/jtok_index.h"
+
+/* Bytes of json a worker takes at a time. Big enough that a chunk costs far
+ * more to parse than to hand out, small enough to keep every worker busy */
+#ifndef JTOK_PARALLEL_CHUNK_SIZE
+#define JTOK_PARALLEL_CHUNK_SIZE (1 << 20)
+#endif
+
+/* Smallest slice of a single document worth a thread of its own */
+#ifndef JTOK_PARALLEL_SLICE_MIN
+#define JTOK_PARALLEL_SLICE_MIN (1 << 16)
+#endif
+
+#define JTOK_PARALLEL_NO_FAILURE SIZE_MAX
+
+/* Deepest nesting of a document, the same as for jtok_parse_n */
+#define JTOK_PARALLEL_MAX_DEPTH (JTOK_MAX_RECURSE_DEPTH + 1)
+
+/* A slice has up to 3 stand-in tokens for each object or array that is
+ * already open where it starts */
+#define JTOK_PARALLEL_MAX_PROXIES (3 * JTOK_PARALLEL_MAX_DEPTH)
+
+typedef struct
+{
+    jtok_doc_t doc;   /* position and status of the document */
+    int        first; /* index of its first token in the worker's tokens */
+    int        count; /* number of tokens */
+} jtok_parallel_doc_t;
+
+typedef struct
+{
+    const char *    json;          /* the whole buffer */
+    size_t          len;           /* number of bytes in the buffer */
+    size_t          pool_size;     /* max tokens per document */
+    jtok_doc_func   handler;       /* gets the documents in order */
+    void *          ctx;           /* passed to handler */
+    size_t          nchunks;       /* number of chunks in the buffer */
+    size_t          next_chunk;    /* next chunk to hand out */
+    size_t          next_delivery; /* chunk whose documents go out next */
+    size_t          failed;        /* first chunk a worker ran out of memory */
+    pthread_mutex_t lock;          /* guards next_chunk onwards */
+    pthread_cond_t  turn;          /* signalled when next_delivery moves */
+} jtok_parallel_batch_t;
+
+typedef struct
+{
+    jtok_parallel_batch_t *batch;
+    pthread_t              thread;
+    jtok_tkn_t *           tkns;      /* tokens of the documents of the chunk */
+    size_t                 tkn_cap;   /* number of entries in tkns */
+    size_t                 tkn_count; /* number of entries in use */
+    jtok_parallel_doc_t *  docs;      /* documents of the chunk */
+    size_t                 doc_cap;   /* number of entries in docs */
+    size_t                 doc_count; /* number of entries in use */
+    jtok_frame_t           stack[JTOK_MAX_RECURSE_DEPTH + 1];
+} jtok_parallel_worker_t;
+
+typedef void (*jtok_parallel_job_func)(void *ctx, size_t i);
+
+typedef struct
+{
+    jtok_parallel_job_func job;   /* runs job i */
+    void *                 ctx;   /* passed to job */
+    size_t                 count; /* number of jobs */
+    size_t                 next;  /* next job to hand out */
+    pthread_mutex_t        lock;  /* guards next */
+} jtok_parallel_jobs_t;
+
+/* Unmatched brackets of one equal cut of a single document */
+typedef struct
+{
+    size_t               start;   /* offset of the cut in the json */
+    size_t               end;     /* offset one past the end of the cut */
+    bool                 flips;   /* holds an odd number of quotes */
+    jtok_index_nesting_t nest[2]; /* outside/inside of a string at start */
+    int                  open_pos[2][JTOK_PARALLEL_MAX_DEPTH];
+} jtok_parallel_cut_t;
+
+/* Part of a single document parsed on its own */
+typedef struct
+{
+    size_t              start;  /* offset of the slice, just past a comma */
+    size_t              end;    /* offset one past the end of the slice */
+    int                 depth;  /* objects and arrays open at start */
+    int                 open[JTOK_PARALLEL_MAX_DEPTH];  /* where they start */
+    int                 cont[JTOK_PARALLEL_MAX_DEPTH];  /* their stand-ins */
+    int                 first[JTOK_PARALLEL_MAX_DEPTH]; /* links 1st child */
+    int                 key[JTOK_PARALLEL_MAX_DEPTH];   /* owns next level */
+    int                 proxies; /* number of stand-in tokens */
+    int                 global[JTOK_PARALLEL_MAX_PROXIES]; /* stood in for */
+    int                 last[JTOK_PARALLEL_MAX_DEPTH]; /* at end, last child */
+    size_t              base;   /* index of its first token in the result */
+    jtok_frame_t        stack[JTOK_PARALLEL_MAX_DEPTH];
+    jtok_parser_t       parser;
+    JTOK_PARSE_STATUS_t status;
+} jtok_parallel_slice_t;
+
+typedef struct
+{
+    const char *           json;    /* the document */
+    size_t                 len;     /* number of bytes in the document */
+    jtok_tkn_t *           tkns;    /* caller's token pool */
+    size_t                 size;    /* number of tokens in tkns */
+    jtok_parallel_cut_t *  cuts;    /* one per thread */
+    size_t                 ncuts;   /* number of cuts */
+    jtok_parallel_slice_t *slices;  /* at most one per cut */
+    size_t                 nslices; /* number of slices */
+} jtok_parallel_split_t;
+
+
+/**
+ * @brief Get the number of threads to run
+ *
+ * @param threads number asked for, 0 for one per online cpu
+ * @return unsigned int number of threads
+ */
+static unsigned int jtok_parallel_threads(unsigned int threads)
+{
+    if (threads == 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads   = (cpus > 0) ? (unsigned int)cpus : 1;
+    }
+    return threads;
+}
+
+
+/**
+ * @brief Find where a chunk starts. Chunk i starts after the first newline at
+ * or past i * JTOK_PARALLEL_CHUNK_SIZE, so every worker finds the bounds of
+ * its chunk on its own and no document is split between two chunks.
+ *
+ * @param batch the batch
+ * @param chunk index of the chunk (batch->nchunks for the end of the last one)
+ * @return size_t offset of the chunk in the buffer
+ */
+static size_t jtok_parallel_chunk_start(const jtok_parallel_batch_t *batch,
+                                        size_t                       chunk)
+{
+    if (chunk == 0)
+    {
+        return 0;
+    }
+
+    size_t from = chunk * (size_t)JTOK_PARALLEL_CHUNK_SIZE;
+    if (from >= batch->len)
+    {
+        return batch->len;
+    }
+
+    const char *newline = memchr(&batch->json[from], '\n', batch->len - from);
+    if (newline == NULL)
+    {
+        return batch->len;
+    }
+    return (size_t)(newline - batch->json) + 1;
+}
+
+
+/**
+ * @brief Make sure a worker has room for another document of up to
+ * batch->pool_size tokens
+ *
+ * @param worker the worker
+ * @return true if there is room
+ * @return false if the memory ran out
+ */
+static bool jtok_parallel_reserve(jtok_parallel_worker_t *worker)
+{
+    size_t need = worker->batch->pool_size;
+    if (worker->tkn_cap - worker->tkn_count < need)
+    {
+        size_t cap = worker->tkn_cap * 2;
+        if (cap < worker->tkn_count + need)
+        {
+            cap = worker->tkn_count + need;
+        }
+        if (cap > INT_MAX)
+        {
+            return false;
+        }
+
+        jtok_tkn_t *tkns = realloc(worker->tkns, cap * sizeof(*tkns));
+        if (tkns == NULL)
+        {
+            return false;
+        }
+
+        if (tkns != worker->tkns)
+        {
+            /* Every token points back at the pool of its document */
+            size_t d;
+            for (d = 0; d < worker->doc_count; d++)
+            {
+                jtok_tkn_t *pool = &tkns[worker->docs[d].first];
+                int         i;
+                for (i = 0; i < worker->docs[d].count; i++)
+                {
+                    pool[i].pool = pool;
+                }
+            }
+        }
+        worker->tkns    = tkns;
+        worker->tkn_cap = cap;
+    }
+
+    if (worker->doc_count == worker->doc_cap)
+    {
+        size_t cap = (worker->doc_cap > 0) ? worker->doc_cap * 2 : 64;
+        jtok_parallel_doc_t *docs = realloc(worker->docs, cap * sizeof(*docs));
+        if (docs == NULL)
+        {
+            return false;
+        }
+        worker->docs    = docs;
+        worker->doc_cap = cap;
+    }
+    return true;
+}
+
+
+/**
+ * @brief Parse every document of a chunk. The documents are parsed straight
+ * into the worker's tokens one after the other, so nothing is copied before
+ * they are handed out.
+ *
+ * Token positions are ints, so the json is handed to the parser from the
+ * start of the chunk rather than the start of the buffer. A chunk only
+ * reaches INT_MAX bytes if it ends in a huge line, and then it is parsed a
+ * line at a time, with a line that is still too long reported as a document
+ * with status JTOK_PARSE_STATUS_TOO_LONG.
+ *
+ * @param worker the worker
+ * @param start offset of the chunk in the buffer
+ * @param end offset one past the end of the chunk
+ * @return true if the whole chunk was parsed
+ * @return false if the memory ran out
+ */
+static bool jtok_parallel_parse_chunk(jtok_parallel_worker_t *worker,
+                                      size_t start, size_t end)
+{
+    jtok_parallel_batch_t *batch = worker->batch;
+    size_t                 base  = start;
+    jtok_parser_t          parser;
+    jtok_doc_t             doc;
+
+    worker->tkn_count = 0;
+    worker->doc_count = 0;
+    while (base < end)
+    {
+        size_t      stop    = end;
+        const char *newline = NULL;
+        if (end - base > INT_MAX)
+        {
+            newline = memchr(&batch->json[base], '\n', INT_MAX);
+            if (newline == NULL)
+            {
+                newline = memchr(&batch->json[base], '\n', end - base);
+            }
+            stop = (newline != NULL) ? (size_t)(newline - batch->json) + 1
+                                     : end;
+        }
+
+        if (stop - base > INT_MAX)
+        {
+            if (!jtok_parallel_reserve(worker))
+            {
+                return false;
+            }
+            jtok_parallel_doc_t *rec = &worker->docs[worker->doc_count++];
+            rec->doc.start  = base;
+            rec->doc.end    = (newline != NULL) ? stop - 1 : stop;
+            rec->doc.status = JTOK_PARSE_STATUS_TOO_LONG;
+            rec->first      = (int)worker->tkn_count;
+            rec->count      = 0;
+        }
+        else
+        {
+            size_t offset = 0;
+            for (;;)
+            {
+                if (!jtok_parallel_reserve(worker))
+                {
+                    return false;
+                }
+
+                jtok_parser_init(&parser, &worker->tkns[worker->tkn_count],
+                                 batch->pool_size, worker->stack,
+                                 sizeof(worker->stack) /
+                                     sizeof(worker->stack[0]));
+                if (!jtok_parse_many(&parser, &batch->json[base], stop - base,
+                                     &offset, &doc))
+                {
+                    break;
+                }
+
+                jtok_parallel_doc_t *rec = &worker->docs[worker->doc_count++];
+                rec->doc = doc;
+                rec->doc.start += base;
+                rec->doc.end += base;
+                rec->first = (int)worker->tkn_count;
+                rec->count = parser.toknext;
+                worker->tkn_count += parser.toknext;
+            }
+        }
+        base = stop;
+    }
+    return true;
+}
+
+
+static void *jtok_parallel_worker_run(void *arg)
+{
+    jtok_parallel_worker_t *worker = arg;
+    jtok_parallel_batch_t * batch  = worker->batch;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&batch->lock);
+        size_t chunk = batch->next_chunk;
+        bool   take  = (chunk < batch->nchunks && chunk < batch->failed);
+        if (take)
+        {
+            batch->next_chunk++;
+        }
+        pthread_mutex_unlock(&batch->lock);
+
+        if (!take)
+        {
+            break;
+        }
+
+        bool parsed = jtok_parallel_parse_chunk(
+            worker, jtok_parallel_chunk_start(batch, chunk),
+            jtok_parallel_chunk_start(batch, chunk + 1));
+
+        /* Wait for the chunks before this one to be handed out. The chunks
+         * are taken in order, so the one being waited for is always held by
+         * a worker that is about to deliver it */
+        pthread_mutex_lock(&batch->lock);
+        if (!parsed && chunk < batch->failed)
+        {
+            batch->failed = chunk;
+        }
+        while (batch->next_delivery != chunk)
+        {
+            pthread_cond_wait(&batch->turn, &batch->lock);
+        }
+        bool deliver = (chunk < batch->failed);
+        pthread_mutex_unlock(&batch->lock);
+
+        if (deliver)
+        {
+            size_t d;
+            for (d = 0; d < worker->doc_count; d++)
+            {
+                const jtok_parallel_doc_t *rec = &worker->docs[d];
+                batch->handler(batch->ctx, &rec->doc, &worker->tkns[rec->first],
+                               rec->count);
+            }
+        }
+
+        pthread_mutex_lock(&batch->lock);
+        batch->next_delivery++;
+        pthread_cond_broadcast(&batch->turn);
+        pthread_mutex_unlock(&batch->lock);
+    }
+    return NULL;
+}
+
+
+JTOK_PARSE_STATUS_t jtok_parse_parallel(const char *json, size_t len,
+                                        unsigned int threads, size_t pool_size,
+                                        jtok_doc_func handler, void *ctx)
+{
+    if (NULL == json || NULL == handler || 0 == pool_size ||
+        pool_size > INT_MAX)
+    {
+        return JTOK_PARSE_STATUS_NULL_PARAM;
+    }
+
+    jtok_parallel_batch_t batch;
+    batch.json          = json;
+    batch.len           = len;
+    batch.pool_size     = pool_size;
+    batch.handler       = handler;
+    batch.ctx           = ctx;
+    batch.next_chunk    = 0;
+    batch.next_delivery = 0;
+    batch.failed        = JTOK_PARALLEL_NO_FAILURE;
+    batch.nchunks =
+        (len + JTOK_PARALLEL_CHUNK_SIZE - 1) / JTOK_PARALLEL_CHUNK_SIZE;
+
+    threads = jtok_parallel_threads(threads);
+    if (threads > batch.nchunks)
+    {
+        threads = (batch.nchunks > 0) ? (unsigned int)batch.nchunks : 1;
+    }
+
+    jtok_parallel_worker_t *workers = calloc(threads, sizeof(*workers));
+    if (workers == NULL)
+    {
+        return JTOK_PARSE_STATUS_NOMEM;
+    }
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_cond_init(&batch.turn, NULL);
+
+    /* The calling thread is worker 0. If a thread can't be started the
+     * others just take more chunks */
+    unsigned int started;
+    for (started = 1; started < threads; started++)
+    {
+        workers[started].batch = &batch;
+        if (pthread_create(&workers[started].thread, NULL,
+                           jtok_parallel_worker_run, &workers[started]) != 0)
+        {
+            break;
+        }
+    }
+    workers[0].batch = &batch;
+    jtok_parallel_worker_run(&workers[0]);
+
+    unsigned int i;
+    for (i = 1; i < started; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+    }
+    for (i = 0; i < threads; i++)
+    {
+        free(workers[i].tkns);
+        free(workers[i].docs);
+    }
+    free(workers);
+    pthread_cond_destroy(&batch.turn);
+    pthread_mutex_destroy(&batch.lock);
+
+    if (batch.failed != JTOK_PARALLEL_NO_FAILURE)
+    {
+        return JTOK_PARSE_STATUS_NOMEM;
+    }
+    return JTOK_PARSE_STATUS_OK;
+}
+
+
+static void *jtok_parallel_jobs_run(void *arg)
+{
+    jtok_parallel_jobs_t *jobs = arg;
+    for (;;)
+    {
+        pthread_mutex_lock(&jobs->lock);
+        size_t i = jobs->next++;
+        pthread_mutex_unlock(&jobs->lock);
+
+        if (i >= jobs->count)
+        {
+            break;
+        }
+        jobs->job(jobs->ctx, i);
+    }
+    return NULL;
+}
+
+
+/**
+ * @brief Run count jobs on up to threads threads, the calling thread
+ * included, and wait for all of them to finish
+ *
+ * @param threads number of threads
+ * @param count number of jobs
+ * @param job the job, called once with each i from 0 to count - 1
+ * @param ctx passed to job
+ */
+static void jtok_parallel_for(unsigned int threads, size_t count,
+                              jtok_parallel_job_func job, void *ctx)
+{
+    jtok_parallel_jobs_t jobs;
+    jobs.job   = job;
+    jobs.ctx   = ctx;
+    jobs.count = count;
+    jobs.next  = 0;
+    pthread_mutex_init(&jobs.lock, NULL);
+
+    if (threads > count)
+    {
+        threads = (unsigned int)count;
+    }
+
+    /* Without room for the thread handles the calling thread runs every
+     * job itself */
+    pthread_t *   thread  = (threads > 1) ? malloc(threads * sizeof(*thread))
+                                          : NULL;
+    unsigned int  started = 0;
+    if (thread != NULL)
+    {
+        for (started = 1; started < threads; started++)
+        {
+            if (pthread_create(&thread[started], NULL, jtok_parallel_jobs_run,
+                               &jobs) != 0)
+            {
+                break;
+            }
+        }
+    }
+    jtok_parallel_jobs_run(&jobs);
+
+    unsigned int i;
+    for (i = 1; i < started; i++)
+    {
+        pthread_join(thread[i], NULL);
+    }
+    free(thread);
+    pthread_mutex_destroy(&jobs.lock);
+}
+
+
+static void *jtok_parallel_realloc(void *ctx, void *ptr, size_t size)
+{
+    (void)ctx;
+    return realloc(ptr, size);
+}
+
+
+/**
+ * @brief Find the unmatched brackets of a cut. The cuts don't depend on each
+ * other, so this runs on every cut at once.
+ */
+static void jtok_parallel_cut_job(void *ctx, size_t i)
+{
+    jtok_parallel_split_t *split = ctx;
+    jtok_parallel_cut_t *  cut   = &split->cuts[i];
+    int *open_pos[2] = {cut->open_pos[0], cut->open_pos[1]};
+
+    cut->flips = jtok_index_nesting(split->json, cut->start, cut->end,
+                                    cut->nest, open_pos,
+                                    JTOK_PARALLEL_MAX_DEPTH);
+}
+
+
+/**
+ * @brief Find the first comma inside an object or array, going one character
+ * at a time from a position where the string state and nesting are known
+ *
+ * @param json the document
+ * @param from where to start looking
+ * @param to where to stop looking
+ * @param in_string true if from is inside a string
+ * @param open positions of the objects and arrays open at from. Updated to
+ * the ones open at the comma.
+ * @param depth in: number of entries in open. out: number at the comma, -1
+ * if the nesting is too deep (or the brackets don't match)
+ * @return size_t offset just past the comma, 0 if there is none before to
+ * or the document ends first (*depth is then 0)
+ */
+static size_t jtok_parallel_next_comma(const char *json, size_t from,
+                                       size_t to, bool in_string, int *open,
+                                       int *depth)
+{
+    bool   escaped = false;
+    size_t pos;
+
+    if (in_string)
+    {
+        size_t run = from;
+        while (run > 0 && json[run - 1] == '\\')
+        {
+            run--;
+        }
+        escaped = ((from - run) & 1) != 0;
+    }
+
+    for (pos = from; pos < to && *depth > 0; pos++)
+    {
+        char c = json[pos];
+        if (in_string)
+        {
+            if (escaped)
+            {
+                escaped = false;
+            }
+            else if (c == '\\')
+            {
+                escaped = true;
+            }
+            else if (c == '\"')
+            {
+                in_string = false;
+            }
+        }
+        else
+        {
+            switch (c)
+            {
+                case '\"':
+                {
+                    in_string = true;
+                }
+                break;
+                case '{':
+                case '[':
+                {
+                    if (*depth >= JTOK_PARALLEL_MAX_DEPTH)
+                    {
+                        *depth = -1;
+                        return 0;
+                    }
+                    open[(*depth)++] = (int)pos;
+                }
+                break;
+                case '}':
+                case ']':
+                {
+                    (*depth)--;
+                }
+                break;
+                case ',':
+                {
+                    return pos + 1;
+                }
+                break;
+                default:
+                {
+                }
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Chain the cuts together to find the string state and the open
+ * objects and arrays at the start of each one, then start a slice at the
+ * first comma of each cut
+ *
+ * @param split the split document
+ * @return true if the document was split
+ * @return false if it has to be parsed serially
+ */
+static bool jtok_parallel_plan(jtok_parallel_split_t *split)
+{
+    int    stack[JTOK_PARALLEL_MAX_DEPTH];
+    int    depth     = 0;
+    bool   in_string = false;
+    size_t c;
+
+    split->slices[0].start = 0;
+    split->slices[0].depth = 0;
+    split->nslices         = 1;
+    for (c = 1; c < split->ncuts; c++)
+    {
+        /* Nesting at the start of cut c */
+        const jtok_parallel_cut_t * prev = &split->cuts[c - 1];
+        const jtok_index_nesting_t *nest = &prev->nest[in_string];
+        if (nest->closes > depth ||
+            depth - nest->closes + nest->opens > JTOK_PARALLEL_MAX_DEPTH)
+        {
+            return false;
+        }
+        depth -= nest->closes;
+        memcpy(&stack[depth], prev->open_pos[in_string],
+               nest->opens * sizeof(*stack));
+        depth += nest->opens;
+        in_string = (in_string != prev->flips);
+
+        if (depth == 0)
+        {
+            /* The document ends before cut c (or hasn't started yet) */
+            break;
+        }
+
+        jtok_parallel_slice_t *slice = &split->slices[split->nslices];
+        memcpy(slice->open, stack, depth * sizeof(*stack));
+        slice->depth = depth;
+        slice->start = jtok_parallel_next_comma(
+            split->json, split->cuts[c].start, split->cuts[c].end, in_string,
+            slice->open, &slice->depth);
+        if (slice->depth < 0)
+        {
+            return false;
+        }
+        else if (slice->depth == 0)
+        {
+            break;
+        }
+        else if (slice->start != 0)
+        {
+            split->nslices++;
+        }
+    }
+
+    size_t i;
+    for (i = 0; i < split->nslices; i++)
+    {
+        split->slices[i].end = (i + 1 < split->nslices)
+                                   ? split->slices[i + 1].start
+                                   : split->len;
+    }
+    return split->nslices > 1;
+}
+
+
+/**
+ * @brief Fill stand-in token idx of a slice parser
+ */
+static int jtok_parallel_proxy(jtok_parser_t *parser, int idx,
+                               JTOK_TYPE_t type, int start, int parent)
+{
+    jtok_tkn_t *tkn = &parser->tkn_pool[idx];
+    tkn->json       = parser->json;
+    tkn->pool       = parser->tkn_pool;
+    tkn->type       = type;
+    tkn->start      = start;
+    tkn->end        = INVALID_ARRAY_INDEX;
+    tkn->size       = 0;
+    tkn->parent     = parent;
+    tkn->sibling    = NO_SIBLING_IDX;
+    tkn->value_type = JTOK_VALUE_TYPE_not_a_value_tkn;
+    tkn->flags      = 0;
+    tkn->hash       = 0;
+    tkn->next       = INVALID_ARRAY_INDEX;
+    return idx;
+}
+
+
+/**
+ * @brief Get the type of the first element of the array at pos. The slices
+ * before have checked that it has one.
+ */
+static JTOK_TYPE_t jtok_parallel_element_type(const char *json, int pos)
+{
+    JTOK_TYPE_t type;
+    do
+    {
+        pos++;
+    } while (jtok_is_whitespace(json[pos]));
+
+    switch (json[pos])
+    {
+        case '{':
+        {
+            type = JTOK_OBJECT;
+        }
+        break;
+        case '[':
+        {
+            type = JTOK_ARRAY;
+        }
+        break;
+        case '\"':
+        {
+            type = JTOK_STRING;
+        }
+        break;
+        default:
+        {
+            type = JTOK_PRIMITIVE;
+        }
+        break;
+    }
+    return type;
+}
+
+
+/**
+ * @brief Set a slice parser up as if it had parsed everything before the
+ * slice. Each open object or array gets a stand-in token and a frame, and an
+ * object that holds the next one gets a stand-in for the key of it too. Each
+ * frame starts with one more stand-in as its last child, which the parser
+ * links to the first child it finds in the slice.
+ */
+static void jtok_parallel_seed(jtok_parallel_slice_t *slice)
+{
+    jtok_parser_t *parser = &slice->parser;
+    int            parent = NO_PARENT_IDX;
+    int            n      = 0;
+    int            j;
+
+    for (j = 0; j < slice->depth; j++)
+    {
+        int         pos  = slice->open[j];
+        JTOK_TYPE_t type = JTOK_ARRAY;
+        if (parser->json[pos] == '{')
+        {
+            type = JTOK_OBJECT;
+        }
+
+        slice->cont[j]  = jtok_parallel_proxy(parser, n++, type, pos, parent);
+        slice->first[j] = jtok_parallel_proxy(
+            parser, n++, JTOK_UNASSIGNED_TOKEN, pos, NO_PARENT_IDX);
+        slice->key[j]   = INVALID_ARRAY_INDEX;
+        parent          = slice->cont[j];
+        if (type == JTOK_OBJECT && j + 1 < slice->depth)
+        {
+            slice->key[j] = jtok_parallel_proxy(parser, n++, JTOK_STRING, pos,
+                                                slice->cont[j]);
+            parent        = slice->key[j];
+        }
+
+        jtok_frame_t *frame = &slice->stack[j];
+        frame->tkn          = slice->cont[j];
+        frame->last_child   = slice->first[j];
+        frame->type         = type;
+        frame->element_type = JTOK_UNASSIGNED_TOKEN;
+        if (type == JTOK_OBJECT)
+        {
+            frame->expecting = JTOK_STATE_OBJECT_COMMA;
+        }
+        else
+        {
+            frame->expecting    = JTOK_STATE_ARRAY_COMMA;
+            frame->element_type = jtok_parallel_element_type(parser->json, pos);
+        }
+    }
+
+    /* The slice starts just past a comma of the innermost one */
+    jtok_frame_t *frame = &slice->stack[slice->depth - 1];
+    if (frame->type == JTOK_OBJECT)
+    {
+        frame->expecting = JTOK_STATE_OBJECT_KEY;
+    }
+    else
+    {
+        frame->expecting = JTOK_STATE_ARRAY_VALUE;
+    }
+    parser->toksuper = frame->tkn;
+    parser->toknext  = n;
+    parser->depth    = slice->depth;
+    slice->proxies   = n;
+}
+
+
+/**
+ * @brief Parse a slice. The first one goes straight into the caller's pool,
+ * the others into pools of their own until they are stitched.
+ */
+static void jtok_parallel_slice_job(void *ctx, size_t i)
+{
+    jtok_parallel_split_t *split  = ctx;
+    jtok_parallel_slice_t *slice  = &split->slices[i];
+    jtok_parser_t *        parser = &slice->parser;
+
+    if (i == 0)
+    {
+        jtok_parser_init(parser, split->tkns, split->size, slice->stack,
+                         JTOK_PARALLEL_MAX_DEPTH);
+        slice->proxies = 0;
+    }
+    else
+    {
+        size_t      size = JTOK_PARALLEL_MAX_PROXIES +
+                      (slice->end - slice->start) / 8;
+        jtok_tkn_t *pool = malloc(size * sizeof(*pool));
+        jtok_parser_init(parser, pool, size, slice->stack,
+                         JTOK_PARALLEL_MAX_DEPTH);
+        if (pool == NULL)
+        {
+            slice->status = JTOK_PARSE_STATUS_NOMEM;
+            return;
+        }
+        jtok_parser_set_allocator(parser, jtok_parallel_realloc, NULL);
+        parser->json = (char *)split->json;
+        jtok_parallel_seed(slice);
+    }
+
+    parser->json     = (char *)split->json;
+    parser->json_len = (int)slice->start;
+    parser->next_pos = (int)slice->start;
+    slice->status    = jtok_parser_feed(parser, &split->json[slice->start],
+                                     slice->end - slice->start);
+}
+
+
+/**
+ * @brief Get the index in the result of token t of a slice parser
+ */
+static int jtok_parallel_global(const jtok_parallel_slice_t *slice, int t)
+{
+    if (t < slice->proxies)
+    {
+        return slice->global[t];
+    }
+    return (int)slice->base + (t - slice->proxies);
+}
+
+
+/**
+ * @brief Check that every slice picked up exactly where the one before left
+ * off, and work out where the tokens of each slice go and which tokens its
+ * stand-ins stand in for
+ *
+ * @param split the split document
+ * @return true if the slices can be stitched
+ * @return false if the document has to be parsed serially
+ */
+static bool jtok_parallel_stitch(jtok_parallel_split_t *split)
+{
+    size_t base = 0;
+    size_t i;
+    for (i = 0; i < split->nslices; i++)
+    {
+        jtok_parallel_slice_t *slice  = &split->slices[i];
+        jtok_parser_t *        parser = &slice->parser;
+        int                    j;
+
+        if (i + 1 == split->nslices)
+        {
+            if (slice->status != JTOK_PARSE_STATUS_OK)
+            {
+                return false;
+            }
+        }
+        else
+        {
+            const jtok_parallel_slice_t *next = &split->slices[i + 1];
+            if (slice->status != JTOK_PARSE_STATUS_PARTIAL_TOKEN ||
+                parser->next_pos != (int)slice->end ||
+                parser->depth != (unsigned int)next->depth)
+            {
+                return false;
+            }
+            for (j = 0; j < next->depth; j++)
+            {
+                int tkn = parser->stack[j].tkn;
+                if (parser->tkn_pool[tkn].start != next->open[j])
+                {
+                    return false;
+                }
+            }
+        }
+
+        slice->base = base;
+        base += parser->toknext - slice->proxies;
+
+        if (i > 0)
+        {
+            /* The open objects and arrays are the ones still open at the end
+             * of the slice before, along with the keys that own them */
+            const jtok_parallel_slice_t *prev = &split->slices[i - 1];
+            for (j = 0; j < slice->depth; j++)
+            {
+                int tkn = prev->parser.stack[j].tkn;
+                slice->global[slice->cont[j]] = jtok_parallel_global(prev, tkn);
+                if (slice->key[j] != INVALID_ARRAY_INDEX)
+                {
+                    int inner = prev->parser.stack[j + 1].tkn;
+                    int key   = prev->parser.tkn_pool[inner].parent;
+                    slice->global[slice->key[j]] =
+                        jtok_parallel_global(prev, key);
+                }
+            }
+        }
+
+        for (j = 0; j < (int)parser->depth; j++)
+        {
+            const jtok_frame_t *frame = &parser->stack[j];
+            if (j < slice->depth && frame->last_child == slice->first[j])
+            {
+                /* No child in this slice */
+                slice->last[j] = split->slices[i - 1].last[j];
+            }
+            else if (frame->last_child == NO_CHILD_IDX)
+            {
+                slice->last[j] = NO_CHILD_IDX;
+            }
+            else
+            {
+                slice->last[j] = jtok_parallel_global(slice, frame->last_child);
+            }
+        }
+    }
+    return base <= split->size;
+}
+
+
+/**
+ * @brief Move the tokens of a slice to their place in the caller's pool
+ */
+static void jtok_parallel_copy_job(void *ctx, size_t i)
+{
+    jtok_parallel_split_t *      split  = ctx;
+    const jtok_parallel_slice_t *slice  = &split->slices[i + 1];
+    const jtok_parser_t *        parser = &slice->parser;
+    jtok_tkn_t *                 dst    = &split->tkns[slice->base];
+    int                          t;
+
+    for (t = slice->proxies; t < parser->toknext; t++)
+    {
+        *dst = parser->tkn_pool[t];
+        dst->pool = split->tkns;
+        if (dst->parent != NO_PARENT_IDX)
+        {
+            dst->parent = jtok_parallel_global(slice, dst->parent);
+        }
+        if (dst->sibling != NO_SIBLING_IDX)
+        {
+            dst->sibling = jtok_parallel_global(slice, dst->sibling);
+        }
+        dst->next = jtok_parallel_global(slice, dst->next);
+        dst++;
+    }
+}
+
+
+/**
+ * @brief Add what a slice found out about a token it stood in for to the
+ * token itself
+ */
+static void jtok_parallel_merge(jtok_parallel_split_t *      split,
+                                const jtok_parallel_slice_t *slice, int proxy)
+{
+    const jtok_tkn_t *from = &slice->parser.tkn_pool[proxy];
+    jtok_tkn_t *      to   = &split->tkns[slice->global[proxy]];
+
+    to->size += from->size;
+    if (from->end != INVALID_ARRAY_INDEX)
+    {
+        to->end = from->end;
+    }
+    if (from->sibling != NO_SIBLING_IDX)
+    {
+        to->sibling = jtok_parallel_global(slice, from->sibling);
+    }
+    if (from->next != INVALID_ARRAY_INDEX)
+    {
+        /* Closed in the slice */
+        to->next = jtok_parallel_global(slice, from->next);
+    }
+}
+
+
+JTOK_PARSE_STATUS_t jtok_parse_n_parallel(const char *json, size_t len,
+                                          jtok_tkn_t *tkns, size_t size,
+                                          unsigned int threads)
+{
+    if (NULL == json || NULL == tkns || size < 1)
+    {
+        return jtok_parse_n(json, len, tkns, size);
+    }
+    else if (len > INT_MAX)
+    {
+        /* Token boundaries are stored as int */
+        return JTOK_PARSE_STATUS_TOO_LONG;
+    }
+
+    size_t ncuts = jtok_parallel_threads(threads);
+    if (ncuts > len / JTOK_PARALLEL_SLICE_MIN)
+    {
+        ncuts = len / JTOK_PARALLEL_SLICE_MIN;
+    }
+    if (ncuts < 2)
+    {
+        return jtok_parse_n(json, len, tkns, size);
+    }
+
+    jtok_parallel_split_t split;
+    split.json    = json;
+    split.len     = len;
+    split.tkns    = tkns;
+    split.size    = size;
+    split.ncuts   = ncuts;
+    split.nslices = 0;
+    split.cuts    = malloc(ncuts * sizeof(*split.cuts));
+    split.slices  = malloc(ncuts * sizeof(*split.slices));
+
+    bool   ok     = (split.cuts != NULL && split.slices != NULL);
+    size_t parsed = 0;
+    size_t i;
+    if (ok)
+    {
+        for (i = 0; i < ncuts; i++)
+        {
+            split.cuts[i].start = len / ncuts * i;
+            split.cuts[i].end   = (i + 1 < ncuts) ? len / ncuts * (i + 1) : len;
+        }
+        jtok_parallel_for(ncuts, ncuts, jtok_parallel_cut_job, &split);
+        ok = jtok_parallel_plan(&split);
+    }
+
+    if (ok)
+    {
+        jtok_parallel_for(ncuts, split.nslices, jtok_parallel_slice_job,
+                          &split);
+        parsed = split.nslices;
+        ok     = jtok_parallel_stitch(&split);
+    }
+
+    if (ok)
+    {
+        jtok_parallel_for(ncuts, split.nslices - 1, jtok_parallel_copy_job,
+                          &split);
+
+        /* Several slices can add children to the same object or array, so
+         * the stand-ins are merged one slice at a time */
+        for (i = 1; i < split.nslices; i++)
+        {
+            const jtok_parallel_slice_t *slice = &split.slices[i];
+            const jtok_parallel_slice_t *prev  = &split.slices[i - 1];
+            int                          j;
+            for (j = 0; j < slice->depth; j++)
+            {
+                jtok_parallel_merge(&split, slice, slice->cont[j]);
+                if (slice->key[j] != INVALID_ARRAY_INDEX)
+                {
+                    jtok_parallel_merge(&split, slice, slice->key[j]);
+                }
+
+                /* Link the last child before the slice to the first one in
+                 * it */
+                const jtok_tkn_t *first =
+                    &slice->parser.tkn_pool[slice->first[j]];
+                if (first->sibling != NO_SIBLING_IDX &&
+                    prev->last[j] != NO_CHILD_IDX)
+                {
+                    tkns[prev->last[j]].sibling =
+                        jtok_parallel_global(slice, first->sibling);
+                }
+
+                /* and end its subtree where the slice found it ends */
+                if (first->next != INVALID_ARRAY_INDEX &&
+                    prev->last[j] != NO_CHILD_IDX)
+                {
+                    tkns[prev->last[j]].next =
+                        jtok_parallel_global(slice, first->next);
+                }
+            }
+        }
+    }
+
+    for (i = 1; i < parsed; i++)
+    {
+        free(split.slices[i].parser.tkn_pool);
+    }
+    free(split.slices);
+    free(split.cuts);
+
+    if (!ok)
+    {
+        /* Invalid json, or json that can't be split. Parsing it serially
+         * reports any error exactly where jtok_parse_n would */
+        return jtok_parse_n(json, len, tkns, size);
+    }
+    return JTOK_PARSE_STATUS_OK;
+}
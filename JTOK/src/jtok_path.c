@@ -0,0 +1,304 @@
+/**
+ * @file jtok_path.c
+ * @author Carl Mattatall (cmattatall2@gmail.com)
+ * @brief Compiled JSON pointer (RFC 6901) queries over a parsed token pool
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2020 Carl Mattatall
+ *
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <string.h>
+
+#include "../inc/jtok.h"
+#include "inc/jtok_shared.h"
+
+
+/**
+ * @brief Get the array index a reference token spells, INVALID_ARRAY_INDEX
+ * if it is not "0" or a decimal with no leading zero that fits in an int
+ */
+static int jtok_path_index(const char *key, size_t len)
+{
+    int    index = 0;
+    size_t i;
+    if (len == 0 || (len > 1 && key[0] == '0'))
+    {
+        index = INVALID_ARRAY_INDEX;
+    }
+    for (i = 0; i < len && index != INVALID_ARRAY_INDEX; i++)
+    {
+        if (key[i] < '0' || key[i] > '9' || index > (INT_MAX - 9) / 10)
+        {
+            index = INVALID_ARRAY_INDEX;
+        }
+        else
+        {
+            index = index * 10 + (key[i] - '0');
+        }
+    }
+    return index;
+}
+
+
+/**
+ * @brief Compare a key token with a reference token that holds ~0 or ~1
+ * escapes, decoding them on the fly
+ */
+static bool jtok_path_escaped_match(const jtok_path_seg_t *seg,
+                                    const jtok_tkn_t *     tkn)
+{
+    const char *text = &tkn->json[tkn->start];
+    size_t      len  = (size_t)(tkn->end - tkn->start);
+    size_t      i     = 0;
+    size_t      j     = 0;
+    bool        match = true;
+    while (match && i < seg->len)
+    {
+        char c = seg->key[i++];
+        if (c == '~')
+        {
+            /* Compiling checked that a 0 or 1 follows */
+            c = (seg->key[i++] == '0') ? '~' : '/';
+        }
+        match = j < len && text[j++] == c;
+    }
+    return match && j == len;
+}
+
+
+/**
+ * @brief Check if key token tkn matches reference token seg
+ */
+static bool jtok_path_key_match(const jtok_path_seg_t *seg,
+                                const jtok_tkn_t *     tkn)
+{
+    bool match;
+    if (seg->escaped)
+    {
+        match = jtok_path_escaped_match(seg, tkn);
+    }
+    else
+    {
+        match = jtok_tokcmp_hash(seg->key, seg->len, seg->hash, tkn);
+    }
+    return match;
+}
+
+
+/**
+ * @brief Find the value reference token seg leads to from node
+ *
+ * @return int pool index of the first value seg matches (the one a wildcard
+ * starts at), or INVALID_ARRAY_INDEX
+ */
+static int jtok_path_step(const jtok_path_seg_t *seg, const jtok_tkn_t *node,
+                          jtok_keymap_t *keys, jtok_elemidx_t *elems)
+{
+    const jtok_tkn_t *tkns = node->pool;
+    int               idx  = INVALID_ARRAY_INDEX;
+    if (node->size == 0)
+    {
+        idx = INVALID_ARRAY_INDEX;
+    }
+    else if (node->type == JTOK_OBJECT)
+    {
+        if (seg->wildcard)
+        {
+            idx = (int)(node - tkns) + 1;
+        }
+        else if (keys != NULL && keys->obj == node && !seg->escaped)
+        {
+            idx = jtok_keymap_find(keys, node, seg->key, seg->len);
+        }
+        else
+        {
+            idx = (int)(node - tkns) + 1;
+            while (idx != NO_SIBLING_IDX &&
+                   !jtok_path_key_match(seg, &tkns[idx]))
+            {
+                idx = tkns[idx].sibling;
+            }
+        }
+
+        /* The value of a key is its only child, right after it */
+        if (idx != INVALID_ARRAY_INDEX)
+        {
+            idx++;
+        }
+    }
+    else if (node->type == JTOK_ARRAY)
+    {
+        if (seg->wildcard)
+        {
+            idx = (int)(node - tkns) + 1;
+        }
+        else if (elems != NULL && elems->arr == node)
+        {
+            idx = jtok_elemidx_at(elems, node, seg->index);
+        }
+        else
+        {
+            idx = jtok_array_at(node, seg->index);
+        }
+    }
+    return idx;
+}
+
+
+void jtok_path_init(jtok_path_t *path, jtok_path_seg_t *segs, size_t size)
+{
+    if (path != NULL)
+    {
+        path->segs  = segs;
+        path->size  = size;
+        path->count = 0;
+    }
+}
+
+
+JTOK_PARSE_STATUS_t jtok_path_compile(jtok_path_t *path, const char *str,
+                                      size_t len)
+{
+    JTOK_PARSE_STATUS_t status = JTOK_PARSE_STATUS_OK;
+    if (path == NULL || str == NULL || (path->segs == NULL && path->size > 0))
+    {
+        status = JTOK_PARSE_STATUS_NULL_PARAM;
+    }
+    else if (len > 0 && str[0] != '/')
+    {
+        path->count = 0;
+        status      = JTOK_PARSE_STATUS_INVAL;
+    }
+    else
+    {
+        size_t pos = 0;
+        path->count = 0;
+        while (pos < len && status == JTOK_PARSE_STATUS_OK)
+        {
+            /* pos is at the '/' that starts a reference token */
+            const char *key     = &str[++pos];
+            bool        escaped = false;
+            while (pos < len && str[pos] != '/')
+            {
+                if (str[pos] == '~')
+                {
+                    if (pos + 1 == len || (str[pos + 1] != '0' &&
+                                           str[pos + 1] != '1'))
+                    {
+                        status = JTOK_PARSE_STATUS_INVAL;
+                        break;
+                    }
+                    escaped = true;
+                    pos++;
+                }
+                pos++;
+            }
+
+            if (status != JTOK_PARSE_STATUS_OK)
+            {
+                path->count = 0;
+            }
+            else if (path->count == path->size)
+            {
+                path->count = 0;
+                status      = JTOK_PARSE_STATUS_NOMEM;
+            }
+            else
+            {
+                jtok_path_seg_t *seg = &path->segs[path->count++];
+                seg->key             = key;
+                seg->len             = (size_t)(&str[pos] - key);
+                seg->escaped         = escaped;
+                seg->wildcard        = seg->len == 1 && key[0] == '*';
+                seg->hash  = escaped ? 0 : jtok_hash_key(key, seg->len);
+                seg->index = jtok_path_index(key, seg->len);
+            }
+        }
+    }
+    return status;
+}
+
+
+size_t jtok_path_find(const jtok_path_t *path, const jtok_tkn_t *root,
+                      jtok_keymap_t *keys, jtok_elemidx_t *elems,
+                      int *matches, size_t size)
+{
+    size_t found = 0;
+    if (path != NULL && root != NULL && root->pool != NULL && matches != NULL &&
+        (path->segs != NULL || path->count == 0))
+    {
+        const jtok_tkn_t *tkns  = root->pool;
+        int               node  = (int)(root - tkns);
+        size_t            depth = 0;
+
+        /* Walk down the path, and on a dead end or a match back up to the
+         * deepest wildcard that has another member or element to try. Every
+         * level is one or two parent links up from the level below it, so
+         * the walk needs no stack. */
+        while (found < size)
+        {
+            int child = INVALID_ARRAY_INDEX;
+            if (depth == path->count)
+            {
+                matches[found++] = node;
+            }
+            else
+            {
+                child = jtok_path_step(&path->segs[depth], &tkns[node], keys,
+                                       elems);
+            }
+
+            if (child != INVALID_ARRAY_INDEX)
+            {
+                node = child;
+                depth++;
+            }
+            else
+            {
+                bool resumed = false;
+                while (depth > 0 && !resumed)
+                {
+                    /* A member value hangs off its key, an element off the
+                     * array */
+                    int  cursor = node;
+                    bool member = tkns[tkns[node].parent].type != JTOK_ARRAY;
+                    if (member)
+                    {
+                        cursor = tkns[node].parent;
+                    }
+                    int container = tkns[cursor].parent;
+
+                    if (path->segs[depth - 1].wildcard &&
+                        tkns[cursor].sibling != NO_SIBLING_IDX)
+                    {
+                        node    = tkns[cursor].sibling + (member ? 1 : 0);
+                        resumed = true;
+                    }
+                    else
+                    {
+                        node = container;
+                        depth--;
+                    }
+                }
+                if (!resumed)
+                {
+                    break;
+                }
+            }
+        }
+    }
+    return found;
+}
+
+
+int jtok_path_get(const jtok_path_t *path, const jtok_tkn_t *root)
+{
+    int match = INVALID_ARRAY_INDEX;
+    jtok_path_find(path, root, NULL, NULL, &match, 1);
+    return match;
+}
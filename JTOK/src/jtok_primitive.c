@@ -11,17 +11,198 @@
 
 #include <ctype.h>
 #include <string.h>
-#include <stdlib.h>
-#include <float.h>
+#include <stdint.h>
 
 
 #include "inc/jtok_primitive.h"
 #include "inc/jtok_shared.h"
+#include "inc/jtok_double.h"
+
+
+/**
+ * @brief Check if the json at str starts with a literal such as "true"
+ *
+ * @param str start of the candidate literal
+ * @param avail number of json bytes available at str
+ * @param literal the nul-terminated literal to match
+ * @return true if the whole literal is present at str
+ * @return false otherwise
+ */
+static bool jtok_match_literal(const char *str, int avail, const char *literal)
+{
+    size_t litlen = strlen(literal);
+    return (size_t)avail >= litlen && memcmp(str, literal, litlen) == 0;
+}
+
+
+/**
+ * @brief Check if the json at str is cut off partway through a literal
+ *
+ * @param str start of the candidate literal
+ * @param avail number of json bytes available at str
+ * @param literal the nul-terminated literal to match
+ * @return true if all avail bytes match the start of the literal
+ * @return false otherwise
+ */
+static bool jtok_match_literal_prefix(const char *str, int avail,
+                                      const char *literal)
+{
+    return (size_t)avail < strlen(literal) &&
+           memcmp(str, literal, avail) == 0;
+}
+
+
+/**
+ * @brief Append a decimal digit to an integer mantissa
+ *
+ * @param mantissa the mantissa
+ * @param c the digit character
+ * @return true if the digit fit
+ * @return false if the mantissa would overflow a uint64_t (it is left alone)
+ */
+static inline bool jtok_push_digit(uint64_t *mantissa, char c)
+{
+    uint64_t digit = (uint64_t)(c - '0');
+    if (*mantissa > (UINT64_MAX - digit) / 10)
+    {
+        return false;
+    }
+    *mantissa = *mantissa * 10 + digit;
+    return true;
+}
+
+
+/**
+ * @brief Decode a number whose digits have already been accumulated
+ *
+ * @param str start of the number
+ * @param len number of bytes in the number
+ * @param real true if the number has a fraction or exponent, or its digits
+ * did not fit in the mantissa
+ * @param mantissa the digits of the number, without the sign
+ * @param value receives the value. If NULL, only the subtype is worked out.
+ * @return JTOK_VALUE_TYPE_t JTOK_VALUE_TYPE_uint, JTOK_VALUE_TYPE_int or
+ * JTOK_VALUE_TYPE_real. An integer too big for its type is a real. A
+ * malformed number is JTOK_VALUE_TYPE_not_a_value_tkn (value is left alone).
+ */
+static JTOK_VALUE_TYPE_t jtok_number_value(const char *str, int len,
+                                           bool real, uint64_t mantissa,
+                                           jtok_value_t *value)
+{
+    JTOK_VALUE_TYPE_t value_type = JTOK_VALUE_TYPE_real;
+    jtok_value_t      decoded;
+    if (!real)
+    {
+        if (str[0] != '-')
+        {
+            decoded.u  = mantissa;
+            value_type = JTOK_VALUE_TYPE_uint;
+        }
+        else if (mantissa <= (uint64_t)INT64_MAX + 1)
+        {
+            decoded.i =
+                mantissa > INT64_MAX ? INT64_MIN : -(int64_t)mantissa;
+            value_type = JTOK_VALUE_TYPE_int;
+        }
+    }
+
+    if (value != NULL)
+    {
+        if (value_type == JTOK_VALUE_TYPE_real &&
+            !jtok_atod(str, len, &decoded.d))
+        {
+            /* The scanner only lets through numbers jtok_atod accepts, so
+             * this is a token that wasn't scanned as a number */
+            value_type = JTOK_VALUE_TYPE_not_a_value_tkn;
+        }
+        else
+        {
+            *value = decoded;
+        }
+    }
+    return value_type;
+}
+
+
+/**
+ * @brief Decode a true, false or null literal
+ *
+ * @param c first character of the literal
+ * @param value receives the value
+ * @return JTOK_VALUE_TYPE_t JTOK_VALUE_TYPE_boolean or JTOK_VALUE_TYPE_null
+ */
+static JTOK_VALUE_TYPE_t jtok_literal_value(char c, jtok_value_t *value)
+{
+    JTOK_VALUE_TYPE_t value_type;
+    if (c == 'n')
+    {
+        value->u   = 0;
+        value_type = JTOK_VALUE_TYPE_null;
+    }
+    else
+    {
+        value->b   = (c == 't');
+        value_type = JTOK_VALUE_TYPE_boolean;
+    }
+    return value_type;
+}
+
+
+JTOK_VALUE_TYPE_t jtok_primitive_value(const char *js, int start, int end,
+                                       jtok_value_t *value)
+{
+    JTOK_VALUE_TYPE_t value_type;
+    switch (js[start])
+    {
+        case 't':
+        case 'f':
+        case 'n':
+        {
+            value_type = jtok_literal_value(js[start], value);
+        }
+        break;
+        default:
+        {
+            uint64_t mantissa = 0;
+            bool     real     = false;
+            int      pos;
+            for (pos = start; pos < end; pos++)
+            {
+                if (isdigit((int)js[pos]))
+                {
+                    if (!real && !jtok_push_digit(&mantissa, js[pos]))
+                    {
+                        real = true;
+                    }
+                }
+                else if (js[pos] != '-' && js[pos] != '+')
+                {
+                    /* decimal point or exponent */
+                    real = true;
+                }
+            }
+            value_type = jtok_number_value(&js[start], end - start, real,
+                                           mantissa, value);
+        }
+        break;
+    }
+    return value_type;
+}
+
+
+/* Scanner state saved with a primitive that is cut off by the end of the json.
+ * The low bits hold the primitive type.
+ */
+#define PRIMITIVE_TYPE_MASK 0x3
+#define PRIMITIVE_EXPONENT (1 << 2)
+#define PRIMITIVE_EXPONENT_POWER (1 << 3)
+#define PRIMITIVE_DECIMAL (1 << 4)
+#define PRIMITIVE_DECIMAL_PLACES (1 << 5)
+#define PRIMITIVE_OVERFLOW (1 << 6) /* digits no longer fit a uint64_t */
 
 
 JTOK_PARSE_STATUS_t jtok_parse_primitive(jtok_parser_t *parser)
 {
-    jtok_tkn_t *token;
     int         start = parser->pos;
     const char *js    = (const char *)parser->json;
     int         len   = parser->json_len;
@@ -33,13 +214,29 @@ JTOK_PARSE_STATUS_t jtok_parse_primitive(jtok_parser_t *parser)
         ERROR
     } primitive_type = ERROR;
 
-    bool exponent             = false;
-    bool found_exponent_power = false;
-    bool decimal              = false;
-    bool found_decimal_places = false;
+    bool     exponent             = false;
+    bool     found_exponent_power = false;
+    bool     decimal              = false;
+    bool     found_decimal_places = false;
+    uint64_t mantissa             = 0; /* integer digits seen so far */
+    bool     overflow             = false;
 
-    for (start = parser->pos; parser->pos < len && js[parser->pos] != '\0';
-         parser->pos++)
+    int flags  = 0;
+    int resume = jtok_resume_token(parser, &flags);
+    if (resume != INVALID_ARRAY_INDEX)
+    {
+        /* Pick up where the json ran out on the previous call */
+        primitive_type       = flags & PRIMITIVE_TYPE_MASK;
+        exponent             = flags & PRIMITIVE_EXPONENT;
+        found_exponent_power = flags & PRIMITIVE_EXPONENT_POWER;
+        decimal              = flags & PRIMITIVE_DECIMAL;
+        found_decimal_places = flags & PRIMITIVE_DECIMAL_PLACES;
+        overflow             = flags & PRIMITIVE_OVERFLOW;
+        mantissa             = parser->tok_digits;
+        parser->pos          = resume;
+    }
+
+    for (; parser->pos < len; parser->pos++)
     {
         switch (js[parser->pos])
         {
@@ -54,6 +251,11 @@ JTOK_PARSE_STATUS_t jtok_parse_primitive(jtok_parser_t *parser)
             case '8':
             case '9':
             {
+                if (!decimal && !exponent && !overflow)
+                {
+                    overflow = !jtok_push_digit(&mantissa, js[parser->pos]);
+                }
+
                 if (parser->pos == start)
                 {
                     primitive_type = NUMBER;
@@ -89,9 +291,10 @@ JTOK_PARSE_STATUS_t jtok_parse_primitive(jtok_parser_t *parser)
                 {
                     primitive_type = NUMBER;
                 }
-                else if (exponent)
+                else if (exponent && (js[parser->pos - 1] == 'e' ||
+                                      js[parser->pos - 1] == 'E'))
                 {
-                    /* do nothing */
+                    /* sign of the exponent, eg: 1e-9. 1E+-2 is invalid */
                 }
                 else
                 {
@@ -111,13 +314,12 @@ JTOK_PARSE_STATUS_t jtok_parse_primitive(jtok_parser_t *parser)
                 {
                     if (primitive_type == NUMBER)
                     {
-                        if (decimal)
+                        /* 123.0.1 and 3..5 are invalid primitives, and so
+                         * is -.5 because the point must follow a digit */
+                        if (decimal || !isdigit((int)js[parser->pos - 1]))
                         {
-                            /* 123.0.1 is invalid primitive */
-                            if (found_decimal_places)
-                            {
-                                return JTOK_PARSE_STATUS_INVALID_PRIMITIVE;
-                            }
+                            parser->pos = start;
+                            return JTOK_PARSE_STATUS_INVALID_PRIMITIVE;
                         }
                         else
                         {
@@ -151,8 +353,9 @@ JTOK_PARSE_STATUS_t jtok_parse_primitive(jtok_parser_t *parser)
                 {
                     if (primitive_type == NUMBER)
                     {
-                        /* previous char has to be a digit eg: 10e9 */
-                        if (isdigit((int)js[parser->pos - 1]))
+                        /* previous char has to be a digit eg: 10e9, and
+                         * there is only one exponent (1e5e5 is invalid) */
+                        if (!exponent && isdigit((int)js[parser->pos - 1]))
                         {
                             exponent             = true;
                             found_exponent_power = false;
@@ -195,15 +398,48 @@ JTOK_PARSE_STATUS_t jtok_parse_primitive(jtok_parser_t *parser)
                     return JTOK_PARSE_STATUS_INVALID_PRIMITIVE;
                 }
 
-                token = jtok_alloc_token(parser);
-                if (token == NULL) /* not enough tokens provided by caller */
+                /* A number ends in a digit, so a sign on its own ({"key" : -})
+                 * has no digits and no value */
+                if (primitive_type == NUMBER && !isdigit((int)last))
                 {
+                    parser->pos = start;
+                    return JTOK_PARSE_STATUS_INVALID_PRIMITIVE;
+                }
+
+                int idx =
+                    jtok_new_token(parser, JTOK_PRIMITIVE, start, parser->pos);
+                if (idx == INVALID_ARRAY_INDEX)
+                {
+                    /* not enough tokens provided by caller */
                     parser->pos = start;
                     return JTOK_PARSE_STATUS_NOMEM;
                 }
-                jtok_fill_token(token, JTOK_PRIMITIVE, start, parser->pos);
 
-                token->parent = parser->toksuper;
+                /* Everything needed to decode the value was worked out
+                 * while scanning, so only reals go back over the digits */
+                jtok_value_t *    value = NULL;
+                JTOK_VALUE_TYPE_t value_type;
+                if (parser->values != NULL)
+                {
+                    value = &parser->values[idx];
+                }
+
+                if (primitive_type == NUMBER)
+                {
+                    value_type = jtok_number_value(
+                        &js[start], parser->pos - start,
+                        decimal || exponent || overflow, mantissa, value);
+                }
+                else
+                {
+                    jtok_value_t literal;
+                    value_type = jtok_literal_value(js[start], &literal);
+                    if (value != NULL)
+                    {
+                        *value = literal;
+                    }
+                }
+                jtok_token_set_value_type(parser, idx, value_type);
 
                 /* Go back 1 spot so when we return from current function, the
                  * calling context can look at the current character
@@ -220,35 +456,50 @@ JTOK_PARSE_STATUS_t jtok_parse_primitive(jtok_parser_t *parser)
             {
                 if (parser->pos == start)
                 {
-                    if (0 == strncmp(&js[start], "true", strlen("true")))
+                    if (jtok_match_literal(&js[start], len - start, "true"))
                     {
                         /* subtract 1 so we don't end up at character
                                   AFTER the final char in token */
                         parser->pos += strlen("true") - 1;
                         break;
                     }
-                    else if (0 == strncmp(&js[start], "false", strlen("false")))
+                    else if (jtok_match_literal(&js[start], len - start,
+                                                "false"))
                     {
                         /* subtract 1 so we don't end up at character
                                   AFTER the final char in token */
                         parser->pos += strlen("false") - 1;
                         break;
                     }
-                    else if (0 == strncmp(&js[start], "null", strlen("null")))
+                    else if (jtok_match_literal(&js[start], len - start,
+                                                "null"))
                     {
                         /* subtract 1 so we don't end up at character
                                   AFTER the final char in token */
                         parser->pos += strlen("null") - 1;
                         break;
                     }
+                    else if (jtok_match_literal_prefix(&js[start],
+                                                       len - start, "true") ||
+                             jtok_match_literal_prefix(&js[start],
+                                                       len - start, "false") ||
+                             jtok_match_literal_prefix(&js[start],
+                                                       len - start, "null"))
+                    {
+                        /* json ends partway through the literal */
+                        parser->pos = start;
+                        return JTOK_PARSE_STATUS_PARTIAL_TOKEN;
+                    }
                     else
                     {
                         parser->pos = start;
                         return JTOK_PARSE_STATUS_INVALID_PRIMITIVE;
                     }
                 }
+
+                /* eg: {"key" : truex} */
                 parser->pos = start;
-                return JTOK_PARSE_STATUS_PARTIAL_TOKEN;
+                return JTOK_PARSE_STATUS_INVALID_PRIMITIVE;
             }
             break;
         }
@@ -256,76 +507,176 @@ JTOK_PARSE_STATUS_t jtok_parse_primitive(jtok_parser_t *parser)
 
     /* We didn't reach a terminating character
      * so the json we recieved was incomplete */
+    flags = primitive_type;
+    flags |= exponent ? PRIMITIVE_EXPONENT : 0;
+    flags |= found_exponent_power ? PRIMITIVE_EXPONENT_POWER : 0;
+    flags |= decimal ? PRIMITIVE_DECIMAL : 0;
+    flags |= found_decimal_places ? PRIMITIVE_DECIMAL_PLACES : 0;
+    flags |= overflow ? PRIMITIVE_OVERFLOW : 0;
+    jtok_suspend_token(parser, start, parser->pos, flags);
+    parser->tok_digits = mantissa;
     return JTOK_PARSE_STATUS_PARTIAL_TOKEN;
 }
 
 
-bool jtok_toktokcmp_primitive(const jtok_tkn_t *tkn1, const jtok_tkn_t *tkn2)
+/**
+ * @brief Convert a decoded number to a double
+ */
+static double jtok_value_to_double(JTOK_VALUE_TYPE_t   value_type,
+                                   const jtok_value_t *value)
 {
-    /** @todo really not proud of this function. SUPER inefficient
-     *  But it works for now. Really we should be storing some sort of
-     * "value subtype" as part of the parsing process and checking that here
-     *
-     * Currently we're pretty much re-parsing each token to determine a subtype
-     */
-
-    bool           is_equal = false;
-    uint_least16_t len1     = jtok_toklen(tkn1);
-    uint_least16_t len2     = jtok_toklen(tkn2);
-    uint_least16_t min_len  = len1;
-    if (min_len > len2)
+    double d;
+    switch (value_type)
     {
-        min_len = len2;
+        case JTOK_VALUE_TYPE_uint:
+        {
+            d = (double)value->u;
+        }
+        break;
+        case JTOK_VALUE_TYPE_int:
+        {
+            d = (double)value->i;
+        }
+        break;
+        default:
+        {
+            d = value->d;
+        }
+        break;
     }
+    return d;
+}
 
 
-    const char *start1 = &tkn1->json[tkn1->start];
-    const char *start2 = &tkn2->json[tkn2->start];
+bool jtok_toktokcmp_primitive(const jtok_tkn_t *tkn1, const jtok_tkn_t *tkn2)
+{
+    bool              is_equal = false;
+    jtok_value_t      val1;
+    jtok_value_t      val2;
+    JTOK_VALUE_TYPE_t type1 =
+        jtok_primitive_value(tkn1->json, tkn1->start, tkn1->end, &val1);
+    JTOK_VALUE_TYPE_t type2 =
+        jtok_primitive_value(tkn2->json, tkn2->start, tkn2->end, &val2);
 
-    if (0 == strncmp("true", start1, min_len) &&
-        0 == strncmp("true", start2, min_len))
-    {
-        is_equal = true;
-    }
-    else if (0 == strncmp("false", start1, min_len) &&
-             0 == strncmp("false", start2, min_len))
+    if (type1 == type2)
     {
-        is_equal = true;
+        switch (type1)
+        {
+            case JTOK_VALUE_TYPE_boolean:
+            {
+                is_equal = (val1.b == val2.b);
+            }
+            break;
+            case JTOK_VALUE_TYPE_null:
+            {
+                is_equal = true;
+            }
+            break;
+            case JTOK_VALUE_TYPE_uint:
+            {
+                is_equal = (val1.u == val2.u);
+            }
+            break;
+            case JTOK_VALUE_TYPE_int:
+            {
+                is_equal = (val1.i == val2.i);
+            }
+            break;
+            default:
+            {
+                is_equal = (val1.d == val2.d);
+            }
+            break;
+        }
     }
-    else if (0 == strncmp("null", start1, min_len) &&
-             0 == strncmp("null", start2, min_len))
+    else if (type1 != JTOK_VALUE_TYPE_boolean &&
+             type1 != JTOK_VALUE_TYPE_null &&
+             type2 != JTOK_VALUE_TYPE_boolean && type2 != JTOK_VALUE_TYPE_null)
     {
-        is_equal = true;
+        /* Different kinds of number, eg: 1 and 1.0 or 0 and -0 */
+        is_equal = (jtok_value_to_double(type1, &val1) ==
+                    jtok_value_to_double(type2, &val2));
     }
-    else
+
+    return is_equal;
+}
+
+
+bool jtok_tok_to_int64(const jtok_tkn_t *tkn, int64_t *value)
+{
+    bool success = false;
+    if (tkn->type == JTOK_PRIMITIVE)
     {
-        /* Token isn't 'true', 'false', or 'null', need to parse it as a number
-         *
-         * Again, since we don't store the subtypes, we have to assume
-         * its a real number and do all the operations with ungodly
-         * floating precision arithmetic
-         */
-        const char *end1 = &tkn1->json[tkn1->end];
-        const char *end2 = &tkn2->json[tkn2->end];
-
-        float val1;
-        float val2;
-        char *endptr1 = (char *)start1;
-        char *endptr2 = (char *)start2;
-
-        val1 = strtof(start1, &endptr1);
-        val2 = strtof(start2, &endptr2);
-        if (endptr2 == end2) /* if first tkn was parsed correctly */
+        jtok_value_t val;
+        switch (jtok_primitive_value(tkn->json, tkn->start, tkn->end, &val))
         {
-            if (endptr1 == end1) /* if second tkn was parsed correctly */
+            case JTOK_VALUE_TYPE_uint:
             {
-                if ((val1 - val2) < FLT_EPSILON)
+                if (val.u <= INT64_MAX)
                 {
-                    is_equal = true;
+                    *value  = (int64_t)val.u;
+                    success = true;
                 }
             }
+            break;
+            case JTOK_VALUE_TYPE_int:
+            {
+                *value  = val.i;
+                success = true;
+            }
+            break;
+            default:
+            {
+            }
+            break;
         }
     }
+    return success;
+}
 
-    return is_equal;
+
+bool jtok_tok_to_uint64(const jtok_tkn_t *tkn, uint64_t *value)
+{
+    bool success = false;
+    if (tkn->type == JTOK_PRIMITIVE)
+    {
+        jtok_value_t val;
+        if (jtok_primitive_value(tkn->json, tkn->start, tkn->end, &val) ==
+            JTOK_VALUE_TYPE_uint)
+        {
+            *value  = val.u;
+            success = true;
+        }
+    }
+    return success;
+}
+
+
+bool jtok_tok_to_double(const jtok_tkn_t *tkn, double *value)
+{
+    return tkn->type == JTOK_PRIMITIVE &&
+           jtok_atod(&tkn->json[tkn->start], tkn->end - tkn->start, value);
+}
+
+
+JTOK_VALUE_TYPE_t jtok_tok_value(const jtok_tkn_t *tkn,
+                                 const jtok_value_t *values,
+                                 jtok_value_t *value)
+{
+    JTOK_VALUE_TYPE_t value_type = JTOK_VALUE_TYPE_not_a_value_tkn;
+    if (tkn != NULL && value != NULL && tkn->type == JTOK_PRIMITIVE)
+    {
+        if (values != NULL && tkn->pool != NULL)
+        {
+            /* Decoded by the parser */
+            *value     = values[tkn - tkn->pool];
+            value_type = tkn->value_type;
+        }
+        else
+        {
+            value_type =
+                jtok_primitive_value(tkn->json, tkn->start, tkn->end, value);
+        }
+    }
+    return value_type;
 }
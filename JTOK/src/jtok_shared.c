@@ -22,10 +22,13 @@ int jtok_fill_token(jtok_tkn_t *token, JTOK_TYPE_t type, int start, int end)
 {
     if (token != NULL)
     {
-        token->type  = type;
-        token->start = start;
-        token->end   = end;
-        token->size  = 0;
+        token->type       = type;
+        token->start      = start;
+        token->end        = end;
+        token->size       = 0;
+        token->value_type = JTOK_VALUE_TYPE_not_a_value_tkn;
+        token->flags      = 0;
+        token->hash       = 0;
         return 0;
     }
     else
@@ -35,19 +38,143 @@ int jtok_fill_token(jtok_tkn_t *token, JTOK_TYPE_t type, int start, int end)
 }
 
 
-jtok_tkn_t *jtok_alloc_token(jtok_parser_t *parser)
+/**
+ * @brief Double the size of the token pool with the parser's allocator
+ *
+ * @param parser the json parser
+ * @return int 0 on success, 1 if there is no allocator or it failed
+ */
+static int jtok_grow_pool(jtok_parser_t *parser)
+{
+    if (parser->realloc_fn == NULL)
+    {
+        return 1;
+    }
+
+    size_t size = JTOK_POOL_GROW_MIN;
+    if (parser->pool_size >= JTOK_POOL_GROW_MIN)
+    {
+        size = (size_t)parser->pool_size * 2;
+    }
+    if (size > INT_MAX / sizeof(jtok_tkn_t))
+    {
+        return 1;
+    }
+
+    if (parser->values != NULL)
+    {
+        /* Grow the values first, a bigger value array on its own is fine */
+        jtok_value_t *values = parser->realloc_fn(
+            parser->alloc_ctx, parser->values, size * sizeof(*values));
+        if (values == NULL)
+        {
+            return 1;
+        }
+        parser->values = values;
+    }
+
+    jtok_tkn_t *pool = parser->realloc_fn(parser->alloc_ctx, parser->tkn_pool,
+                                          size * sizeof(*pool));
+    if (pool == NULL)
+    {
+        return 1;
+    }
+
+    if (pool != parser->tkn_pool)
+    {
+        /* Every token points back at its pool */
+        int i;
+        for (i = 0; i < parser->toknext; i++)
+        {
+            pool[i].pool = pool;
+        }
+    }
+    parser->tkn_pool  = pool;
+    parser->pool_size = size;
+    return 0;
+}
+
+
+/**
+ * @brief Pick the slot of a new token in the pool of a validating parser.
+ *
+ * The grammar only ever reads back the open objects and arrays, the current
+ * key of an object and the value after it, so each nesting level gets a slot
+ * for each and a slot is reused as soon as the next token of its kind comes
+ * along at that level.
+ *
+ * @param parser the validating parser
+ * @param type type of the new token
+ * @return int slot of the new token
+ */
+static int jtok_path_slot(const jtok_parser_t *parser, JTOK_TYPE_t type)
+{
+    int slot = parser->depth * JTOK_PATH_SLOTS_PER_LEVEL;
+    if (type == JTOK_OBJECT || type == JTOK_ARRAY)
+    {
+        /* The frame it is about to get */
+        return slot;
+    }
+    else if (parser->tkn_pool[parser->toksuper].type == JTOK_OBJECT)
+    {
+        /* A key of the innermost open object */
+        return slot - JTOK_PATH_SLOTS_PER_LEVEL + 1;
+    }
+    else
+    {
+        /* A value of the innermost open object or array */
+        return slot - JTOK_PATH_SLOTS_PER_LEVEL + 2;
+    }
+}
+
+
+int jtok_new_token(jtok_parser_t *parser, JTOK_TYPE_t type, int start, int end)
 {
-    jtok_tkn_t *tok;
-    if (parser->toknext >= (int)parser->pool_size)
-    {
-        return NULL;
-    }
-    tok        = &parser->tkn_pool[parser->toknext++];
-    tok->pool  = parser->tkn_pool;
-    tok->start = tok->end = INVALID_ARRAY_INDEX;
-    tok->size             = 0;
-    tok->parent           = NO_PARENT_IDX;
-    tok->json             = parser->json;
-    tok->sibling          = NO_SIBLING_IDX;
-    return tok;
+    int idx = parser->toknext;
+    if (parser->tape != NULL)
+    {
+        jtok_tape_t *tape = parser->tape;
+        if ((size_t)idx >= tape->size)
+        {
+            return INVALID_ARRAY_INDEX;
+        }
+
+        uint32_t len = 0;
+        if (end != INVALID_ARRAY_INDEX)
+        {
+            if ((uint32_t)(end - start) > JTOK_TAPE_VALUE_MASK)
+            {
+                /* Token too long to describe on a tape */
+                return INVALID_ARRAY_INDEX;
+            }
+            len = end - start;
+        }
+
+        jtok_tape_tkn_t *tkn = &tape->tkns[idx];
+        tkn->start           = start;
+        tkn->info            = ((uint32_t)type << JTOK_TAPE_TYPE_SHIFT) | len;
+        tkn->parent          = (uint32_t)parser->toksuper;
+        tkn->next            = idx + 1;
+        tape->count          = idx + 1;
+    }
+    else
+    {
+        if (parser->validating)
+        {
+            idx = jtok_path_slot(parser, type);
+        }
+        else if (idx >= (int)parser->pool_size && jtok_grow_pool(parser) != 0)
+        {
+            return INVALID_ARRAY_INDEX;
+        }
+        jtok_tkn_t *tok = &parser->tkn_pool[idx];
+        tok->pool       = parser->tkn_pool;
+        tok->json       = parser->json;
+        tok->sibling    = NO_SIBLING_IDX;
+        tok->parent     = parser->toksuper;
+        tok->next       = idx + 1;
+        jtok_fill_token(tok, type, start, end);
+    }
+    parser->toknext = idx + 1;
+    return idx;
 }
@@ -11,49 +11,716 @@
  */
 
 #include <ctype.h>
+#include <stdbool.h>
 #include <string.h>
 
 #include "inc/jtok_string.h"
 #include "inc/jtok_shared.h"
 
 
+/* Scanner state saved with a string that is cut off by the end of the json */
+#define STRING_ESCAPED (1 << 0)   /* a backslash was found */
+#define STRING_NON_ASCII (1 << 1) /* a byte >= 0x80 was found */
+
+
+#if defined(JTOK_SIMD_AVX2) || defined(JTOK_SIMD_AVX2_DISPATCH)
+/* Error bits of the UTF-8 lookup tables. Each is set by all three lookups
+ * only when the byte pair it names really occurs */
+#define UTF8_TOO_SHORT (1 << 0)  /* lead byte followed by a non-continuation */
+#define UTF8_TOO_LONG (1 << 1)   /* continuation after an ascii byte */
+#define UTF8_OVERLONG_3 (1 << 2) /* E0 80..9F */
+#define UTF8_TOO_LARGE (1 << 3)  /* F4 90..BF, F5..FF */
+#define UTF8_SURROGATE (1 << 4)  /* ED A0..BF */
+#define UTF8_OVERLONG_2 (1 << 5) /* C0, C1 */
+#define UTF8_TOO_LARGE_1000 (1 << 6)
+#define UTF8_OVERLONG_4 (1 << 6) /* F0 80..8F */
+#define UTF8_TWO_CONTS (1 << 7)  /* continuation after a continuation */
+#define UTF8_CARRY (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+
+/**
+ * @brief Look up a 16 entry table (repeated in both lanes) with the low
+ * nibble of every byte of idx
+ */
+JTOK_AVX2_FN static inline __m256i jtok_utf8_lookup(__m256i idx,
+                                                    __m256i table)
+{
+    return _mm256_shuffle_epi8(table, idx);
+}
+
+
+/**
+ * @brief Shift the 32 bytes of v right by n bytes, filling in from the end
+ * of prev, i.e. the byte n positions before each byte of v
+ */
+#define jtok_utf8_prev(v, prev, n)                                            \
+    _mm256_alignr_epi8((v), _mm256_permute2x128_si256((prev), (v), 0x21),    \
+                       16 - (n))
+
+
+/**
+ * @brief Check 32 bytes of string for UTF-8 errors, using the three table
+ * lookups of Keiser and Lemire, "Validating UTF-8 In Less Than One
+ * Instruction Per Byte".
+ *
+ * @param v the 32 bytes
+ * @param prev the 32 bytes before them, zero if there are none
+ * @return true if no byte of v breaks a sequence. A sequence cut off by the
+ * end of v is not an error here (see jtok_utf8_incomplete).
+ */
+JTOK_AVX2_FN static inline bool jtok_utf8_block(__m256i v, __m256i prev)
+{
+    /* clang-format off */
+    const __m256i byte_1_high = _mm256_setr_epi8(
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+        UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+        UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 |
+            UTF8_OVERLONG_4,
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+        UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+        UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 |
+            UTF8_OVERLONG_4);
+    const __m256i byte_1_low = _mm256_setr_epi8(
+        UTF8_CARRY | UTF8_OVERLONG_2 | UTF8_OVERLONG_3 | UTF8_OVERLONG_4,
+        UTF8_CARRY | UTF8_OVERLONG_2,
+        UTF8_CARRY, UTF8_CARRY,
+        UTF8_CARRY | UTF8_TOO_LARGE,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_OVERLONG_2 | UTF8_OVERLONG_3 | UTF8_OVERLONG_4,
+        UTF8_CARRY | UTF8_OVERLONG_2,
+        UTF8_CARRY, UTF8_CARRY,
+        UTF8_CARRY | UTF8_TOO_LARGE,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000);
+    const __m256i byte_2_high = _mm256_setr_epi8(
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |
+            UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |
+            UTF8_TOO_LARGE,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE |
+            UTF8_TOO_LARGE,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE |
+            UTF8_TOO_LARGE,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |
+            UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |
+            UTF8_TOO_LARGE,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE |
+            UTF8_TOO_LARGE,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE |
+            UTF8_TOO_LARGE,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT);
+    /* clang-format on */
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+
+    __m256i prev1 = jtok_utf8_prev(v, prev, 1);
+    __m256i special_cases = _mm256_and_si256(
+        _mm256_and_si256(
+            jtok_utf8_lookup(
+                _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble),
+                byte_1_high),
+            jtok_utf8_lookup(_mm256_and_si256(prev1, nibble), byte_1_low)),
+        jtok_utf8_lookup(_mm256_and_si256(_mm256_srli_epi16(v, 4), nibble),
+                         byte_2_high));
+
+    /* Two continuations in a row are only right as the 3rd or 4th byte of
+     * a sequence */
+    __m256i prev2  = jtok_utf8_prev(v, prev, 2);
+    __m256i prev3  = jtok_utf8_prev(v, prev, 3);
+    __m256i third  = _mm256_subs_epu8(prev2, _mm256_set1_epi8(0xE0 - 0x80));
+    __m256i fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8(0xF0 - 0x80));
+    __m256i must23 = _mm256_and_si256(_mm256_or_si256(third, fourth),
+                                      _mm256_set1_epi8((char)0x80));
+    __m256i error  = _mm256_xor_si256(must23, special_cases);
+    return _mm256_testz_si256(error, error);
+}
+
+
+/**
+ * @brief Check if the last 3 bytes of v start a sequence that goes on past v
+ */
+JTOK_AVX2_FN static inline bool jtok_utf8_incomplete(__m256i v)
+{
+    const __m256i max = _mm256_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, (char)(0xF0 - 1),
+        (char)(0xE0 - 1), (char)(0xC0 - 1));
+    __m256i over = _mm256_subs_epu8(v, max);
+    return !_mm256_testz_si256(over, over);
+}
+#endif
+
+
+#if defined(JTOK_SIMD_AVX2) || defined(JTOK_SIMD_AVX2_DISPATCH)
+/**
+ * @brief jtok_string_skip with AVX2. Blocks holding non-ascii bytes are
+ * checked to be UTF-8 in the same pass and skipped too.
+ */
+JTOK_AVX2_FN static int jtok_string_skip_avx2(const char *js, int pos,
+                                              int len, int *flags)
+{
+    const __m256i quote      = _mm256_set1_epi8('\"');
+    const __m256i backslash  = _mm256_set1_epi8('\\');
+    const __m256i ctrl_max   = _mm256_set1_epi8(0x1F);
+    const __m256i iota       = _mm256_setr_epi8(
+        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19,
+        20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31);
+    __m256i       prev       = _mm256_setzero_si256();
+    bool          incomplete = false;
+    while (pos + 32 <= len)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)&js[pos]);
+
+        /* v <= 0x1F (unsigned) iff max(v, 0x1F) == 0x1F */
+        __m256i ctrl =
+            _mm256_cmpeq_epi8(_mm256_max_epu8(v, ctrl_max), ctrl_max);
+        __m256i special = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, quote),
+                            _mm256_cmpeq_epi8(v, backslash)),
+            ctrl);
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(special);
+        uint32_t high = (uint32_t)_mm256_movemask_epi8(v);
+        if ((mask | high) == 0 && !incomplete)
+        {
+            /* All ascii */
+            prev = v;
+            pos += 32;
+            continue;
+        }
+
+        if (mask != 0)
+        {
+            /* Only check up to the special character. A sequence it cuts
+             * off is an error, as the zeros put in its place are ascii. */
+            __m256i before = _mm256_cmpgt_epi8(
+                _mm256_set1_epi8((char)jtok_ctz64(mask)), iota);
+            v = _mm256_and_si256(v, before);
+        }
+
+        if (!jtok_utf8_block(v, prev))
+        {
+            /* Let jtok_utf8_sequence find the bad sequence */
+            if (incomplete)
+            {
+                break;
+            }
+            return pos + jtok_ctz64(high);
+        }
+        else if (mask != 0)
+        {
+            uint32_t first = jtok_ctz64(mask);
+            if (high & ((1u << first) - 1))
+            {
+                *flags |= STRING_NON_ASCII;
+            }
+            return pos + first;
+        }
+        *flags |= (high != 0) ? STRING_NON_ASCII : 0;
+        incomplete = jtok_utf8_incomplete(v);
+        prev       = v;
+        pos += 32;
+    }
+
+    if (incomplete)
+    {
+        /* Back up to the lead byte of the sequence the last block cut off */
+        while (((unsigned char)js[pos - 1] & 0xC0) == 0x80)
+        {
+            pos--;
+        }
+        pos--;
+    }
+    return pos;
+}
+#endif
+
+
+#if defined(JTOK_SIMD_SSE2)
+/**
+ * @brief jtok_string_skip with SSE2. Non-ascii bytes are left to
+ * jtok_utf8_sequence.
+ */
+static inline int jtok_string_skip_sse2(const char *js, int pos, int len)
+{
+    const __m128i quote     = _mm_set1_epi8('\"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i ctrl_max  = _mm_set1_epi8(0x1F);
+    while (pos + 16 <= len)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)&js[pos]);
+
+        /* v <= 0x1F (unsigned) iff max(v, 0x1F) == 0x1F */
+        __m128i ctrl    = _mm_cmpeq_epi8(_mm_max_epu8(v, ctrl_max), ctrl_max);
+        __m128i special = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                         _mm_cmpeq_epi8(v, backslash)),
+            ctrl);
+
+        /* Non-ascii bytes are left to jtok_utf8_sequence */
+        uint32_t mask = (uint32_t)(_mm_movemask_epi8(special) |
+                                   _mm_movemask_epi8(v));
+        if (mask != 0)
+        {
+            return pos + jtok_ctz64(mask);
+        }
+        pos += 16;
+    }
+    return pos;
+}
+#endif
+
+
+/**
+ * @brief Skip over string bytes that need no further checks.
+ *
+ * Blocks of ascii are skipped with one compare. With AVX2, blocks holding
+ * other bytes are checked to be UTF-8 in the same pass and skipped too. A
+ * build without -mavx2 checks the CPU for AVX2 at run time where it can.
+ *
+ * @param js the json string
+ * @param pos current position inside the string, at the start of a character
+ * @param len length of the json string
+ * @param flags STRING_NON_ASCII is added if non-ascii bytes are skipped
+ * @return int position of the first quote, backslash, control character or
+ * unchecked non-ascii byte at or after pos, or a position within one vector
+ * of len. It is always at the start of a character. The scalar loop in
+ * jtok_parse_string takes over from there.
+ */
+static inline int jtok_string_skip(const char *js, int pos, int len,
+                                   int *flags)
+{
+#if defined(JTOK_SIMD_AVX2)
+    return jtok_string_skip_avx2(js, pos, len, flags);
+#elif defined(JTOK_SIMD_AVX2_DISPATCH)
+    if (jtok_cpu_has_avx2())
+    {
+        return jtok_string_skip_avx2(js, pos, len, flags);
+    }
+    return jtok_string_skip_sse2(js, pos, len);
+#elif defined(JTOK_SIMD_SSE2)
+    (void)flags;
+    return jtok_string_skip_sse2(js, pos, len);
+#else
+    (void)js;
+    (void)len;
+    (void)flags;
+    return pos;
+#endif
+}
+
+
+/**
+ * @brief Check the UTF-8 sequence that starts with the non-ascii byte at pos
+ *
+ * @param js the json string
+ * @param pos position of the lead byte
+ * @param len length of the json string
+ * @return int length of the sequence, 0 if it is not valid UTF-8 (RFC 3629:
+ * no overlong forms, surrogates or code points past U+10FFFF), or
+ * INVALID_ARRAY_INDEX if the json ends before the sequence does
+ */
+static int jtok_utf8_sequence(const char *js, int pos, int len)
+{
+    const unsigned char *seq = (const unsigned char *)&js[pos];
+    unsigned char        lo  = 0x80; /* range of the 2nd byte */
+    unsigned char        hi  = 0xBF;
+    int                  n;
+    if (seq[0] >= 0xC2 && seq[0] <= 0xDF)
+    {
+        n = 2;
+    }
+    else if (seq[0] >= 0xE0 && seq[0] <= 0xEF)
+    {
+        n  = 3;
+        lo = (seq[0] == 0xE0) ? 0xA0 : lo; /* overlong */
+        hi = (seq[0] == 0xED) ? 0x9F : hi; /* surrogate */
+    }
+    else if (seq[0] >= 0xF0 && seq[0] <= 0xF4)
+    {
+        n  = 4;
+        lo = (seq[0] == 0xF0) ? 0x90 : lo; /* overlong */
+        hi = (seq[0] == 0xF4) ? 0x8F : hi; /* past U+10FFFF */
+    }
+    else
+    {
+        return 0;
+    }
+
+    int i;
+    for (i = 1; i < n; i++)
+    {
+        if (pos + i >= len)
+        {
+            return INVALID_ARRAY_INDEX;
+        }
+        else if (seq[i] < lo || seq[i] > hi)
+        {
+            return 0;
+        }
+        lo = 0x80;
+        hi = 0xBF;
+    }
+    return n;
+}
+
+
+/**
+ * @brief Value of the 4 hex digits of a \uXXXX escape
+ */
+static uint32_t jtok_hex4(const char *hex)
+{
+    uint32_t value = 0;
+    int      i;
+    for (i = 0; i < HEXCHAR_ESCAPE_SEQ_COUNT; i++)
+    {
+        char c = hex[i];
+        value <<= 4;
+        if (c >= '0' && c <= '9')
+        {
+            value |= (uint32_t)(c - '0');
+        }
+        else
+        {
+            value |= (uint32_t)((c | 0x20) - 'a' + 10);
+        }
+    }
+    return value;
+}
+
+
+/**
+ * @brief Write code point cp as UTF-8
+ *
+ * @return int number of bytes written (1 to 4)
+ */
+static int jtok_utf8_encode(char *dst, uint32_t cp)
+{
+    int n;
+    if (cp < 0x80)
+    {
+        dst[0] = (char)cp;
+        n      = 1;
+    }
+    else if (cp < 0x800)
+    {
+        dst[0] = (char)(0xC0 | (cp >> 6));
+        dst[1] = (char)(0x80 | (cp & 0x3F));
+        n      = 2;
+    }
+    else if (cp < 0x10000)
+    {
+        dst[0] = (char)(0xE0 | (cp >> 12));
+        dst[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        dst[2] = (char)(0x80 | (cp & 0x3F));
+        n      = 3;
+    }
+    else
+    {
+        dst[0] = (char)(0xF0 | (cp >> 18));
+        dst[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+        dst[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        dst[3] = (char)(0x80 | (cp & 0x3F));
+        n      = 4;
+    }
+    return n;
+}
+
+
+/**
+ * @brief Decode the escape sequence at src
+ *
+ * @param src the backslash
+ * @param end end of the string
+ * @param out receives the decoded bytes (up to 4). It may overlap the escape
+ * sequence if it does not start after src.
+ * @param n receives the number of bytes written to out
+ * @return const char* position after the escape sequence
+ */
+static const char *jtok_unescape_seq(const char *src, const char *end,
+                                     char *out, int *n)
+{
+    *n = 1;
+    if (end - src < 2)
+    {
+        /* Not from the parser, leave it */
+        out[0] = src[0];
+        return src + 1;
+    }
+
+    switch (src[1])
+    {
+        case 'b':
+        {
+            out[0] = '\b';
+        }
+        break;
+        case 'f':
+        {
+            out[0] = '\f';
+        }
+        break;
+        case 'n':
+        {
+            out[0] = '\n';
+        }
+        break;
+        case 'r':
+        {
+            out[0] = '\r';
+        }
+        break;
+        case 't':
+        {
+            out[0] = '\t';
+        }
+        break;
+        case 'u':
+        {
+            if (end - src < 2 + HEXCHAR_ESCAPE_SEQ_COUNT)
+            {
+                /* Not from the parser, leave it */
+                out[0] = src[0];
+                return src + 1;
+            }
+
+            uint32_t cp = jtok_hex4(&src[2]);
+            if (cp >= 0xD800 && cp <= 0xDBFF && end - src >= 12 &&
+                src[6] == '\\' && src[7] == 'u')
+            {
+                uint32_t low = jtok_hex4(&src[8]);
+                if (low >= 0xDC00 && low <= 0xDFFF)
+                {
+                    /* Surrogate pair */
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    src += 6;
+                }
+            }
+            if (cp >= 0xD800 && cp <= 0xDFFF)
+            {
+                /* Lone surrogate */
+                cp = 0xFFFD;
+            }
+            *n = jtok_utf8_encode(out, cp);
+            src += HEXCHAR_ESCAPE_SEQ_COUNT;
+        }
+        break;
+        default: /* \" \\ \/ */
+        {
+            out[0] = src[1];
+        }
+        break;
+    }
+    return src + 2;
+}
+
+
+/**
+ * @brief Step over the next piece of an escaped string: the run of text up
+ * to the next backslash, which needs no decoding, and the escape sequence
+ * after it
+ *
+ * @param src start of the piece
+ * @param end end of the string
+ * @param run receives the number of bytes of text at src
+ * @param out receives the decoded escape sequence (up to 4 bytes)
+ * @param n receives the number of bytes written to out, 0 if the run goes
+ * to the end of the string
+ * @return const char* start of the next piece
+ */
+static const char *jtok_unescape_next(const char *src, const char *end,
+                                      size_t *run, char *out, int *n)
+{
+    const char *esc = memchr(src, '\\', (size_t)(end - src));
+    if (esc == NULL)
+    {
+        esc = end;
+    }
+    *run = (size_t)(esc - src);
+    *n   = 0;
+    if (esc < end)
+    {
+        esc = jtok_unescape_seq(esc, end, out, n);
+    }
+    return esc;
+}
+
+
+/**
+ * @brief Decode the escape sequences of a string token in place and update
+ * its flags to describe the decoded text
+ *
+ * @param tkn the string token
+ */
+static void jtok_unescape(jtok_tkn_t *tkn)
+{
+    char *      str   = &tkn->json[tkn->start];
+    const char *end   = &tkn->json[tkn->end];
+    const char *src   = str;
+    char *      dst   = str;
+    bool        ascii = true;
+
+    while (src < end)
+    {
+        /* Decoding never makes the text longer, so dst never passes src */
+        char        decoded[4];
+        size_t      run;
+        int         n;
+        const char *next = jtok_unescape_next(src, end, &run, decoded, &n);
+        if (dst != src)
+        {
+            memmove(dst, src, run);
+        }
+        dst += run;
+        memcpy(dst, decoded, (size_t)n);
+        ascii &= (n == 0 || (unsigned char)decoded[0] < 0x80);
+        dst += n;
+        src = next;
+    }
+    tkn->end = (int)(dst - tkn->json);
+
+    tkn->flags &= ~JTOK_TKN_FLAG_ESCAPED;
+    if (tkn->flags & JTOK_TKN_FLAG_HASHED)
+    {
+        tkn->hash = jtok_hash(str, (size_t)(tkn->end - tkn->start));
+    }
+    if (!ascii)
+    {
+        tkn->flags &= ~JTOK_TKN_FLAG_ASCII;
+    }
+    tkn->flags |= JTOK_TKN_FLAG_DECODED;
+}
+
+
+/**
+ * @brief Record what the scanner found in new string token idx, decode it
+ * in place if the parser unescapes strings and was handed writable json, and
+ * hash it if it is a key and the parser hashes keys. The tape has no room for
+ * any of it.
+ *
+ * @param parser the json parser
+ * @param idx the string token
+ * @param flags scanner flags of the string
+ */
+static void jtok_string_close(jtok_parser_t *parser, int idx, int flags)
+{
+    if (parser->tape == NULL)
+    {
+        jtok_tkn_t *tkn = &parser->tkn_pool[idx];
+        if (flags & STRING_ESCAPED)
+        {
+            tkn->flags |= JTOK_TKN_FLAG_ESCAPED;
+        }
+        if (!(flags & STRING_NON_ASCII))
+        {
+            tkn->flags |= JTOK_TKN_FLAG_ASCII;
+        }
+        bool decode = parser->unescape && parser->writable;
+        if (decode && (flags & STRING_ESCAPED))
+        {
+            jtok_unescape(tkn);
+        }
+        else if (decode)
+        {
+            tkn->flags |= JTOK_TKN_FLAG_DECODED;
+        }
+
+        if (parser->hash_keys && tkn->parent != NO_PARENT_IDX &&
+            parser->tkn_pool[tkn->parent].type == JTOK_OBJECT)
+        {
+            /* A key, and its text was just scanned */
+            tkn->hash =
+                jtok_hash(&tkn->json[tkn->start], tkn->end - tkn->start);
+            tkn->flags |= JTOK_TKN_FLAG_HASHED;
+        }
+    }
+}
+
+
 JTOK_PARSE_STATUS_t jtok_parse_string(jtok_parser_t *parser)
 {
-    jtok_tkn_t *token;
-    jtok_tkn_t *tokens = parser->tkn_pool;
     int         start;
     char *      js  = parser->json;
     int         len = parser->json_len;
     if (js[parser->pos] == '\"')
     {
+        int quote  = parser->pos;
+        int flags  = 0;
+        int resume = jtok_resume_token(parser, &flags);
         parser->pos++;       /* advance to inside of quotes */
         start = parser->pos; /* first character after the quote */
-        for (; parser->pos < len && js[parser->pos] != '\0'; parser->pos++)
+        if (resume != INVALID_ARRAY_INDEX)
+        {
+            /* Everything before resume was checked by an earlier call */
+            parser->pos = resume;
+        }
+
+        /* Most string bytes need no checks, so jump over them */
+        for (parser->pos = jtok_string_skip(js, parser->pos, len, &flags);
+             parser->pos < len;
+             parser->pos = jtok_string_skip(js, parser->pos + 1, len, &flags))
         {
             /* Quote: end of string */
             if (js[parser->pos] == '\"')
             {
                 if (parser->pos == start)
                 {
-                    token = &tokens[parser->toksuper];
-                    if (token->type != JTOK_STRING)
+                    if (jtok_token_type(parser, parser->toksuper) !=
+                        JTOK_STRING)
                     {
                         return JTOK_PARSE_STATUS_EMPTY_KEY;
                     }
                 }
-                token = jtok_alloc_token(parser);
-                if (token == NULL)
+                int idx =
+                    jtok_new_token(parser, JTOK_STRING, start, parser->pos);
+                if (idx == INVALID_ARRAY_INDEX)
                 {
                     parser->pos = start;
                     return JTOK_PARSE_STATUS_NOMEM;
                 }
-                jtok_fill_token(token, JTOK_STRING, start, parser->pos);
-                token->parent = parser->toksuper;
+                jtok_token_set_value_type(parser, idx,
+                                          parser->pos == start
+                                              ? JTOK_VALUE_TYPE_empty
+                                              : JTOK_VALUE_TYPE_str);
+                jtok_string_close(parser, idx, flags);
                 return JTOK_PARSE_STATUS_OK;
             }
 
             if (js[parser->pos] == '\\')
             {
+                int escape = parser->pos;
+                flags |= STRING_ESCAPED;
                 if (parser->pos + sizeof((char)'\"') < (size_t)len)
                 {
                     parser->pos++;
@@ -77,9 +744,7 @@ JTOK_PARSE_STATUS_t jtok_parse_string(jtok_parser_t *parser)
                                               character */
                             int i;
                             int max_i = HEXCHAR_ESCAPE_SEQ_COUNT;
-                            for (i = 0; i < max_i && parser->pos < len &&
-                                        js[parser->pos] != '\0';
-                                 i++)
+                            for (i = 0; i < max_i && parser->pos < len; i++)
                             {
                                 if (!isxdigit((int)js[parser->pos]))
                                 {
@@ -89,6 +754,14 @@ JTOK_PARSE_STATUS_t jtok_parse_string(jtok_parser_t *parser)
                                 }
                                 parser->pos++;
                             }
+                            if (i < max_i)
+                            {
+                                /* json ends inside the escape sequence */
+                                jtok_suspend_token(parser, quote, escape,
+                                                   flags);
+                                parser->pos = start;
+                                return JTOK_PARSE_STATUS_PARTIAL_TOKEN;
+                            }
                             parser->pos--;
                         }
                         break;
@@ -100,8 +773,46 @@ JTOK_PARSE_STATUS_t jtok_parse_string(jtok_parser_t *parser)
                         break;
                     }
                 }
+                else
+                {
+                    /* json ends right after the backslash */
+                    jtok_suspend_token(parser, quote, escape, flags);
+                    parser->pos = start;
+                    return JTOK_PARSE_STATUS_PARTIAL_TOKEN;
+                }
+            }
+            else if (js[parser->pos] == '\0')
+            {
+                /* The length bounds the json, so a NUL is just a bad byte */
+                parser->pos = start;
+                return JTOK_PARSE_STATUS_INVAL;
+            }
+            else if ((unsigned char)js[parser->pos] >= 0x80)
+            {
+                /* Check the whole run of non-ascii characters */
+                flags |= STRING_NON_ASCII;
+                do
+                {
+                    int seq = jtok_utf8_sequence(js, parser->pos, len);
+                    if (seq == 0)
+                    {
+                        parser->pos = start;
+                        return JTOK_PARSE_STATUS_INVALID_UTF8;
+                    }
+                    else if (seq == INVALID_ARRAY_INDEX)
+                    {
+                        /* json ends inside the sequence */
+                        jtok_suspend_token(parser, quote, parser->pos, flags);
+                        parser->pos = start;
+                        return JTOK_PARSE_STATUS_PARTIAL_TOKEN;
+                    }
+                    parser->pos += seq;
+                } while (parser->pos < len &&
+                         (unsigned char)js[parser->pos] >= 0x80);
+                parser->pos--;
             }
         }
+        jtok_suspend_token(parser, quote, parser->pos, flags);
         parser->pos = start;
         return JTOK_PARSE_STATUS_PARTIAL_TOKEN;
     }
@@ -113,18 +824,150 @@ JTOK_PARSE_STATUS_t jtok_parse_string(jtok_parser_t *parser)
 }
 
 
+unsigned int jtok_string_flags(const char *str, int len)
+{
+    unsigned int flags = JTOK_TKN_FLAG_ASCII;
+    int          i;
+    for (i = 0; i < len; i++)
+    {
+        if ((unsigned char)str[i] >= 0x80)
+        {
+            flags &= ~JTOK_TKN_FLAG_ASCII;
+        }
+        else if (str[i] == '\\')
+        {
+            flags |= JTOK_TKN_FLAG_ESCAPED;
+        }
+    }
+    return flags;
+}
+
+
 bool jtok_toktokcmp_string(const jtok_tkn_t *tkn1, const jtok_tkn_t *tkn2)
 {
     bool           is_equal = false;
     uint_least16_t len      = jtok_toklen(tkn1);
-    if (len == jtok_toklen(tkn2))
+    if ((tkn1->flags & tkn2->flags & JTOK_TKN_FLAG_HASHED) &&
+        tkn1->hash != tkn2->hash)
+    {
+        /* Both keys were hashed while parsing */
+        is_equal = false;
+    }
+    else if (len == jtok_toklen(tkn2))
     {
         const char *start1 = &tkn1->json[tkn1->start];
         const char *start2 = &tkn2->json[tkn2->start];
-        if (0 == strncmp(start1, start2, len))
+        if (0 == memcmp(start1, start2, len))
         {
             is_equal = true;
         }
     }
     return is_equal;
 }
+
+
+JTOK_PARSE_STATUS_t jtok_tok_unescape(jtok_tkn_t *tkn)
+{
+    JTOK_PARSE_STATUS_t status = JTOK_PARSE_STATUS_OK;
+    if (tkn == NULL || tkn->json == NULL)
+    {
+        status = JTOK_PARSE_STATUS_NULL_PARAM;
+    }
+    else if (tkn->type != JTOK_STRING)
+    {
+        status = JTOK_PARSE_STATUS_INVAL;
+    }
+    else if (!(tkn->flags & JTOK_TKN_FLAG_DECODED))
+    {
+        jtok_unescape(tkn);
+    }
+    return status;
+}
+
+
+bool jtok_tokcmp_unescaped(const char *str, const jtok_tkn_t *tok)
+{
+    bool result = false;
+    if (str == NULL || tok == NULL || tok->json == NULL)
+    {
+        result = false;
+    }
+    else if (!(tok->flags & JTOK_TKN_FLAG_ESCAPED))
+    {
+        result = jtok_tokcmp(str, tok);
+    }
+    else
+    {
+        const char *src = &tok->json[tok->start];
+        const char *end = &tok->json[tok->end];
+        result          = true;
+        while (result && src < end)
+        {
+            /* The run up to the next backslash compares as is */
+            char        decoded[4];
+            size_t      run;
+            int         n;
+            int         i;
+            const char *next = jtok_unescape_next(src, end, &run, decoded, &n);
+            result           = (strncmp(str, src, run) == 0);
+            str += run;
+            for (i = 0; i < n && result; i++)
+            {
+                result = (decoded[i] != '\0' && *str++ == decoded[i]);
+            }
+            src = next;
+        }
+        result = result && *str == '\0';
+    }
+    return result;
+}
+
+
+char *jtok_tokcpy_unescaped(char *dst, size_t bufsize, const jtok_tkn_t *tkn)
+{
+    char *result = NULL;
+    if (dst != NULL && tkn != NULL && tkn->json != NULL && bufsize > 0)
+    {
+        const char *src = &tkn->json[tkn->start];
+        const char *end = &tkn->json[tkn->end];
+        size_t      len = 0;
+        if (!(tkn->flags & JTOK_TKN_FLAG_ESCAPED))
+        {
+            len = (size_t)(end - src);
+            if (len < bufsize)
+            {
+                memcpy(dst, src, len);
+                result = dst;
+            }
+        }
+        else
+        {
+            result = dst;
+            while (src < end)
+            {
+                /* Copy the run up to the next backslash as is */
+                char        decoded[4];
+                size_t      run;
+                int         n;
+                const char *next =
+                    jtok_unescape_next(src, end, &run, decoded, &n);
+                if (len + run + (size_t)n >= bufsize)
+                {
+                    result = NULL;
+                    break;
+                }
+                memcpy(&dst[len], src, run);
+                len += run;
+                memcpy(&dst[len], decoded, (size_t)n);
+                len += (size_t)n;
+                src = next;
+            }
+        }
+
+        if (result != NULL)
+        {
+            dst[len] = '\0';
+        }
+    }
+    return result;
+}
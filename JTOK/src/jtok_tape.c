@@ -0,0 +1,227 @@
+/**
+ * @file jtok_tape.c
+ * @author Carl Mattatall (cmattatall2@gmail.com)
+ * @brief Accessors for the compact jtok tape representation
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2020 Carl Mattatall
+ *
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../inc/jtok.h"
+#include "inc/jtok_shared.h"
+#include "inc/jtok_primitive.h"
+#include "inc/jtok_string.h"
+
+
+JTOK_TYPE_t jtok_tape_type(const jtok_tape_t *tape, int idx)
+{
+    return (JTOK_TYPE_t)(tape->tkns[idx].info >> JTOK_TAPE_TYPE_SHIFT);
+}
+
+
+int jtok_tape_size(const jtok_tape_t *tape, int idx)
+{
+    uint32_t info = tape->tkns[idx].info;
+    int      size;
+    switch (jtok_tape_type(tape, idx))
+    {
+        case JTOK_OBJECT:
+        case JTOK_ARRAY:
+        {
+            size = info & JTOK_TAPE_VALUE_MASK;
+        }
+        break;
+        case JTOK_STRING:
+        {
+            size = (info & JTOK_TAPE_KEYVAL_FLAG) ? 1 : 0;
+        }
+        break;
+        default:
+        {
+            size = 0;
+        }
+        break;
+    }
+    return size;
+}
+
+
+int jtok_tape_start(const jtok_tape_t *tape, int idx)
+{
+    return (int)tape->tkns[idx].start;
+}
+
+
+int jtok_tape_end(const jtok_tape_t *tape, int idx)
+{
+    int end;
+    switch (jtok_tape_type(tape, idx))
+    {
+        case JTOK_OBJECT:
+        case JTOK_ARRAY:
+        {
+            /* Find the end of the last token in the subtree, then skip one
+             * closing bracket for every aggregate between it and idx.
+             * Nothing but whitespace and the closing quote of a string can
+             * sit between a token and the brackets that close it.
+             */
+            int last = jtok_tape_next(tape, idx) - 1;
+            int closers;
+            if (last == idx)
+            {
+                end     = jtok_tape_start(tape, idx) + 1;
+                closers = 1;
+            }
+            else
+            {
+                end     = jtok_tape_end(tape, last);
+                closers = 0;
+                do
+                {
+                    last = jtok_tape_parent(tape, last);
+                    switch (jtok_tape_type(tape, last))
+                    {
+                        case JTOK_OBJECT:
+                        case JTOK_ARRAY:
+                        {
+                            closers++;
+                        }
+                        break;
+                        default:
+                        {
+                        }
+                        break;
+                    }
+                } while (last != idx);
+            }
+
+            while (closers > 0)
+            {
+                if (tape->json[end] == '}' || tape->json[end] == ']')
+                {
+                    closers--;
+                }
+                end++;
+            }
+        }
+        break;
+        default:
+        {
+            end = jtok_tape_start(tape, idx) +
+                  (int)(tape->tkns[idx].info & JTOK_TAPE_VALUE_MASK);
+        }
+        break;
+    }
+    return end;
+}
+
+
+int jtok_tape_parent(const jtok_tape_t *tape, int idx)
+{
+    return (int)tape->tkns[idx].parent;
+}
+
+
+int jtok_tape_next(const jtok_tape_t *tape, int idx)
+{
+    return (int)tape->tkns[idx].next;
+}
+
+
+int jtok_tape_sibling(const jtok_tape_t *tape, int idx)
+{
+    int next    = jtok_tape_next(tape, idx);
+    int sibling = NO_SIBLING_IDX;
+    if ((size_t)next < tape->count)
+    {
+        int parent = jtok_tape_parent(tape, idx);
+        if (parent != NO_PARENT_IDX && jtok_tape_parent(tape, next) == parent)
+        {
+            sibling = next;
+        }
+    }
+    return sibling;
+}
+
+
+/**
+ * @brief Work out the value subtype of a tape token, which the tape has no
+ * room to store
+ */
+static JTOK_VALUE_TYPE_t jtok_tape_value_type(const jtok_tape_t *tape,
+                                              int                idx)
+{
+    JTOK_VALUE_TYPE_t value_type = JTOK_VALUE_TYPE_not_a_value_tkn;
+    uint32_t          info       = tape->tkns[idx].info;
+    switch (jtok_tape_type(tape, idx))
+    {
+        case JTOK_STRING:
+        {
+            if (!(info & JTOK_TAPE_KEYVAL_FLAG))
+            {
+                value_type = (info & JTOK_TAPE_VALUE_MASK) == 0
+                                 ? JTOK_VALUE_TYPE_empty
+                                 : JTOK_VALUE_TYPE_str;
+            }
+        }
+        break;
+        case JTOK_PRIMITIVE:
+        {
+            jtok_value_t value;
+            value_type = jtok_primitive_value(tape->json,
+                                              jtok_tape_start(tape, idx),
+                                              jtok_tape_end(tape, idx), &value);
+        }
+        break;
+        default:
+        {
+        }
+        break;
+    }
+    return value_type;
+}
+
+
+jtok_tkn_t jtok_tape_tkn(const jtok_tape_t *tape, int idx)
+{
+    jtok_tkn_t tkn;
+    tkn.json       = (char *)tape->json;
+    tkn.pool       = NULL;
+    tkn.type       = jtok_tape_type(tape, idx);
+    tkn.start      = jtok_tape_start(tape, idx);
+    tkn.end        = jtok_tape_end(tape, idx);
+    tkn.size       = jtok_tape_size(tape, idx);
+    tkn.parent     = jtok_tape_parent(tape, idx);
+    tkn.sibling    = jtok_tape_sibling(tape, idx);
+    tkn.value_type = jtok_tape_value_type(tape, idx);
+    tkn.flags      = 0;
+    tkn.hash       = 0;
+    tkn.next       = jtok_tape_next(tape, idx);
+    if (tkn.type == JTOK_STRING)
+    {
+        /* The tape has no room for the flags the parser found */
+        tkn.flags =
+            jtok_string_flags(&tkn.json[tkn.start], tkn.end - tkn.start);
+    }
+    return tkn;
+}
+
+
+bool jtok_tape_tokcmp(const char *str, const jtok_tape_t *tape, int idx)
+{
+    jtok_tkn_t tkn = jtok_tape_tkn(tape, idx);
+    return jtok_tokcmp(str, &tkn);
+}
+
+
+char *jtok_tape_tokcpy(char *dst, uint_least16_t bufsize,
+                       const jtok_tape_t *tape, int idx)
+{
+    jtok_tkn_t tkn = jtok_tape_tkn(tape, idx);
+    return jtok_tokcpy(dst, bufsize, &tkn);
+}
@@ -0,0 +1,477 @@
+/**
+ * @file jtok_bench.c
+ * @author Carl Mattatall (cmattatall2@gmail.com)
+ * @brief Throughput benchmarks of the jtok parser. Run with make bench.
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2020 Carl Mattatall
+ *
+ * The corpora are generated from a fixed seed, so every run (and every
+ * revision built with JTOK_BENCH_BASE) parses the same bytes. Each figure is
+ * the best of BENCH_ROUNDS runs. JTOK_BENCH_BASE builds only the benchmarks
+ * an older revision has the API for.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../JTOK/inc/jtok.h"
+
+#define BENCH_ROUNDS        5
+#define BENCH_TKN_COUNT     8192
+#define BENCH_DOC_COUNT     2048
+#define BENCH_NDJSON_COPIES 8 /* copies of the corpus in the NDJSON buffer */
+#define BENCH_KEYMAP_MAX    1024
+#define BENCH_LOOKUPS       (1 << 16) /* key lookups timed per object size */
+
+/* A growing byte buffer the corpora are written into */
+typedef struct
+{
+    char * buf;
+    size_t len;
+    size_t cap;
+} bench_buf_t;
+
+/* Corpus of documents parsed one after the other */
+typedef struct
+{
+    bench_buf_t text;
+    size_t      starts[BENCH_DOC_COUNT + 1];
+    int         count;
+} bench_corpus_t;
+
+static unsigned long bench_seed;
+
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+
+static unsigned int bench_rand(unsigned int n)
+{
+    bench_seed = bench_seed * 6364136223846793005ul + 1442695040888963407ul;
+    return (unsigned int)(bench_seed >> 33) % n;
+}
+
+
+static void bench_append(bench_buf_t *out, const char *fmt, ...)
+{
+    va_list args;
+    int     len;
+
+    va_start(args, fmt);
+    len = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+    if (out->len + (size_t)len + 1 > out->cap)
+    {
+        out->cap = (out->len + (size_t)len + 1) * 2;
+        out->buf = realloc(out->buf, out->cap);
+        if (out->buf == NULL)
+        {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    va_start(args, fmt);
+    vsnprintf(&out->buf[out->len], out->cap - out->len, fmt, args);
+    va_end(args);
+    out->len += (size_t)len;
+}
+
+
+static void bench_indent(bench_buf_t *out, int depth, bool pretty)
+{
+    if (pretty)
+    {
+        bench_append(out, "\n%*s", depth * 4, "");
+    }
+}
+
+
+static void bench_object(bench_buf_t *out, int depth, bool pretty);
+
+
+/**
+ * @brief Write a random value. Arrays only ever hold one element type,
+ * since jtok rejects mixed arrays.
+ */
+static void bench_value(bench_buf_t *out, int depth, bool pretty)
+{
+    unsigned int kind = bench_rand(depth < 3 ? 9 : 6);
+    unsigned int i;
+    unsigned int n;
+
+    switch (kind)
+    {
+        case 0:
+            bench_append(out, "%u", bench_rand(100000));
+            break;
+        case 1:
+            bench_append(out, "-%u.%02ue%u", bench_rand(1000), bench_rand(100),
+                         bench_rand(20));
+            break;
+        case 2:
+            bench_append(out, "\"value %u\"", bench_rand(100000));
+            break;
+        case 3:
+            bench_append(out, "\"a \\\"quoted\\\" \\u00e9 string\"");
+            break;
+        case 4:
+            bench_append(out, bench_rand(2) ? "true" : "false");
+            break;
+        case 5:
+            bench_append(out, "null");
+            break;
+        case 6:
+            bench_object(out, depth + 1, pretty);
+            break;
+        case 7:
+            n = 1 + bench_rand(8);
+            bench_append(out, "[");
+            for (i = 0; i < n; i++)
+            {
+                bench_append(out, i ? ",%u" : "%u", bench_rand(1000));
+            }
+            bench_append(out, "]");
+            break;
+        default:
+            n = 1 + bench_rand(4);
+            bench_append(out, "[");
+            for (i = 0; i < n; i++)
+            {
+                bench_append(out, i ? "," : "");
+                bench_object(out, depth + 1, pretty);
+            }
+            bench_append(out, "]");
+            break;
+    }
+}
+
+
+static void bench_object(bench_buf_t *out, int depth, bool pretty)
+{
+    unsigned int n = 1 + bench_rand(depth ? 6 : 24);
+    unsigned int i;
+
+    bench_append(out, "{");
+    for (i = 0; i < n; i++)
+    {
+        bench_append(out, i ? "," : "");
+        bench_indent(out, depth + 1, pretty);
+        bench_append(out, pretty ? "\"key%u\": " : "\"key%u\":", i);
+        bench_value(out, depth, pretty);
+    }
+    bench_indent(out, depth, pretty);
+    bench_append(out, "}");
+}
+
+
+/**
+ * @brief Fill a corpus with count small documents of mixed-type values
+ */
+static void bench_corpus(bench_corpus_t *corpus, int count, bool pretty)
+{
+    int i;
+
+    memset(corpus, 0, sizeof(*corpus));
+    bench_seed = 1;
+    for (i = 0; i < count; i++)
+    {
+        corpus->starts[i] = corpus->text.len;
+        bench_object(&corpus->text, 0, pretty);
+    }
+    corpus->starts[count] = corpus->text.len;
+    corpus->count         = count;
+}
+
+
+static void bench_report(const char *what, size_t bytes, double secs)
+{
+    printf("  %-32s %8.1f MB/s\n", what, (double)bytes / secs / 1e6);
+}
+
+
+/**
+ * @brief Parse every document of the corpus into a token pool
+ */
+static double bench_parse_corpus(const bench_corpus_t *corpus,
+                                 jtok_tkn_t *          tkns)
+{
+    double best = 0;
+    int    round;
+    int    i;
+
+    for (round = 0; round < BENCH_ROUNDS; round++)
+    {
+        double start = bench_now();
+        double secs;
+        for (i = 0; i < corpus->count; i++)
+        {
+            const char *json = &corpus->text.buf[corpus->starts[i]];
+            size_t      len  = corpus->starts[i + 1] - corpus->starts[i];
+            if (jtok_parse_n(json, len, tkns, BENCH_TKN_COUNT) !=
+                JTOK_PARSE_STATUS_OK)
+            {
+                fprintf(stderr, "document %d does not parse\n", i);
+                exit(1);
+            }
+        }
+        secs = bench_now() - start;
+        best = (round == 0 || secs < best) ? secs : best;
+    }
+    return best;
+}
+
+
+/**
+ * @brief Object and array state machines on minified and pretty-printed
+ * documents. Built with JTOK_BENCH_BASE against an older revision, this is
+ * the baseline the transition tables are compared with.
+ */
+static void bench_fsm(jtok_tkn_t *tkns)
+{
+    bench_corpus_t corpus;
+
+    printf("object/array state machines (jtok_parse_n):\n");
+    bench_corpus(&corpus, BENCH_DOC_COUNT, false);
+    bench_report("mixed, minified", corpus.text.len,
+                 bench_parse_corpus(&corpus, tkns));
+    free(corpus.text.buf);
+
+    bench_corpus(&corpus, BENCH_DOC_COUNT, true);
+    bench_report("mixed, pretty", corpus.text.len,
+                 bench_parse_corpus(&corpus, tkns));
+    free(corpus.text.buf);
+}
+
+
+#ifndef JTOK_BENCH_BASE
+static void bench_count_doc(void *ctx, const jtok_doc_t *doc,
+                            const jtok_tkn_t *tkns, int count)
+{
+    (void)tkns;
+    (void)count;
+    if (doc->status != JTOK_PARSE_STATUS_OK)
+    {
+        fprintf(stderr, "ndjson document does not parse\n");
+        exit(1);
+    }
+    (*(size_t *)ctx)++;
+}
+
+
+/**
+ * @brief jtok_parse_parallel on one NDJSON buffer, from one thread up to
+ * twice the online cpus. Throughput should grow near linearly up to the cpu
+ * count and flatten past it.
+ */
+static void bench_parallel(void)
+{
+    bench_corpus_t corpus;
+    bench_buf_t    ndjson = {0};
+    long           cpus   = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int   threads;
+    int            copy;
+    int            i;
+
+    bench_corpus(&corpus, BENCH_DOC_COUNT, false);
+    for (copy = 0; copy < BENCH_NDJSON_COPIES; copy++)
+    {
+        for (i = 0; i < corpus.count; i++)
+        {
+            bench_append(&ndjson, "%.*s\n",
+                         (int)(corpus.starts[i + 1] - corpus.starts[i]),
+                         &corpus.text.buf[corpus.starts[i]]);
+        }
+    }
+    free(corpus.text.buf);
+
+    printf("parallel NDJSON (jtok_parse_parallel, %ld online cpus):\n", cpus);
+    for (threads = 1; threads <= (unsigned int)(cpus < 1 ? 2 : cpus * 2);
+         threads *= 2)
+    {
+        char   what[32];
+        double best = 0;
+        int    round;
+        for (round = 0; round < BENCH_ROUNDS; round++)
+        {
+            size_t docs  = 0;
+            double start = bench_now();
+            double secs;
+            jtok_parse_parallel(ndjson.buf, ndjson.len, threads,
+                                BENCH_TKN_COUNT, bench_count_doc, &docs);
+            secs = bench_now() - start;
+            best = (round == 0 || secs < best) ? secs : best;
+            if (docs != (size_t)BENCH_DOC_COUNT * BENCH_NDJSON_COPIES)
+            {
+                fprintf(stderr, "ndjson documents went missing\n");
+                exit(1);
+            }
+        }
+        snprintf(what, sizeof(what), "%u thread(s)", threads);
+        bench_report(what, ndjson.len, best);
+    }
+    free(ndjson.buf);
+}
+
+/**
+ * @brief jtok_validate against a full jtok_parse_n of the same corpora
+ */
+static void bench_validate(jtok_tkn_t *tkns)
+{
+    bench_corpus_t corpus;
+    int            pretty;
+
+    printf("validate vs parse:\n");
+    for (pretty = 0; pretty < 2; pretty++)
+    {
+        double best = 0;
+        int    round;
+        int    i;
+
+        bench_corpus(&corpus, BENCH_DOC_COUNT, pretty);
+        for (round = 0; round < BENCH_ROUNDS; round++)
+        {
+            double start = bench_now();
+            double secs;
+            for (i = 0; i < corpus.count; i++)
+            {
+                const char *json = &corpus.text.buf[corpus.starts[i]];
+                size_t      len  = corpus.starts[i + 1] - corpus.starts[i];
+                if (jtok_validate(json, len) != JTOK_PARSE_STATUS_OK)
+                {
+                    fprintf(stderr, "document %d does not validate\n", i);
+                    exit(1);
+                }
+            }
+            secs = bench_now() - start;
+            best = (round == 0 || secs < best) ? secs : best;
+        }
+        bench_report(pretty ? "jtok_parse_n, pretty" : "jtok_parse_n, minified",
+                     corpus.text.len, bench_parse_corpus(&corpus, tkns));
+        bench_report(pretty ? "jtok_validate, pretty"
+                            : "jtok_validate, minified",
+                     corpus.text.len, best);
+        free(corpus.text.buf);
+    }
+}
+
+/**
+ * @brief Time lookups of every key of the object, one pass per rep
+ */
+static double bench_lookups(const jtok_tkn_t *obj, char (*keys)[16], int n,
+                            int reps, jtok_keymap_t *map)
+{
+    double best = 0;
+    int    round;
+
+    for (round = 0; round < BENCH_ROUNDS; round++)
+    {
+        double start = bench_now();
+        double secs;
+        int    rep;
+        int    i;
+        if (map != NULL)
+        {
+            /* Dropped, so each round pays for building it again */
+            jtok_keymap_init(map, map->slots, map->size);
+        }
+        for (rep = 0; rep < reps; rep++)
+        {
+            for (i = 0; i < n; i++)
+            {
+                int found = (map != NULL)
+                                ? jtok_keymap_find(map, obj, keys[i],
+                                                   strlen(keys[i]))
+                                : jtok_obj_has_key(obj, keys[i]);
+                if (found != 1 + 2 * i)
+                {
+                    fprintf(stderr, "key %s not found\n", keys[i]);
+                    exit(1);
+                }
+            }
+        }
+        secs = bench_now() - start;
+        best = (round == 0 || secs < best) ? secs : best;
+    }
+    return best;
+}
+
+
+/**
+ * @brief jtok_keymap_find against the linear jtok_obj_has_key on objects of
+ * growing size
+ */
+static void bench_keymap(void)
+{
+    static char        keys[BENCH_KEYMAP_MAX][16];
+    jtok_keymap_slot_t slots[JTOK_KEYMAP_SLOTS(BENCH_KEYMAP_MAX)];
+    jtok_keymap_t      map;
+    jtok_tkn_t *       tkns = malloc((2 * BENCH_KEYMAP_MAX + 1) * sizeof(*tkns));
+    int                n;
+
+    if (tkns == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    printf("key lookup (ns per lookup, linear vs keymap):\n");
+    for (n = 4; n <= BENCH_KEYMAP_MAX; n *= 4)
+    {
+        bench_buf_t json = {0};
+        int         reps = BENCH_LOOKUPS / n;
+        int         i;
+        double      linear;
+        double      hashed;
+
+        for (i = 0; i < n; i++)
+        {
+            snprintf(keys[i], sizeof(keys[i]), "key%d", i);
+            bench_append(&json, "%s\"%s\":%d", i ? "," : "{", keys[i], i);
+        }
+        bench_append(&json, "}");
+        if (jtok_parse_n(json.buf, json.len, tkns, 2 * n + 1) !=
+            JTOK_PARSE_STATUS_OK)
+        {
+            fprintf(stderr, "object of %d keys does not parse\n", n);
+            exit(1);
+        }
+
+        jtok_keymap_init(&map, slots, JTOK_KEYMAP_SLOTS(n));
+        linear = bench_lookups(tkns, keys, n, reps, NULL);
+        hashed = bench_lookups(tkns, keys, n, reps, &map);
+        printf("  %5d keys %24.1f %8.1f\n", n, linear * 1e9 / (n * reps),
+               hashed * 1e9 / (n * reps));
+        free(json.buf);
+    }
+    free(tkns);
+}
+#endif
+
+
+int main(void)
+{
+    jtok_tkn_t *tkns = malloc(BENCH_TKN_COUNT * sizeof(*tkns));
+    if (tkns == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    bench_fsm(tkns);
+#ifndef JTOK_BENCH_BASE
+    bench_parallel();
+    bench_validate(tkns);
+    bench_keymap();
+#endif
+    free(tkns);
+    return 0;
+}
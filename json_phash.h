@@ -0,0 +1,34 @@
+#ifndef __JSON_PHASH_H__
+#define __JSON_PHASH_H__
+#ifdef __cplusplus
+/* clang-format off */
+extern "C"
+{
+/* clang-format on */
+#endif /* Start C linkage */
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Perfect hash of the json_parse command keys. A key hash picks a bucket,
+ * and the displacement tools/json_phash_gen.c found for the bucket moves
+ * each of its keys to a slot of its own. Shared by the generator and
+ * jsons_parser.c so both always agree on the slot of a key.
+ */
+
+/* Bucket of key hash h, for n buckets */
+#define JSON_PHASH_BUCKET(h, n) ((size_t)((h) % (uint32_t)(n)))
+
+/* Slot of key hash h with bucket displacement d, for n slots */
+#define JSON_PHASH_SLOT(h, d, n)                                               \
+    ((size_t)(((uint64_t)(uint32_t)(((h) ^ (d)) * 0x9E3779B1u) *               \
+               (uint64_t)(n)) >>                                               \
+              32))
+
+#ifdef __cplusplus
+/* clang-format off */
+}
+/* clang-format on */
+#endif /* End C linkage */
+#endif /* __JSON_PHASH_H__ */
@@ -19,93 +19,169 @@
 
 #include "JTOK/inc/jtok.h"
 #include "jsons_parser.h"
+#include "json_phash.h"
+
+/* Command list and the table generated from it. The checks in tests/
+ * build their own */
+#ifndef JSON_COMMANDS_DEF
+#define JSON_COMMANDS_DEF "json_commands.def"
+#endif
+#ifndef JSON_PARSE_TABLE_H
+#define JSON_PARSE_TABLE_H "json_parse_table.h"
+#endif
 
 #define BASE_10 10
-#define JSON_TKN_CNT 20
 #define JSON_HANDLER_RETVAL_ERROR NULL
 
 typedef uint_fast16_t token_index_t;
 
 typedef void *         json_handler_retval;
 typedef token_index_t *json_handler_args;
-typedef json_handler_retval (*json_handler)(json_handler_args);
+typedef json_handler_retval (*json_handler)(json_parse_ctx_t *ctx,
+                                            json_handler_args);
 
 typedef struct
 {
-    char         key[25];
+    const char * key;     /* NULL in a free slot */
+    size_t       len;     /* strlen(key) */
+    uint32_t     hash;    /* jtok_hash_key(key, len) */
     json_handler handler;
+    int          next;    /* next entry with the same hash, -1 if none */
 } json_parse_table_item;
 
 
-static jtok_tkn_t tkns[JSON_TKN_CNT];
-static char       value_holder[50];
+/* Context of json_parse and json_parse_n */
+static json_parse_ctx_t default_ctx;
 
 
 /* JSON HANDLER DECLARATIONS */
-//static void *parse_hardware_json(json_handler_args args);
+#define JSON_COMMAND(key, handler)                                             \
+    static json_handler_retval handler(json_parse_ctx_t *ctx,                  \
+                                       json_handler_args args);
+#include JSON_COMMANDS_DEF
+#undef JSON_COMMAND
 
-/* JSON PARSE TABLE */
-/* clang-format off */
-static const json_parse_table_item json_parse_table[] = {
+/* JSON PARSE TABLE, generated from json_commands.def by the makefile */
+#include JSON_PARSE_TABLE_H
 
-  //  {.key = "fwVersion",  .handler = parse_firmware_json},
 
-  };
-/* clang-format on */
+/**
+ * @brief Find the command table entry of a key with one hash and, unless
+ * two commands share a hash, at most one memcmp
+ *
+ * @param key the key token, hashed by the parser
+ * @return const json_parse_table_item* the entry, NULL if the key is not a
+ * registered command
+ */
+static const json_parse_table_item *json_parse_lookup(const jtok_tkn_t *key)
+{
+    const json_parse_table_item *item = NULL;
+    uint32_t                     hash = key->hash;
+    if (!(key->flags & JTOK_TKN_FLAG_HASHED))
+    {
+        size_t      len  = 0;
+        const char *text = jtok_tokview(key, &len);
+        hash             = jtok_hash_key(text, len);
+    }
+
+    size_t bucket = JSON_PHASH_BUCKET(hash, JSON_PARSE_DISP_SIZE);
+    int    entry  = (int)JSON_PHASH_SLOT(hash, json_parse_disp[bucket],
+                                        JSON_PARSE_SLOT_COUNT);
+    while (item == NULL && entry >= 0)
+    {
+        const json_parse_table_item *candidate = &json_parse_table[entry];
+        if (jtok_tokcmp_hash(candidate->key, candidate->len, candidate->hash,
+                             key))
+        {
+            item = candidate;
+        }
+        entry = candidate->next;
+    }
+    return item;
+}
 
 
 int json_parse(uint8_t *json)
 {
     //CONFIG_ASSERT(json != NULL);
 
-    int json_parse_status = 0;
+    return json_parse_n(json, strlen((char *)json));
+}
+
+
+int json_parse_n(const uint8_t *json, size_t len)
+{
+    //CONFIG_ASSERT(json != NULL);
+
+    return json_parse_ctx(&default_ctx, json, len);
+}
 
-    int jtok_retval = jtok_parse((char *)json, tkns, JSON_TKN_CNT);
 
+int json_parse_ctx(json_parse_ctx_t *ctx, const uint8_t *json, size_t len)
+{
+    //CONFIG_ASSERT(ctx != NULL);
+    //CONFIG_ASSERT(json != NULL);
+
+    int           json_parse_status = 0;
+    jtok_tkn_t *  tkns              = ctx->tkns;
+    jtok_frame_t  stack[JTOK_MAX_RECURSE_DEPTH + 1];
+    jtok_parser_t parser;
+
+    /* Keys are hashed while parsing, for the command table, and numbers are
+     * decoded once for the handlers (see jtok_tok_value) */
+    jtok_parser_init(&parser, tkns, JSON_TKN_CNT, stack,
+                     sizeof(stack) / sizeof(*stack));
+    jtok_parser_set_hash_keys(&parser, true);
+    jtok_parser_set_values(&parser, ctx->values);
+    int jtok_retval = jtok_parser_parse(&parser, (const char *)json, len);
+
+    ctx->key_cnt = 0;
     if (jtok_retval != JTOK_PARSE_STATUS_OK)
     {
         json_parse_status = jtok_retval;
-        memset(tkns, 0, sizeof(tkns));
+        memset(ctx->tkns, 0, sizeof(ctx->tkns));
     }
     else
     {
 
-        token_index_t t; /* token index */
-        token_index_t k; /* key index for json table */
-        t = 0;
         if (isValidJson(tkns, JSON_TKN_CNT))
         {
-            /* Go through command table and check if we have a registered
-             * command for the key */
-            t++;
-
-            unsigned int k_max =
-                sizeof(json_parse_table) / sizeof(*json_parse_table);
-            for (k = 0; k < k_max; k++)
+            /* Dispatch every top-level key, first key is right after the
+             * top-level object */
+            int key = (tkns[0].size > 0) ? 1 : NO_SIBLING_IDX;
+            while (key != NO_SIBLING_IDX)
             {
-                /*
-                 * If we have a command for the current key,
-                 * execute the command handler
-                 */
-                if (jtok_tokcmp(json_parse_table[k].key, &tkns[t]))
+                /* Handlers move t through the value of the key */
+                token_index_t t          = (token_index_t)key;
+                int           key_status = 0;
+
+                /* Check if we have a registered command for the key */
+                const json_parse_table_item *item = json_parse_lookup(&tkns[t]);
+                if (item != NULL)
                 {
-                    if (NULL != json_parse_table[k].handler)
+                    /* execute the command handler */
+                    if (NULL != item->handler)
                     {
                         json_handler_retval retval;
-                        retval = json_parse_table[k].handler(&t);
+                        retval = item->handler(ctx, &t);
                         if (retval == JSON_HANDLER_RETVAL_ERROR)
                         {
-                            json_parse_status = -1;
+                            key_status = -1;
                         }
                     }
-                    break;
                 }
-            }
+                else
+                {
+                    /* No match with supported json keys */
+                    key_status = -1;
+                }
 
-            /* No match with supported json keys */
-            if (k >= k_max)
-            {
-                json_parse_status = -1;
+                if (key_status != 0)
+                {
+                    json_parse_status = -1;
+                }
+                ctx->key_status[ctx->key_cnt++] = key_status;
+                key                             = tkns[key].sibling;
             }
         }
         else
@@ -117,11 +193,13 @@ int json_parse(uint8_t *json)
 }
 
 //example
+/*
 
 
-static void *parse_pwm_rw_x(json_handler_args args)
+static void *parse_pwm_rw_x(json_parse_ctx_t *ctx, json_handler_args args)
 {
-    token_index_t *t = (token_index_t *)args;
+    jtok_tkn_t *   tkns = ctx->tkns;
+    token_index_t *t    = (token_index_t *)args;
     CONFIG_ASSERT(*t < JSON_TKN_CNT);
     *t += 1; // don't do ++ because * has higher precedence than ++
     if (jtok_tokcmp("read", &tkns[*t]))
@@ -134,25 +212,21 @@ static void *parse_pwm_rw_x(json_handler_args args)
         *t += 1;
         if (jtok_tokcmp("value", &tkns[*t]))
         {
-             //getting values from JSON is a little unelegant in C ...
             *t += 1;
 
-
-            memset(value_holder, 0, sizeof(value_holder));
-            jtok_tokcpy(value_holder, sizeof(value_holder), &tkns[*t]);
-            char *endptr    = value_holder;
-            pwm_t new_value = (pwm_t)strtoul(value_holder, &endptr, BASE_10);
-            if (*endptr != '\0')
+            // decoded while parsing, no need to parse the digits again
+            jtok_value_t new_value;
+            if (jtok_tok_value(&tkns[*t], ctx->values, &new_value) !=
+                JTOK_VALUE_TYPE_uint)
             {
-                //error parsing the value - couldn't reach end of token
+                //value isn't an unsigned integer
                 return JSON_HANDLER_RETVAL_ERROR;
             }
             else
             {
-                reacwheel_set_wheel_pwm(REACTION_WHEEL_x, new_value);
+                reacwheel_set_wheel_pwm(REACTION_WHEEL_x, (pwm_t)new_value.u);
                 OBC_IF_printf("{\"pwm_rw_x\":\"written\"}");
             }
-            memset(value_holder, 0, sizeof(value_holder));
         }
         else
         {
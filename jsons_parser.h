@@ -8,16 +8,68 @@ extern "C"
 #endif /* Start C linkage */
 
 #include <stdint.h>
+#include <stddef.h>
+
+#include "JTOK/inc/jtok.h"
+
+#define JSON_TKN_CNT 20
+#define JSON_VALUE_HOLDER_SIZE 50
+#define JSON_KEY_CNT (JSON_TKN_CNT / 2) /* max top-level keys of a json */
+
+/**
+ * Everything one json_parse_ctx call works on. Each thread that dispatches
+ * json needs its own context, then no locking is needed.
+ */
+typedef struct
+{
+    jtok_tkn_t   tkns[JSON_TKN_CNT];                  /* token pool */
+    jtok_value_t values[JSON_TKN_CNT]; /* decoded value of each primitive */
+    char         value_holder[JSON_VALUE_HOLDER_SIZE]; /* handler scratch */
+    unsigned int key_cnt;                  /* top-level keys dispatched */
+    int          key_status[JSON_KEY_CNT]; /* status of each, 0 == success */
+} json_parse_ctx_t;
 
 /**
- * @brief Parse a json and execute commands based on the key : value pairs
+ * @brief Parse a json and execute commands based on the key : value pairs.
+ * Every top-level key is dispatched to its handler, in order, so one json
+ * can carry a batch of commands.
  *
  * @param json nul-terminated string in json format
  * @param json_strlen
- * @return int 0 == success.
+ * @return int 0 == success of every command, -1 if any key has no handler
+ * or its handler failed.
  */
 int json_parse(uint8_t *json);
 
+
+/**
+ * @brief Parse len bytes of json and execute commands based on the
+ * key : value pairs
+ *
+ * @param json json to parse. Does not need to be nul-terminated, so it can be
+ * parsed straight out of a receive buffer.
+ * @param len number of bytes of json
+ * @return int 0 == success.
+ */
+int json_parse_n(const uint8_t *json, size_t len);
+
+
+/**
+ * @brief Parse len bytes of json with the token pool and scratch buffers of
+ * ctx, and execute commands based on the key : value pairs
+ *
+ * @param ctx the parse context. The handlers are passed ctx. On return
+ * ctx->key_status holds the status of each of the ctx->key_cnt top-level
+ * keys, in order.
+ * @param json json to parse. Does not need to be nul-terminated.
+ * @param len number of bytes of json
+ * @return int 0 == success of every command, -1 if any failed.
+ *
+ * @note json_parse and json_parse_n share one static context, so only this
+ * function may be called from more than one thread at once.
+ */
+int json_parse_ctx(json_parse_ctx_t *ctx, const uint8_t *json, size_t len);
+
 #ifdef __cplusplus
 /* clang-format off */
 }
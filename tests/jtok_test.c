@@ -0,0 +1,2053 @@
+/**
+ * @file jtok_test.c
+ * @author Carl Mattatall (cmattatall2@gmail.com)
+ * @brief Checks of the jtok parser and json_parse. Run with make test, which
+ * builds json_parse with the commands of tests/json_test_commands.def.
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2020 Carl Mattatall
+ *
+ */
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../JTOK/inc/jtok.h"
+#include "../JTOK/src/inc/jtok_double.h"
+#include "../JTOK/src/inc/jtok_index.h"
+
+/* Built in, so the checks can reach its command table */
+#include "../jsons_parser.c"
+
+#define TEST_TKN_COUNT   32
+#define TEST_STACK_DEPTH 8
+
+static int failures;
+
+
+/* Test command handlers. Each leaves its name in the value holder */
+static json_handler_retval test_cmd_record(json_parse_ctx_t *ctx,
+                                           json_handler_args args,
+                                           const char *      name)
+{
+    size_t used = strlen(ctx->value_holder);
+    snprintf(&ctx->value_holder[used], sizeof(ctx->value_holder) - used,
+             "%s;", name);
+    return args;
+}
+
+static json_handler_retval test_cmd_ping(json_parse_ctx_t *ctx,
+                                         json_handler_args args)
+{
+    return test_cmd_record(ctx, args, "ping");
+}
+
+static json_handler_retval test_cmd_fail(json_parse_ctx_t *ctx,
+                                         json_handler_args args)
+{
+    test_cmd_record(ctx, args, "fail");
+    return JSON_HANDLER_RETVAL_ERROR;
+}
+
+static json_handler_retval test_cmd_set(json_parse_ctx_t *ctx,
+                                        json_handler_args args)
+{
+    return test_cmd_record(ctx, args, "set");
+}
+
+static json_handler_retval test_cmd_first(json_parse_ctx_t *ctx,
+                                          json_handler_args args)
+{
+    return test_cmd_record(ctx, args, "first");
+}
+
+static json_handler_retval test_cmd_second(json_parse_ctx_t *ctx,
+                                           json_handler_args args)
+{
+    return test_cmd_record(ctx, args, "second");
+}
+
+
+static void expect_status(const char *what, JTOK_PARSE_STATUS_t got,
+                          JTOK_PARSE_STATUS_t want)
+{
+    if (got != want)
+    {
+        printf("FAIL %s: got status %d, want %d\n", what, (int)got,
+               (int)want);
+        failures++;
+    }
+}
+
+
+static void expect(const char *what, bool ok)
+{
+    if (!ok)
+    {
+        printf("FAIL %s\n", what);
+        failures++;
+    }
+}
+
+
+/**
+ * @brief A NUL inside the given length is a bad byte like any other, not
+ * the end of the json
+ */
+static void test_parse_n_embedded_nul(void)
+{
+    static const struct
+    {
+        const char *        name;
+        const char *        json;
+        size_t              len;
+        JTOK_PARSE_STATUS_t status;
+    } cases[] = {
+        {"nul in string", "{\"a\":\"b\0c\"}", 11, JTOK_PARSE_STATUS_INVAL},
+        {"nul in \\u escape", "{\"a\":\"\\u00\0a\"}", 14,
+         JTOK_PARSE_STATUS_INVAL},
+        {"nul after number", "{\"a\":1\0}", 8,
+         JTOK_PARSE_STATUS_INVALID_PRIMITIVE},
+        {"nul after comma", "{\"a\":1,\0}", 9, JTOK_PARSE_STATUS_INVAL},
+        {"no nul", "{\"a\":1}", 7, JTOK_PARSE_STATUS_OK},
+    };
+    jtok_tkn_t tkns[TEST_TKN_COUNT];
+    size_t     i;
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        expect_status(
+            cases[i].name,
+            jtok_parse_n(cases[i].json, cases[i].len, tkns, TEST_TKN_COUNT),
+            cases[i].status);
+        expect_status(cases[i].name,
+                      jtok_validate(cases[i].json, cases[i].len),
+                      cases[i].status);
+    }
+}
+
+
+/**
+ * @brief A streaming parser must report a NUL as an error rather than ask
+ * for more json forever
+ */
+static void test_feed_embedded_nul(void)
+{
+    static const char json[]   = "{\"a\":1\0,\"b\":2}";
+    static const char string[] = "{\"a\":\"x\0\"}";
+    jtok_tkn_t        tkns[TEST_TKN_COUNT];
+    jtok_frame_t      stack[TEST_STACK_DEPTH];
+    jtok_parser_t     parser;
+
+    jtok_parser_init(&parser, tkns, TEST_TKN_COUNT, stack, TEST_STACK_DEPTH);
+    expect_status("feed nul after number", jtok_parser_feed(&parser, json, 7),
+                  JTOK_PARSE_STATUS_INVALID_PRIMITIVE);
+
+    jtok_parser_init(&parser, tkns, TEST_TKN_COUNT, stack, TEST_STACK_DEPTH);
+    expect_status("feed open string", jtok_parser_feed(&parser, string, 6),
+                  JTOK_PARSE_STATUS_PARTIAL_TOKEN);
+    expect_status("feed nul in string", jtok_parser_feed(&parser, string + 6, 4),
+                  JTOK_PARSE_STATUS_INVAL);
+}
+
+
+/**
+ * @brief Token positions are ints, so longer json is turned away before any
+ * of it is read
+ */
+static void test_parse_n_too_long(void)
+{
+    static const char json[] = "{\"a\":1}";
+    jtok_tkn_t        tkns[TEST_TKN_COUNT];
+    size_t            len = (size_t)INT_MAX + 1;
+
+    expect_status("parse_n too long",
+                  jtok_parse_n(json, len, tkns, TEST_TKN_COUNT),
+                  JTOK_PARSE_STATUS_TOO_LONG);
+    expect_status("parse_n_parallel too long",
+                  jtok_parse_n_parallel(json, len, tkns, TEST_TKN_COUNT, 4),
+                  JTOK_PARSE_STATUS_TOO_LONG);
+}
+
+
+/**
+ * @brief Escapes decode the same in place, on compare and on copy
+ */
+static void test_unescape(void)
+{
+    static const char json[] = "{\"k\":\"a\\n\\u00e9\\ud83d\\ude00b\\\"\"}";
+    static const char want[] = "a\n\xc3\xa9\xf0\x9f\x98\x80" "b\"";
+    char              copy[sizeof(json)];
+    char              buf[sizeof(want)];
+    jtok_tkn_t        tkns[TEST_TKN_COUNT];
+    jtok_frame_t      stack[TEST_STACK_DEPTH];
+    jtok_parser_t     parser;
+    size_t            len;
+    const char *      view;
+
+    expect_status("unescape parse",
+                  jtok_parse_n(json, sizeof(json) - 1, tkns, TEST_TKN_COUNT),
+                  JTOK_PARSE_STATUS_OK);
+    if (!jtok_tokcmp_unescaped(want, &tkns[2]) ||
+        jtok_tokcpy_unescaped(buf, sizeof(buf), &tkns[2]) == NULL ||
+        strcmp(buf, want) != 0 ||
+        jtok_tokcpy_unescaped(buf, sizeof(buf) - 1, &tkns[2]) != NULL)
+    {
+        printf("FAIL unescape on compare or copy\n");
+        failures++;
+    }
+
+    /* The const entry point leaves the json alone even when unescaping */
+    memcpy(copy, json, sizeof(json));
+    jtok_parser_init(&parser, tkns, TEST_TKN_COUNT, stack, TEST_STACK_DEPTH);
+    jtok_parser_set_unescape(&parser, true);
+    expect_status("unescape read-only",
+                  jtok_parser_parse(&parser, copy, sizeof(copy) - 1),
+                  JTOK_PARSE_STATUS_OK);
+    expect("unescape read-only",
+           memcmp(copy, json, sizeof(json)) == 0 &&
+               !(tkns[2].flags & JTOK_TKN_FLAG_DECODED) &&
+               jtok_tokcmp_unescaped(want, &tkns[2]));
+
+    jtok_parser_init(&parser, tkns, TEST_TKN_COUNT, stack, TEST_STACK_DEPTH);
+    jtok_parser_set_unescape(&parser, true);
+    expect_status("unescape in place",
+                  jtok_parser_parse_inplace(&parser, copy, sizeof(copy) - 1),
+                  JTOK_PARSE_STATUS_OK);
+    view = jtok_tokview(&tkns[2], &len);
+    if (view == NULL || len != sizeof(want) - 1 ||
+        memcmp(view, want, len) != 0)
+    {
+        printf("FAIL unescape in place\n");
+        failures++;
+    }
+}
+
+
+typedef struct
+{
+    const char *json;  /* the buffer */
+    size_t      docs;  /* documents handled */
+    size_t      last;  /* start of the last one */
+    bool        bad;   /* a document was out of order or misplaced */
+} test_ndjson_t;
+
+
+static void test_ndjson_handler(void *ctx, const jtok_doc_t *doc,
+                                const jtok_tkn_t *tkns, int count)
+{
+    test_ndjson_t *batch = ctx;
+    if (doc->status != JTOK_PARSE_STATUS_OK || count != 3 ||
+        (batch->docs > 0 && doc->start <= batch->last) ||
+        &tkns[0].json[tkns[0].start] != &batch->json[doc->start] ||
+        &tkns[0].json[tkns[0].end] != &batch->json[doc->end])
+    {
+        batch->bad = true;
+    }
+    batch->last = doc->start;
+    batch->docs++;
+}
+
+
+/**
+ * @brief Documents of every chunk are handed out in order, with offsets into
+ * the whole buffer and tokens that point at the same text
+ */
+static void test_parse_parallel_offsets(void)
+{
+    static const char line[]  = "{\"a\":1}\n";
+    const size_t      nlines  = 400000; /* a few chunks */
+    size_t            len     = nlines * (sizeof(line) - 1);
+    char *            json    = malloc(len);
+    test_ndjson_t     batch   = {json, 0, 0, false};
+    size_t            i;
+
+    if (json == NULL)
+    {
+        printf("FAIL parse_parallel: no memory\n");
+        failures++;
+        return;
+    }
+    for (i = 0; i < nlines; i++)
+    {
+        memcpy(&json[i * (sizeof(line) - 1)], line, sizeof(line) - 1);
+    }
+
+    expect_status("parse_parallel",
+                  jtok_parse_parallel(json, len, 4, TEST_TKN_COUNT,
+                                      test_ndjson_handler, &batch),
+                  JTOK_PARSE_STATUS_OK);
+    if (batch.docs != nlines || batch.bad)
+    {
+        printf("FAIL parse_parallel: %zu of %zu documents, bad %d\n",
+               batch.docs, nlines, (int)batch.bad);
+        failures++;
+    }
+    free(json);
+}
+
+
+/**
+ * @brief Copy the subtree of token root to the start of dst, so it is the
+ * root of a pool of its own
+ */
+static int subtree_pool(jtok_tkn_t *dst, const jtok_tkn_t *src, int root,
+                        int count)
+{
+    int i;
+    for (i = root; i < count; i++)
+    {
+        jtok_tkn_t *tkn = &dst[i - root];
+        *tkn            = src[i];
+        tkn->pool       = dst;
+        tkn->parent -= (tkn->parent != NO_PARENT_IDX) ? root : 0;
+        tkn->sibling -= (tkn->sibling != NO_SIBLING_IDX) ? root : 0;
+        tkn->next -= root;
+    }
+    dst[0].parent = NO_PARENT_IDX;
+    return count - root;
+}
+
+
+/**
+ * @brief Objects and arrays compare equal by value, whatever the root of
+ * their pool
+ */
+static void test_toktokcmp(void)
+{
+    static const char one[]  = "{\"a\":{\"x\":1}}";
+    static const char two[]  = "{\"b\":{\"x\":1},\"c\":{\"x\":2}}";
+    static const char arrs[] = "{\"k\":[[1,2],[1,2],[1,3]]}";
+    jtok_tkn_t        t1[TEST_TKN_COUNT];
+    jtok_tkn_t        t2[TEST_TKN_COUNT];
+    jtok_tkn_t        t3[TEST_TKN_COUNT];
+    jtok_tkn_t        arr[TEST_TKN_COUNT];
+
+    jtok_parse_n(one, sizeof(one) - 1, t1, TEST_TKN_COUNT);
+    jtok_parse_n(two, sizeof(two) - 1, t2, TEST_TKN_COUNT);
+    expect("toktokcmp single key nested object with itself",
+           jtok_toktokcmp(&t1[2], &t1[2]));
+    expect("toktokcmp equal nested objects", jtok_toktokcmp(&t1[2], &t2[2]));
+    expect("toktokcmp different nested objects",
+           !jtok_toktokcmp(&t1[2], &t2[6]));
+
+    /* Arrays in a pool whose root is the outer array */
+    expect_status("toktokcmp array parse",
+                  jtok_parse_n(arrs, sizeof(arrs) - 1, t3, TEST_TKN_COUNT),
+                  JTOK_PARSE_STATUS_OK);
+    subtree_pool(arr, t3, 2, t3[0].next);
+    expect("toktokcmp equal arrays in array root",
+           jtok_toktokcmp(&arr[1], &arr[4]));
+    expect("toktokcmp different arrays in array root",
+           !jtok_toktokcmp(&arr[1], &arr[7]));
+    expect("toktokcmp array root with itself", jtok_toktokcmp(&arr[0], &arr[0]));
+}
+
+
+/**
+ * @brief The packed fields keep a token at two pointers and eight words
+ */
+static void test_token_size(void)
+{
+    expect("token size", sizeof(jtok_tkn_t) == 2 * sizeof(void *) + 32);
+}
+
+
+/**
+ * @brief Commands whose keys hash the same are both found, each by its own
+ * text
+ */
+static void test_phash_collision(void)
+{
+    static const char json[] = "{\"cmd0f74f8\":1,\"cmd075ae3\":2}";
+    static json_parse_ctx_t ctx;
+
+    expect("phash colliding keys hash the same",
+           jtok_hash_key("cmd075ae3", 9) == jtok_hash_key("cmd0f74f8", 9));
+    memset(ctx.value_holder, 0, sizeof(ctx.value_holder));
+    expect("phash colliding keys dispatch",
+           json_parse_ctx(&ctx, (const uint8_t *)json, sizeof(json) - 1) ==
+               0);
+    expect("phash colliding keys reach their own handlers",
+           strcmp(ctx.value_holder, "second;first;") == 0);
+}
+
+
+/**
+ * @brief Reference UTF-8 check (RFC 3629), one sequence at a time
+ */
+static bool utf8_valid(const unsigned char *s, size_t len)
+{
+    size_t i = 0;
+    while (i < len)
+    {
+        unsigned char c  = s[i];
+        size_t        n  = 0;
+        unsigned char lo = 0x80;
+        unsigned char hi = 0xBF;
+        if (c < 0x80)
+        {
+            i++;
+            continue;
+        }
+        else if (c >= 0xC2 && c <= 0xDF)
+        {
+            n = 2;
+        }
+        else if (c >= 0xE0 && c <= 0xEF)
+        {
+            n  = 3;
+            lo = (c == 0xE0) ? 0xA0 : 0x80;
+            hi = (c == 0xED) ? 0x9F : 0xBF;
+        }
+        else if (c >= 0xF0 && c <= 0xF4)
+        {
+            n  = 4;
+            lo = (c == 0xF0) ? 0x90 : 0x80;
+            hi = (c == 0xF4) ? 0x8F : 0xBF;
+        }
+        else
+        {
+            return false;
+        }
+
+        size_t k;
+        for (k = 1; k < n; k++)
+        {
+            if (i + k >= len || s[i + k] < lo || s[i + k] > hi)
+            {
+                return false;
+            }
+            lo = 0x80;
+            hi = 0xBF;
+        }
+        i += n;
+    }
+    return true;
+}
+
+
+/**
+ * @brief Parse {"k":"<body>"} and check the UTF-8 verdict against
+ * utf8_valid
+ */
+static void check_utf8_body(const char *what, const unsigned char *body,
+                            size_t n)
+{
+    char       json[512];
+    jtok_tkn_t tkns[TEST_TKN_COUNT];
+    memcpy(json, "{\"k\":\"", 6);
+    memcpy(&json[6], body, n);
+    memcpy(&json[6 + n], "\"}", 2);
+
+    JTOK_PARSE_STATUS_t want = utf8_valid(body, n)
+                                   ? JTOK_PARSE_STATUS_OK
+                                   : JTOK_PARSE_STATUS_INVALID_UTF8;
+    expect_status(what, jtok_parse_n(json, n + 8, tkns, TEST_TKN_COUNT),
+                  want);
+    expect_status(what, jtok_validate(json, n + 8), want);
+}
+
+
+/**
+ * @brief Good and bad sequences at every offset around the 16 and 32 byte
+ * blocks of the vector scanners, and random strings, agree with the
+ * reference. make test runs this with and without JTOK_NO_SIMD.
+ */
+static void test_utf8(void)
+{
+    static const char *const seqs[] = {
+        "\xC3\xA9",         "\xE2\x82\xAC",     "\xF0\x9F\x98\x80",
+        "\xF4\x8F\xBF\xBF", "\xC0\xAF",         "\xC1\xBF",
+        "\xE0\x80\xAF",     "\xED\xA0\x80",     "\xF0\x8F\xBF\xBF",
+        "\xF4\x90\x80\x80", "\xF5\x80\x80\x80", "\xFF",
+        "\x80",             "\xBF\xBF",         "\xC3",
+        "\xE2\x82",         "\xF0\x9F\x98",     "\xC3\xA9\xA9",
+        "\xE2\x28\xA1",     "\xF0\x28\x8C\xBC",
+    };
+    static const unsigned char alphabet[] = {
+        'a',  'z',  ' ',  0x80, 0x8F, 0x90, 0x9F, 0xA0, 0xBF, 0xC2,
+        0xC3, 0xDF, 0xE0, 0xE2, 0xED, 0xEF, 0xF0, 0xF4, 0xF5, 0xC0,
+    };
+    unsigned char body[160];
+    size_t        s;
+    int           at;
+    unsigned long seed  = 12345;
+    int           round = 0;
+
+    for (s = 0; s < sizeof(seqs) / sizeof(seqs[0]); s++)
+    {
+        size_t n = strlen(seqs[s]);
+        for (at = 0; at < 72; at++)
+        {
+            /* Non-ascii before and after keeps the vector path validating */
+            size_t len = 0;
+            memset(body, 'x', (size_t)at);
+            len = (size_t)at;
+            if (at >= 2)
+            {
+                memcpy(body, "\xC3\xA9", 2);
+            }
+            memcpy(&body[len], seqs[s], n);
+            len += n;
+            memcpy(&body[len], "\xE2\x82\xAC", 3);
+            len += 3;
+            memset(&body[len], 'y', 40);
+            len += 40;
+            check_utf8_body(seqs[s], body, len);
+        }
+    }
+
+    for (round = 0; round < 20000; round++)
+    {
+        /* Mostly good sequences, with a stray byte now and then */
+        size_t len = 0;
+        size_t n   = 40 + (size_t)(round % 100);
+        while (len + 4 <= n)
+        {
+            seed = seed * 6364136223846793005ul + 1442695040888963407ul;
+            unsigned long pick = (seed >> 33) % 64;
+            if (pick < 4)
+            {
+                body[len++] = alphabet[(seed >> 40) % sizeof(alphabet)];
+            }
+            else if (pick < 32)
+            {
+                body[len++] = 'a';
+            }
+            else
+            {
+                const char *seq = seqs[pick % 4];
+                memcpy(&body[len], seq, strlen(seq));
+                len += strlen(seq);
+            }
+        }
+        check_utf8_body("random utf8", body, len);
+    }
+}
+
+
+/**
+ * @brief A number fed a byte at a time decodes to the same value as one
+ * parsed in a single call
+ */
+static void test_feed_number(void)
+{
+    static const char *const cases[] = {
+        "{\"n\":18446744073709551615}", "{\"n\":-9223372036854775808}",
+        "{\"n\":123456789012345678901234}", "{\"n\":12345.678e-3}",
+        "{\"n\":1844674407370955161}",
+    };
+    jtok_tkn_t    whole[TEST_TKN_COUNT];
+    jtok_tkn_t    fed[TEST_TKN_COUNT];
+    jtok_value_t  whole_values[TEST_TKN_COUNT];
+    jtok_value_t  fed_values[TEST_TKN_COUNT];
+    jtok_frame_t  stack[TEST_STACK_DEPTH];
+    jtok_parser_t parser;
+    size_t        c;
+
+    for (c = 0; c < sizeof(cases) / sizeof(*cases); c++)
+    {
+        const char *        json = cases[c];
+        size_t              len  = strlen(json);
+        JTOK_PARSE_STATUS_t status = JTOK_PARSE_STATUS_PARTIAL_TOKEN;
+        size_t              i;
+
+        jtok_parser_init(&parser, whole, TEST_TKN_COUNT, stack,
+                         TEST_STACK_DEPTH);
+        jtok_parser_set_values(&parser, whole_values);
+        expect_status(json, jtok_parser_parse(&parser, json, len),
+                      JTOK_PARSE_STATUS_OK);
+
+        jtok_parser_init(&parser, fed, TEST_TKN_COUNT, stack,
+                         TEST_STACK_DEPTH);
+        jtok_parser_set_values(&parser, fed_values);
+        for (i = 0; i < len && status == JTOK_PARSE_STATUS_PARTIAL_TOKEN; i++)
+        {
+            status = jtok_parser_feed(&parser, json + i, 1);
+        }
+        expect_status(json, status, JTOK_PARSE_STATUS_OK);
+        expect(json, fed[2].value_type == whole[2].value_type &&
+                         memcmp(&fed_values[2], &whole_values[2],
+                                sizeof(jtok_value_t)) == 0);
+    }
+}
+
+
+static unsigned int test_rand(unsigned long *seed, unsigned int n)
+{
+    *seed = *seed * 6364136223846793005ul + 1442695040888963407ul;
+    return (unsigned int)(*seed >> 33) % n;
+}
+
+
+/* A byte that is part of a primitive (or garbage) for the indexer */
+static bool index_is_scalar(char c)
+{
+    return strchr("{}[]:, \t\r\n\"", c) == NULL;
+}
+
+
+/**
+ * @brief Reference for jtok_index_block and jtok_index_count, one byte at a
+ * time. Sets bit i of *bits (if i is in the first block) for each position
+ * the parser has to visit, and returns the number of tokens.
+ */
+static size_t index_reference(const char *json, size_t len, uint64_t *bits)
+{
+    bool   in_string = false;
+    bool   escaped   = false;
+    size_t count     = 0;
+    size_t i;
+
+    *bits = 0;
+    for (i = 0; i < len; i++)
+    {
+        char c     = json[i];
+        bool visit = false;
+        if (in_string)
+        {
+            if (escaped)
+            {
+                escaped = false;
+            }
+            else if (c == '\\')
+            {
+                escaped = true;
+            }
+            else if (c == '\"')
+            {
+                in_string = false;
+            }
+            continue;
+        }
+        if (c == '\"')
+        {
+            in_string = true;
+            visit     = true;
+            count++;
+        }
+        else if (strchr("{}[]:,", c) != NULL)
+        {
+            visit = true;
+            count += (c == '{' || c == '[');
+        }
+        else if (index_is_scalar(c) &&
+                 (i == 0 || !index_is_scalar(json[i - 1])))
+        {
+            visit = true;
+            count++;
+        }
+        if (visit && i < JTOK_INDEX_BLOCK_SIZE)
+        {
+            *bits |= (uint64_t)1 << i;
+        }
+    }
+    return count;
+}
+
+
+/**
+ * @brief The structural indexer agrees with a byte at a time reference on
+ * random streams whose strings, escapes and primitives straddle the 64 byte
+ * blocks. make test runs this with and without JTOK_NO_SIMD.
+ */
+static void test_index(void)
+{
+    static const char *const pieces[] = {
+        "{", "}", "[", "]", ":", ",", " ", "\n\t ", "12", "-3.5e7", "true",
+        "null", "\"k\"", "\"a\\\"b\"", "\"\\\\\"", "\"\\\\\\\"x\"",
+        "\"{[:,]} \\n\"", "\"a long string body that runs past a block\"",
+    };
+    char          json[400];
+    size_t        starts[64];
+    unsigned long seed = 99;
+    int           round;
+
+    for (round = 0; round < 5000; round++)
+    {
+        size_t len     = 0;
+        size_t npieces = 0;
+        size_t target  = 1 + (size_t)test_rand(&seed, 300);
+        size_t i;
+
+        while (len < target && npieces < 64)
+        {
+            const char *piece =
+                pieces[test_rand(&seed, sizeof(pieces) / sizeof(*pieces))];
+            starts[npieces++] = len;
+            memcpy(&json[len], piece, strlen(piece));
+            len += strlen(piece);
+        }
+
+        uint64_t want_bits;
+        size_t   want = index_reference(json, len, &want_bits);
+        if (jtok_index_count(json, len) != want)
+        {
+            printf("FAIL index count of %.*s\n", (int)len, json);
+            failures++;
+        }
+
+        /* Blocks are only ever anchored outside of a string */
+        for (i = 0; i < npieces; i++)
+        {
+            size_t n = len - starts[i];
+            n        = (n > JTOK_INDEX_BLOCK_SIZE) ? JTOK_INDEX_BLOCK_SIZE : n;
+            index_reference(&json[starts[i]], n, &want_bits);
+            if (jtok_index_block(&json[starts[i]], (unsigned int)n) !=
+                want_bits)
+            {
+                printf("FAIL index block of %.*s\n", (int)n, &json[starts[i]]);
+                failures++;
+            }
+        }
+    }
+}
+
+
+/**
+ * @brief String ends, escapes and bad bytes are found at every offset
+ * around the 16 and 32 byte blocks the string scanner skips
+ */
+static void test_string_scan(void)
+{
+    static const struct
+    {
+        const char *        name;
+        const char *        body; /* put after at filler bytes */
+        size_t              len;
+        int                 extra; /* token length past the filler */
+        JTOK_PARSE_STATUS_t status;
+    } cases[] = {
+        {"string end", "", 0, 0, JTOK_PARSE_STATUS_OK},
+        {"escaped quote", "\\\"bb", 4, 4, JTOK_PARSE_STATUS_OK},
+        {"escaped backslash", "\\\\", 2, 2, JTOK_PARSE_STATUS_OK},
+        {"unicode escape", "\\u00e9b", 7, 7, JTOK_PARSE_STATUS_OK},
+        {"control byte", "\x01" "b", 2, 2, JTOK_PARSE_STATUS_OK},
+        {"bad escape", "\\qb", 3, 0, JTOK_PARSE_STATUS_INVAL},
+        {"nul", "\0b", 2, 0, JTOK_PARSE_STATUS_INVAL},
+    };
+    char       json[128];
+    jtok_tkn_t tkns[TEST_TKN_COUNT];
+    size_t     c;
+    int        at;
+
+    for (c = 0; c < sizeof(cases) / sizeof(*cases); c++)
+    {
+        for (at = 0; at < 72; at++)
+        {
+            size_t len = 0;
+            memcpy(json, "{\"k\":\"", 6);
+            len = 6;
+            memset(&json[len], 'a', (size_t)at);
+            len += (size_t)at;
+            memcpy(&json[len], cases[c].body, cases[c].len);
+            len += cases[c].len;
+            memcpy(&json[len], "\"}", 2);
+            len += 2;
+
+            JTOK_PARSE_STATUS_t status =
+                jtok_parse_n(json, len, tkns, TEST_TKN_COUNT);
+            if (status != cases[c].status ||
+                (status == JTOK_PARSE_STATUS_OK &&
+                 tkns[2].end - tkns[2].start != at + cases[c].extra))
+            {
+                printf("FAIL string scan %s at %d: status %d\n", cases[c].name,
+                       at, (int)status);
+                failures++;
+            }
+
+            /* Cut off inside the string, so it never ends */
+            expect_status(cases[c].name, jtok_parse_n(json, 6 + (size_t)at,
+                                                      tkns, TEST_TKN_COUNT),
+                          JTOK_PARSE_STATUS_PARTIAL_TOKEN);
+        }
+    }
+}
+
+
+/**
+ * @brief Nothing at or past json[len] is looked at, so json can be parsed
+ * straight out of a bigger buffer
+ */
+static void test_parse_n_length(void)
+{
+    static const char two[] = "{\"ping\":1}{\"fail\":1}";
+    static const char num[] = "{\"a\":12}";
+    jtok_tkn_t        tkns[TEST_TKN_COUNT];
+    char *            exact = malloc(sizeof(num) - 1);
+
+    if (exact == NULL)
+    {
+        printf("FAIL parse_n length: no memory\n");
+        failures++;
+        return;
+    }
+    memcpy(exact, num, sizeof(num) - 1);
+    expect_status("parse_n without nul",
+                  jtok_parse_n(exact, sizeof(num) - 1, tkns, TEST_TKN_COUNT),
+                  JTOK_PARSE_STATUS_OK);
+    expect("parse_n without nul value", tkns[2].end - tkns[2].start == 2);
+    free(exact);
+
+    /* The number is cut short by len, not by what follows it */
+    expect("parse_n cut number",
+           jtok_parse_n(num, 6, tkns, TEST_TKN_COUNT) != JTOK_PARSE_STATUS_OK);
+
+    expect_status("parse_n first of two",
+                  jtok_parse_n(two, 10, tkns, TEST_TKN_COUNT),
+                  JTOK_PARSE_STATUS_OK);
+    default_ctx.value_holder[0] = '\0';
+    expect("json_parse_n first of two",
+           json_parse_n((const uint8_t *)two, 10) == 0 &&
+               strcmp(default_ctx.value_holder, "ping;") == 0);
+}
+
+
+/* Documents the pool and tape checks run over, valid and not */
+static const char *const test_docs[] = {
+    "{}",
+    "{\"a\":1}",
+    "{\"a\":{},\"b\":[]}",
+    "{\"s\":\"x\\\"y\",\"n\":-1.5e3,\"t\":true,\"f\":false,\"z\":null}",
+    "{\"a\":[1,2,3],\"b\":[\"x\",\"y\"],\"c\":[{\"d\":[[1],[2,3]]}]}",
+    "{\"deep\":{\"er\":{\"est\":[{\"k\":\"v\"},{\"k\":\"w\"}]}},\"after\":2}",
+    " {\n  \"pretty\" : [ 1 , 2 ] ,\n  \"x\" : { \"y\" : \"z\" }\n}\n",
+    "{\"a\":[1,\"mixed\"]}",
+    "{\"a\":1,}",
+    "{\"a\" 1}",
+    "[1,2]",
+    "{\"a\":[1,2}",
+};
+
+
+/**
+ * @brief The tape holds the same tokens as the token pool, and fails the
+ * same way
+ */
+static void test_tape(void)
+{
+    jtok_tkn_t      tkns[TEST_TKN_COUNT];
+    jtok_tape_tkn_t tape_tkns[TEST_TKN_COUNT];
+    jtok_frame_t    stack[TEST_STACK_DEPTH];
+    jtok_parser_t   parser;
+    size_t          d;
+
+    for (d = 0; d < sizeof(test_docs) / sizeof(*test_docs); d++)
+    {
+        const char *        json = test_docs[d];
+        jtok_tape_t         tape = {NULL, tape_tkns, TEST_TKN_COUNT, 0};
+        JTOK_PARSE_STATUS_t status;
+        int                 i;
+
+        jtok_parser_init(&parser, tkns, TEST_TKN_COUNT, stack,
+                         TEST_STACK_DEPTH);
+        status = jtok_parser_parse(&parser, json, strlen(json));
+        expect_status(json, jtok_tape_parse(&tape, json, strlen(json)),
+                      status);
+        if (status != JTOK_PARSE_STATUS_OK)
+        {
+            continue;
+        }
+        expect(json, tape.count == (size_t)parser.toknext);
+        for (i = 0; i < parser.toknext && (size_t)i < tape.count; i++)
+        {
+            jtok_tkn_t tkn = jtok_tape_tkn(&tape, i);
+            if (tkn.type != tkns[i].type || tkn.start != tkns[i].start ||
+                tkn.end != tkns[i].end || tkn.size != tkns[i].size ||
+                jtok_tape_parent(&tape, i) != tkns[i].parent ||
+                jtok_tape_sibling(&tape, i) != tkns[i].sibling ||
+                jtok_tape_next(&tape, i) != tkns[i].next)
+            {
+                printf("FAIL tape token %d of %s\n", i, json);
+                failures++;
+            }
+        }
+    }
+}
+
+
+/**
+ * @brief Write an object holding depth - 1 nested arrays or objects, so the
+ * json nests depth deep counting the top-level object
+ */
+static size_t nested_json(char *json, int depth, bool objects)
+{
+    size_t len = 0;
+    int    i;
+
+    for (i = 0; i < depth; i++)
+    {
+        const char *open = (objects || i == 0) ? "{\"a\":" : "[";
+        memcpy(&json[len], open, strlen(open));
+        len += strlen(open);
+    }
+    json[len++] = '1';
+    for (i = depth - 1; i >= 0; i--)
+    {
+        json[len++] = (objects || i == 0) ? '}' : ']';
+    }
+    return len;
+}
+
+
+/**
+ * @brief Nesting is limited by the stack handed to the parser, not by the C
+ * stack, so even absurdly deep json fails cleanly
+ */
+static void test_nesting(void)
+{
+    const int     deep = 100000;
+    char *        json = malloc((size_t)deep * 6 + 16);
+    jtok_tkn_t *  tkns = malloc(2 * (size_t)deep * sizeof(*tkns));
+    jtok_frame_t  stack[TEST_STACK_DEPTH];
+    jtok_parser_t parser;
+    int           objects;
+
+    if (json == NULL || tkns == NULL)
+    {
+        printf("FAIL nesting: no memory\n");
+        failures++;
+        free(json);
+        free(tkns);
+        return;
+    }
+    for (objects = 0; objects < 2; objects++)
+    {
+        const char *what = objects ? "nested objects" : "nested arrays";
+        size_t      len  = nested_json(json, JTOK_MAX_RECURSE_DEPTH + 1,
+                                       objects);
+        expect_status(what, jtok_parse_n(json, len, tkns, 2 * (size_t)deep),
+                      JTOK_PARSE_STATUS_OK);
+        expect_status(what, jtok_validate(json, len), JTOK_PARSE_STATUS_OK);
+
+        len = nested_json(json, JTOK_MAX_RECURSE_DEPTH + 2, objects);
+        expect_status(what, jtok_parse_n(json, len, tkns, 2 * (size_t)deep),
+                      JTOK_PARSE_STATUS_NEST_DEPTH_EXCEEDED);
+        expect_status(what, jtok_validate(json, len),
+                      JTOK_PARSE_STATUS_NEST_DEPTH_EXCEEDED);
+
+        len = nested_json(json, deep, objects);
+        expect_status(what, jtok_parse_n(json, len, tkns, 2 * (size_t)deep),
+                      JTOK_PARSE_STATUS_NEST_DEPTH_EXCEEDED);
+        expect_status(what, jtok_validate(json, len),
+                      JTOK_PARSE_STATUS_NEST_DEPTH_EXCEEDED);
+
+        /* A caller's stack sets the limit */
+        len = nested_json(json, TEST_STACK_DEPTH, objects);
+        jtok_parser_init(&parser, tkns, 2 * (size_t)deep, stack,
+                         TEST_STACK_DEPTH);
+        expect_status(what, jtok_parser_parse(&parser, json, len),
+                      JTOK_PARSE_STATUS_OK);
+        len = nested_json(json, TEST_STACK_DEPTH + 1, objects);
+        jtok_parser_init(&parser, tkns, 2 * (size_t)deep, stack,
+                         TEST_STACK_DEPTH);
+        expect_status(what, jtok_parser_parse(&parser, json, len),
+                      JTOK_PARSE_STATUS_NEST_DEPTH_EXCEEDED);
+    }
+    free(json);
+    free(tkns);
+}
+
+
+typedef struct
+{
+    int calls; /* times the pool was grown */
+    int fail;  /* fail from this call on, 0 for never */
+} test_alloc_t;
+
+
+static void *test_realloc(void *ctx, void *ptr, size_t size)
+{
+    test_alloc_t *alloc = ctx;
+    alloc->calls++;
+    if (alloc->fail != 0 && alloc->calls >= alloc->fail)
+    {
+        return NULL;
+    }
+    return realloc(ptr, size);
+}
+
+
+/**
+ * @brief Counting mode counts what a full parse would produce, and a pool
+ * grown with realloc_fn ends up holding the same tokens as a big fixed pool
+ */
+static void test_pool_growth(void)
+{
+    char          json[4096];
+    size_t        len = 0;
+    jtok_tkn_t    fixed[512];
+    jtok_frame_t  stack[TEST_STACK_DEPTH];
+    jtok_parser_t parser;
+    test_alloc_t  alloc = {0, 0};
+    size_t        d;
+    int           i;
+
+    for (d = 0; d < sizeof(test_docs) / sizeof(*test_docs); d++)
+    {
+        const char *doc = test_docs[d];
+        jtok_parser_init(&parser, fixed, 512, stack, TEST_STACK_DEPTH);
+        if (jtok_parser_parse(&parser, doc, strlen(doc)) ==
+            JTOK_PARSE_STATUS_OK)
+        {
+            int want = parser.toknext;
+            jtok_parser_init(&parser, NULL, 0, stack, TEST_STACK_DEPTH);
+            expect_status(doc, jtok_parser_parse(&parser, doc, strlen(doc)),
+                          JTOK_PARSE_STATUS_OK);
+            expect(doc, parser.toknext == want);
+        }
+    }
+
+    for (i = 0; i < 150; i++)
+    {
+        len += (size_t)sprintf(&json[len], "%s\"k%d\":[%d]", i ? "," : "{",
+                               i, i);
+    }
+    json[len++] = '}';
+    jtok_parser_init(&parser, fixed, 512, stack, TEST_STACK_DEPTH);
+    expect_status("grow fixed pool", jtok_parser_parse(&parser, json, len),
+                  JTOK_PARSE_STATUS_OK);
+
+    /* From a pool of 4, decoding values into an array that grows with it */
+    jtok_parser_init(&parser, realloc(NULL, 4 * sizeof(jtok_tkn_t)), 4, stack,
+                     TEST_STACK_DEPTH);
+    jtok_parser_set_allocator(&parser, test_realloc, &alloc);
+    jtok_parser_set_values(&parser, realloc(NULL, 4 * sizeof(jtok_value_t)));
+    expect_status("grow pool", jtok_parser_parse(&parser, json, len),
+                  JTOK_PARSE_STATUS_OK);
+    expect("grow pool calls", alloc.calls > 1);
+    expect("grow pool size", parser.pool_size >= (size_t)parser.toknext &&
+                                 parser.toknext == 1 + 150 * 3);
+    for (i = 0; i < parser.toknext; i++)
+    {
+        const jtok_tkn_t *tkn = &parser.tkn_pool[i];
+        if (tkn->pool != parser.tkn_pool || tkn->type != fixed[i].type ||
+            tkn->start != fixed[i].start || tkn->end != fixed[i].end ||
+            tkn->parent != fixed[i].parent || tkn->sibling != fixed[i].sibling)
+        {
+            printf("FAIL grow pool token %d\n", i);
+            failures++;
+            break;
+        }
+    }
+    for (i = 0; i < 150; i++)
+    {
+        if (parser.values[3 + 3 * i].u != (uint64_t)i)
+        {
+            printf("FAIL grow pool value %d\n", i);
+            failures++;
+            break;
+        }
+    }
+    free(parser.tkn_pool);
+    free(parser.values);
+
+    /* A failed growth is reported, and the pool so far is not lost */
+    alloc.calls = 0;
+    alloc.fail  = 3;
+    jtok_parser_init(&parser, NULL, 0, stack, TEST_STACK_DEPTH);
+    jtok_parser_set_allocator(&parser, test_realloc, &alloc);
+    expect_status("grow pool failure", jtok_parser_parse(&parser, json, len),
+                  JTOK_PARSE_STATUS_NOMEM);
+    free(parser.tkn_pool);
+}
+
+
+/**
+ * @brief Primitives get their value type while tokenized, and the value
+ * recorded by the parser is the one decoded from the json afterwards
+ */
+static void test_value_types(void)
+{
+    static const char json[] = "{\"u\":18446744073709551615,\"i\":-42,"
+                               "\"d\":2.5e-3,\"t\":true,\"f\":false,"
+                               "\"z\":null,\"e\":\"\",\"s\":\"x\"}";
+    static const struct
+    {
+        JTOK_VALUE_TYPE_t type;
+        jtok_value_t      value;
+    } want[] = {
+        {JTOK_VALUE_TYPE_uint, {.u = UINT64_MAX}},
+        {JTOK_VALUE_TYPE_int, {.i = -42}},
+        {JTOK_VALUE_TYPE_real, {.d = 2.5e-3}},
+        {JTOK_VALUE_TYPE_boolean, {.b = true}},
+        {JTOK_VALUE_TYPE_boolean, {.b = false}},
+        {JTOK_VALUE_TYPE_null, {.u = 0}},
+        {JTOK_VALUE_TYPE_empty, {.u = 0}},
+        {JTOK_VALUE_TYPE_str, {.u = 0}},
+    };
+    jtok_tkn_t    tkns[TEST_TKN_COUNT];
+    jtok_value_t  values[TEST_TKN_COUNT];
+    jtok_frame_t  stack[TEST_STACK_DEPTH];
+    jtok_parser_t parser;
+    size_t        k;
+
+    jtok_parser_init(&parser, tkns, TEST_TKN_COUNT, stack, TEST_STACK_DEPTH);
+    jtok_parser_set_values(&parser, values);
+    expect_status("value types", jtok_parser_parse(&parser, json, strlen(json)),
+                  JTOK_PARSE_STATUS_OK);
+    for (k = 0; k < sizeof(want) / sizeof(*want); k++)
+    {
+        const jtok_tkn_t *tkn = &tkns[2 + 2 * k];
+        jtok_value_t      recorded;
+        jtok_value_t      decoded;
+        bool              same = true;
+
+        /* Strings have a value type, but no value to decode */
+        JTOK_VALUE_TYPE_t type = jtok_tok_value(tkn, values, &recorded);
+        expect("value type",
+               tkn->value_type == want[k].type &&
+                   type == (tkn->type == JTOK_PRIMITIVE
+                                ? want[k].type
+                                : JTOK_VALUE_TYPE_not_a_value_tkn) &&
+                   jtok_tok_value(tkn, NULL, &decoded) == type);
+        switch (type)
+        {
+            case JTOK_VALUE_TYPE_uint:
+                same = recorded.u == want[k].value.u &&
+                       decoded.u == want[k].value.u;
+                break;
+            case JTOK_VALUE_TYPE_int:
+                same = recorded.i == want[k].value.i &&
+                       decoded.i == want[k].value.i;
+                break;
+            case JTOK_VALUE_TYPE_real:
+                same = recorded.d == want[k].value.d &&
+                       decoded.d == want[k].value.d;
+                break;
+            case JTOK_VALUE_TYPE_boolean:
+                same = recorded.b == want[k].value.b &&
+                       decoded.b == want[k].value.b;
+                break;
+            default:
+                break;
+        }
+        if (!same)
+        {
+            printf("FAIL value of key %zu\n", k);
+            failures++;
+        }
+    }
+}
+
+
+static void check_atod(const char *str)
+{
+    double got  = 0;
+    double want = strtod(str, NULL);
+    if (!jtok_atod(str, (int)strlen(str), &got) ||
+        memcmp(&got, &want, sizeof(got)) != 0)
+    {
+        printf("FAIL atod %s: got %.17g, want %.17g\n", str, got, want);
+        failures++;
+    }
+}
+
+
+/**
+ * @brief jtok_atod rounds like strtod on halfway cases, subnormals, the ends
+ * of the double range and long mantissas
+ */
+static void test_atod(void)
+{
+    static const char *const hard[] = {
+        "0", "-0", "0.1", "1e23", "9007199254740993", "9007199254740992.5",
+        "2.2250738585072011e-308", "2.2250738585072012e-308",
+        "4.9406564584124654e-324", "2.4703282292062327e-324",
+        "2.4703282292062328e-324", "1.7976931348623157e308",
+        "1.7976931348623158e308", "1.7976931348623159e308", "1e-400",
+        "-1e400", "8.98846567431158e307", "123456789012345678901234567890",
+        "0.000000000000000000000000000001e30",
+        "1.00000000000000011102230246251565404236316680908203125",
+        "1.00000000000000011102230246251565404236316680908203124",
+        "1.00000000000000011102230246251565404236316680908203126",
+        "7.2057594037927933e16", "3.0517578125e-5", "1E+2", "1e-2",
+    };
+    static const char *const bad[] = {"", "-", "1e", "1e+", "0x10", "1..2",
+                                      "nan", "inf"};
+    char          str[64];
+    unsigned long seed = 7;
+    double        value;
+    size_t        i;
+    int           round;
+
+    for (i = 0; i < sizeof(hard) / sizeof(*hard); i++)
+    {
+        check_atod(hard[i]);
+    }
+    for (round = 0; round < 20000; round++)
+    {
+        /* 1 to 20 digits with a decimal point somewhere and any exponent */
+        unsigned int digits = 1 + test_rand(&seed, 20);
+        unsigned int point  = test_rand(&seed, digits);
+        size_t       len    = 0;
+        for (i = 0; i < digits; i++)
+        {
+            if (i == point && i != 0)
+            {
+                str[len++] = '.';
+            }
+            str[len++] = (char)('0' + test_rand(&seed, 10));
+        }
+        sprintf(&str[len], "e%d", (int)test_rand(&seed, 700) - 350);
+        check_atod(str);
+    }
+    for (i = 0; i < sizeof(bad) / sizeof(*bad); i++)
+    {
+        expect(bad[i], !jtok_atod(bad[i], (int)strlen(bad[i]), &value));
+    }
+}
+
+
+/**
+ * @brief Each transition of the object and array state machines gives the
+ * status and error position the switch-based loops before the tables gave
+ */
+static void test_state_machines(void)
+{
+    static const struct
+    {
+        const char *        json;
+        JTOK_PARSE_STATUS_t status;
+        int                 pos; /* parser position after the parse */
+    } cases[] = {
+        {"{\"a\":1,}", JTOK_PARSE_STATUS_OK, 7},
+        {"{,\"a\":1}", JTOK_PARSE_STATUS_OBJ_NOKEY, 1},
+        {"{\"a\" 1}", JTOK_PARSE_STATUS_KEY_NO_VAL, 0},
+        {"{\"a\":1 \"b\":2}", JTOK_PARSE_STATUS_VAL_NO_COMMA, 7},
+        {"{\"a\":1:2}", JTOK_PARSE_STATUS_INVALID_PRIMITIVE, 5},
+        {"{1:2}", JTOK_PARSE_STATUS_KEY_NO_VAL, 0},
+        {"{\"a\":[1 2]}", JTOK_PARSE_STATUS_STRAY_COMMA, 8},
+        {"{\"a\":[1,,2]}", JTOK_PARSE_STATUS_STRAY_COMMA, 8},
+        {"{\"a\":[1,]}", JTOK_PARSE_STATUS_ARRAY_SEPARATOR, 8},
+        {"{\"a\":[,1]}", JTOK_PARSE_STATUS_STRAY_COMMA, 6},
+        {"{\"a\":[1,\"x\"]}", JTOK_STATUS_MIXED_ARRAY, 8},
+        {"{\"a\"}", JTOK_PARSE_STATUS_KEY_NO_VAL, 4},
+        {"{\"a\":}", JTOK_PARSE_STATUS_KEY_NO_VAL, 5},
+        {"{{}}", JTOK_PARSE_STATUS_OBJ_NOKEY, 1},
+        {"{\"a\":1]", JTOK_PARSE_STATUS_INVAL, 0},
+        {"{\"a\":[1}", JTOK_PARSE_STATUS_INVAL, 5},
+        {"{\"\":1}", JTOK_PARSE_STATUS_EMPTY_KEY, 2},
+        {"{\"a\":[[1],[2]],\"b\":{\"c\":[]}}", JTOK_PARSE_STATUS_OK, 27},
+        {"{\"a\":tru}", JTOK_PARSE_STATUS_INVALID_PRIMITIVE, 5},
+        {"{\"a\":[true,false,null]}", JTOK_PARSE_STATUS_OK, 22},
+        {"{\"a\":[{},{}]}", JTOK_PARSE_STATUS_OK, 12},
+        {"{\"a\":[{},[]]}", JTOK_STATUS_MIXED_ARRAY, 9},
+        {"{\"a\":1}}", JTOK_PARSE_STATUS_OK, 6},
+        {"{} ", JTOK_PARSE_STATUS_OK, 1},
+        {"{}x", JTOK_PARSE_STATUS_OK, 1},
+        {"{\"a\":{\"b\":1,}}", JTOK_PARSE_STATUS_OK, 13},
+        {"{\"a\":[\"x\",1]}", JTOK_STATUS_MIXED_ARRAY, 10},
+        {"{\"a\":[[1],2]}", JTOK_STATUS_MIXED_ARRAY, 10},
+        {"{\"a\":{}]", JTOK_PARSE_STATUS_INVAL, 0},
+        {"{\"a\":[]}", JTOK_PARSE_STATUS_OK, 7},
+        {"{\"a\":x}", JTOK_PARSE_STATUS_INVAL, 0},
+        {"{\"a\"::1}", JTOK_PARSE_STATUS_INVAL, 0},
+        {"{\"a\":1,\"b\"}", JTOK_PARSE_STATUS_KEY_NO_VAL, 10},
+    };
+    jtok_tkn_t    tkns[TEST_TKN_COUNT];
+    jtok_frame_t  stack[TEST_STACK_DEPTH];
+    jtok_parser_t parser;
+    size_t        i;
+
+    for (i = 0; i < sizeof(cases) / sizeof(*cases); i++)
+    {
+        jtok_parser_init(&parser, tkns, TEST_TKN_COUNT, stack,
+                         TEST_STACK_DEPTH);
+        expect_status(cases[i].json,
+                      jtok_parser_parse(&parser, cases[i].json,
+                                        strlen(cases[i].json)),
+                      cases[i].status);
+        if (parser.pos != cases[i].pos)
+        {
+            printf("FAIL %s: stopped at %d, want %d\n", cases[i].json,
+                   parser.pos, cases[i].pos);
+            failures++;
+        }
+    }
+}
+
+
+/**
+ * @brief jtok_parse_many finds newline delimited and concatenated documents,
+ * and picks up again on the next line after a bad one
+ */
+static void test_parse_many(void)
+{
+    static const char json[] = "{\"a\":1}\n{\"b\":[1,2]}{\"c\":{}}  \r\n\n"
+                               "{\"bad\":} {\"skipped\":1}\n"
+                               "\t{\"d\":\"x\"}\n{\"cut\":";
+    static const struct
+    {
+        const char *        text; /* the document starts here */
+        size_t              len;  /* and is this long */
+        JTOK_PARSE_STATUS_t status;
+        int                 count; /* tokens of a good document */
+    } want[] = {
+        {"{\"a\":1}", 7, JTOK_PARSE_STATUS_OK, 3},
+        {"{\"b\":[1,2]}", 11, JTOK_PARSE_STATUS_OK, 5},
+        {"{\"c\":{}}", 8, JTOK_PARSE_STATUS_OK, 3},
+        {"{\"bad\":}", 22, JTOK_PARSE_STATUS_KEY_NO_VAL, 0},
+        {"{\"d\":\"x\"}", 9, JTOK_PARSE_STATUS_OK, 3},
+        {"{\"cut\":", 7, JTOK_PARSE_STATUS_PARTIAL_TOKEN, 0},
+    };
+    jtok_tkn_t    tkns[TEST_TKN_COUNT];
+    jtok_frame_t  stack[TEST_STACK_DEPTH];
+    jtok_parser_t parser;
+    jtok_doc_t    doc;
+    size_t        offset = 0;
+    size_t        d      = 0;
+
+    jtok_parser_init(&parser, tkns, TEST_TKN_COUNT, stack, TEST_STACK_DEPTH);
+    while (jtok_parse_many(&parser, json, sizeof(json) - 1, &offset, &doc))
+    {
+        size_t start;
+        if (d >= sizeof(want) / sizeof(*want))
+        {
+            printf("FAIL parse_many: extra document at %zu\n", doc.start);
+            failures++;
+            break;
+        }
+        start = (size_t)(strstr(json, want[d].text) - json);
+        expect_status(want[d].text, doc.status, want[d].status);
+        if (doc.start != start || doc.end != start + want[d].len ||
+            offset != doc.end)
+        {
+            printf("FAIL parse_many %s: at %zu-%zu\n", want[d].text,
+                   doc.start, doc.end);
+            failures++;
+        }
+        if (doc.status == JTOK_PARSE_STATUS_OK &&
+            (parser.toknext != want[d].count ||
+             tkns[0].start != (int)start ||
+             tkns[0].end != (int)(start + want[d].len)))
+        {
+            printf("FAIL parse_many %s tokens\n", want[d].text);
+            failures++;
+        }
+        d++;
+    }
+    expect("parse_many document count", d == sizeof(want) / sizeof(*want));
+    expect("parse_many offset at end", offset == sizeof(json) - 1);
+}
+
+
+/**
+ * @brief jtok_validate gives the status of jtok_parse_n with a big enough
+ * pool, on the test documents and on random mutations of them
+ */
+static void test_validate(void)
+{
+    static const char mutations[] = "{}[]:,\"\\ 1-.eEtfn\x80";
+    jtok_tkn_t        tkns[256];
+    char              json[256];
+    unsigned long     seed = 3;
+    int               round;
+
+    for (round = 0; round < 20000; round++)
+    {
+        const char *doc =
+            test_docs[test_rand(&seed, sizeof(test_docs) / sizeof(*test_docs))];
+        size_t len = strlen(doc);
+        int    edits;
+
+        memcpy(json, doc, len);
+        for (edits = test_rand(&seed, 3); edits > 0 && len > 0; edits--)
+        {
+            size_t at = test_rand(&seed, (unsigned int)len);
+            switch (test_rand(&seed, 3))
+            {
+                case 0: /* replace */
+                    json[at] = mutations[test_rand(&seed,
+                                                   sizeof(mutations) - 1)];
+                    break;
+                case 1: /* delete */
+                    memmove(&json[at], &json[at + 1], len - at - 1);
+                    len--;
+                    break;
+                default: /* cut off */
+                    len = at;
+                    break;
+            }
+        }
+
+        JTOK_PARSE_STATUS_t want = jtok_parse_n(json, len, tkns, 256);
+        JTOK_PARSE_STATUS_t got  = jtok_validate(json, len);
+        if (got != want)
+        {
+            printf("FAIL validate %.*s: got %d, want %d\n", (int)len, json,
+                   (int)got, (int)want);
+            failures++;
+        }
+    }
+
+    /* No pool to run out of, however many tokens */
+    char * big = malloc(20000);
+    size_t len = 0;
+    int    i;
+    if (big != NULL)
+    {
+        len += (size_t)sprintf(big, "{\"a\":[0");
+        for (i = 1; i < 5000; i++)
+        {
+            big[len++] = ',';
+            big[len++] = '1';
+        }
+        len += (size_t)sprintf(&big[len], "]}");
+        expect_status("validate many tokens", jtok_validate(big, len),
+                      JTOK_PARSE_STATUS_OK);
+        expect_status("parse many tokens", jtok_parse_n(big, len, tkns, 256),
+                      JTOK_PARSE_STATUS_NOMEM);
+        free(big);
+    }
+}
+
+
+/**
+ * @brief UTF-8 is checked in keys, on the tape and across feed chunks, not
+ * only in values parsed in one go
+ */
+static void test_utf8_paths(void)
+{
+    static const char good[] =
+        "{\"k\xC3\xA9\":\"\xF0\x9F\x98\x80\xE2\x82\xAC\"}";
+    static const char bad[]  = "{\"k\":\"\xF0\x9F\x28\x80\"}";
+    static const char key[]  = "{\"\xED\xA0\x80\":1}";
+    jtok_tkn_t        tkns[TEST_TKN_COUNT];
+    jtok_tape_tkn_t   tape_tkns[TEST_TKN_COUNT];
+    jtok_tape_t       tape = {NULL, tape_tkns, TEST_TKN_COUNT, 0};
+    jtok_frame_t      stack[TEST_STACK_DEPTH];
+    jtok_parser_t     parser;
+    size_t            split;
+
+    expect_status("utf8 bad key",
+                  jtok_parse_n(key, sizeof(key) - 1, tkns, TEST_TKN_COUNT),
+                  JTOK_PARSE_STATUS_INVALID_UTF8);
+    expect_status("utf8 bad key tape",
+                  jtok_tape_parse(&tape, key, sizeof(key) - 1),
+                  JTOK_PARSE_STATUS_INVALID_UTF8);
+    expect_status("utf8 bad tape", jtok_tape_parse(&tape, bad, sizeof(bad) - 1),
+                  JTOK_PARSE_STATUS_INVALID_UTF8);
+    expect_status("utf8 good tape",
+                  jtok_tape_parse(&tape, good, sizeof(good) - 1),
+                  JTOK_PARSE_STATUS_OK);
+
+    /* Every split, including inside a sequence */
+    for (split = 1; split < sizeof(good) - 1; split++)
+    {
+        jtok_parser_init(&parser, tkns, TEST_TKN_COUNT, stack,
+                         TEST_STACK_DEPTH);
+        jtok_parser_feed(&parser, good, split);
+        expect_status("utf8 good fed in two",
+                      jtok_parser_feed(&parser, good + split,
+                                       sizeof(good) - 1 - split),
+                      JTOK_PARSE_STATUS_OK);
+    }
+    for (split = 1; split < sizeof(bad) - 1; split++)
+    {
+        JTOK_PARSE_STATUS_t status;
+        jtok_parser_init(&parser, tkns, TEST_TKN_COUNT, stack,
+                         TEST_STACK_DEPTH);
+        status = jtok_parser_feed(&parser, bad, split);
+        if (status == JTOK_PARSE_STATUS_PARTIAL_TOKEN)
+        {
+            status = jtok_parser_feed(&parser, bad + split,
+                                      sizeof(bad) - 1 - split);
+        }
+        expect_status("utf8 bad fed in two", status,
+                      JTOK_PARSE_STATUS_INVALID_UTF8);
+    }
+}
+
+
+/**
+ * @brief String tokens say whether they hold escapes or only ascii, whichever
+ * scanner (vector or scalar) went over them
+ */
+static void test_string_flags(void)
+{
+    static const struct
+    {
+        const char * text;
+        unsigned int flags;
+    } cases[] = {
+        {"plain", JTOK_TKN_FLAG_ASCII},
+        {"a\\nb", JTOK_TKN_FLAG_ASCII | JTOK_TKN_FLAG_ESCAPED},
+        {"\\u00e9", JTOK_TKN_FLAG_ASCII | JTOK_TKN_FLAG_ESCAPED},
+        {"\xC3\xA9", 0},
+        {"\xC3\xA9\\t", JTOK_TKN_FLAG_ESCAPED},
+        {"a long ascii string well past one vector block of 32",
+         JTOK_TKN_FLAG_ASCII},
+        {"a long string well past one vector block, then \xE2\x82\xAC", 0},
+        {"a long string well past one vector block, then \\\" ",
+         JTOK_TKN_FLAG_ASCII | JTOK_TKN_FLAG_ESCAPED},
+    };
+    const unsigned int mask = JTOK_TKN_FLAG_ASCII | JTOK_TKN_FLAG_ESCAPED;
+    char               json[128];
+    jtok_tkn_t         tkns[TEST_TKN_COUNT];
+    size_t             c;
+
+    for (c = 0; c < sizeof(cases) / sizeof(*cases); c++)
+    {
+        /* Once as a key and once as a value */
+        int len = snprintf(json, sizeof(json), "{\"%s\":\"%s\"}",
+                           cases[c].text, cases[c].text);
+        expect_status(cases[c].text,
+                      jtok_parse_n(json, (size_t)len, tkns, TEST_TKN_COUNT),
+                      JTOK_PARSE_STATUS_OK);
+        if ((tkns[1].flags & mask) != cases[c].flags ||
+            (tkns[2].flags & mask) != cases[c].flags)
+        {
+            printf("FAIL flags of %s: key %u, value %u\n", cases[c].text,
+                   tkns[1].flags & mask, tkns[2].flags & mask);
+            failures++;
+        }
+        expect(cases[c].text, !(tkns[2].flags & JTOK_TKN_FLAG_DECODED));
+    }
+
+    /* Decoding a token flags it, and a second decode is a no-op */
+    snprintf(json, sizeof(json), "{\"k\":\"a\\tb\"}");
+    jtok_parse_n(json, strlen(json), tkns, TEST_TKN_COUNT);
+    expect_status("decode flag", jtok_tok_unescape(&tkns[2]),
+                  JTOK_PARSE_STATUS_OK);
+    expect_status("decode twice", jtok_tok_unescape(&tkns[2]),
+                  JTOK_PARSE_STATUS_OK);
+    expect("decode flag", (tkns[2].flags & JTOK_TKN_FLAG_DECODED) &&
+                              jtok_toklen(&tkns[2]) == 3 &&
+                              memcmp(&json[tkns[2].start], "a\tb", 3) == 0);
+}
+
+
+typedef struct
+{
+    const char *json; /* what the thread dispatches */
+    const char *want; /* handlers it should run, in order */
+    int         bad;  /* runs that went wrong */
+} test_thread_t;
+
+
+static void *test_ctx_thread(void *arg)
+{
+    test_thread_t *   run = arg;
+    json_parse_ctx_t *ctx = malloc(sizeof(*ctx));
+    int               i;
+
+    if (ctx == NULL)
+    {
+        run->bad = -1;
+        return NULL;
+    }
+    for (i = 0; i < 20000; i++)
+    {
+        ctx->value_holder[0] = '\0';
+        if (json_parse_ctx(ctx, (const uint8_t *)run->json,
+                           strlen(run->json)) != 0 ||
+            strcmp(ctx->value_holder, run->want) != 0)
+        {
+            run->bad++;
+        }
+    }
+    free(ctx);
+    return NULL;
+}
+
+
+/**
+ * @brief Two threads dispatching through contexts of their own never see
+ * each other's tokens or handler state
+ */
+static void test_parse_ctx_threads(void)
+{
+    test_thread_t runs[2] = {
+        {"{\"ping\":1,\"set\":2}", "ping;set;", 0},
+        {"{\"set\":[1,2,3],\"cmd075ae3\":0,\"ping\":\"x\"}",
+         "set;first;ping;", 0},
+    };
+    pthread_t threads[2];
+    int       t;
+
+    for (t = 0; t < 2; t++)
+    {
+        if (pthread_create(&threads[t], NULL, test_ctx_thread, &runs[t]) != 0)
+        {
+            printf("FAIL parse_ctx threads: no thread\n");
+            failures++;
+            return;
+        }
+    }
+    for (t = 0; t < 2; t++)
+    {
+        pthread_join(threads[t], NULL);
+        if (runs[t].bad != 0)
+        {
+            printf("FAIL parse_ctx thread %d: %d bad runs\n", t, runs[t].bad);
+            failures++;
+        }
+    }
+}
+
+
+/**
+ * @brief jtok_keymap_find finds the same keys as jtok_obj_has_key, misses
+ * the same ones, and switches objects on its own
+ */
+static void test_keymap(void)
+{
+    static const char *const misses[] = {"", "key", "key1x", "key100",
+                                         "KEY1", "inner"};
+    char               json[1024];
+    char               name[16];
+    jtok_tkn_t         tkns[256];
+    jtok_keymap_slot_t slots[JTOK_KEYMAP_SLOTS(64)];
+    jtok_keymap_t      map;
+    size_t             len = 0;
+    size_t             i;
+    int                inner;
+
+    /* key0 to key49, a repeated key1 and an object holding more keys */
+    for (i = 0; i < 50; i++)
+    {
+        len += (size_t)sprintf(&json[len], "%s\"key%zu\":%zu", i ? "," : "{",
+                               i, i);
+    }
+    len += (size_t)sprintf(&json[len],
+                           ",\"key1\":2,\"obj\":{\"inner\":1,\"key0\":2}}");
+    expect_status("keymap parse", jtok_parse_n(json, len, tkns, 256),
+                  JTOK_PARSE_STATUS_OK);
+    inner = jtok_obj_has_key(&tkns[0], "obj") + 1;
+
+    jtok_keymap_init(&map, slots, JTOK_KEYMAP_SLOTS(64));
+    for (i = 0; i < 50; i++)
+    {
+        sprintf(name, "key%zu", i);
+        expect(name, jtok_keymap_find(&map, &tkns[0], name, strlen(name)) ==
+                             jtok_obj_has_key(&tkns[0], name) &&
+                         jtok_obj_has_key(&tkns[0], name) == 1 + 2 * (int)i);
+    }
+    expect("keymap first of repeated key",
+           jtok_keymap_find(&map, &tkns[0], "key1", 4) == 3);
+    for (i = 0; i < sizeof(misses) / sizeof(*misses); i++)
+    {
+        expect(misses[i], jtok_keymap_find(&map, &tkns[0], misses[i],
+                                           strlen(misses[i])) ==
+                              INVALID_ARRAY_INDEX);
+    }
+
+    /* Asked about another object, the map is built again for it */
+    expect("keymap other object",
+           jtok_keymap_find(&map, &tkns[inner], "key0", 4) ==
+               jtok_obj_has_key(&tkns[inner], "key0"));
+    expect("keymap other object miss",
+           jtok_keymap_find(&map, &tkns[inner], "key1", 4) ==
+               INVALID_ARRAY_INDEX);
+
+    /* Too few slots: the object is walked instead */
+    jtok_keymap_init(&map, slots, 8);
+    expect_status("keymap too small", jtok_keymap_build(&map, &tkns[0]),
+                  JTOK_PARSE_STATUS_NOMEM);
+    expect("keymap too small find",
+           jtok_keymap_find(&map, &tkns[0], "key42", 5) ==
+               jtok_obj_has_key(&tkns[0], "key42"));
+    expect_status("keymap of a value", jtok_keymap_build(&map, &tkns[2]),
+                  JTOK_PARSE_STATUS_NON_OBJECT);
+}
+
+
+/* Every command json_parse is built with here, straight from the def file
+ * (which takes in the real commands too) */
+static const struct
+{
+    const char * key;
+    json_handler handler;
+} test_commands[] = {
+#define JSON_COMMAND(key, handler) {key, handler},
+#include "json_test_commands.def"
+#undef JSON_COMMAND
+};
+
+
+/**
+ * @brief The perfect hash table leads every command of the def file to its
+ * own handler, whether or not the parser hashed the key, and nothing else
+ * to any handler
+ */
+static void test_phash_commands(void)
+{
+    char          json[64];
+    jtok_tkn_t    tkns[TEST_TKN_COUNT];
+    jtok_frame_t  stack[TEST_STACK_DEPTH];
+    jtok_parser_t parser;
+    size_t        c;
+    size_t        used = 0;
+    int           hashed;
+
+    for (c = 0; c < JSON_PARSE_TABLE_SIZE; c++)
+    {
+        used += (json_parse_table[c].key != NULL);
+    }
+    expect("phash table holds every command",
+           used == sizeof(test_commands) / sizeof(*test_commands));
+
+    for (c = 0; c < sizeof(test_commands) / sizeof(*test_commands); c++)
+    {
+        const char *key = test_commands[c].key;
+        for (hashed = 0; hashed < 2; hashed++)
+        {
+            const json_parse_table_item *item;
+            int len = snprintf(json, sizeof(json), "{\"%s\":1}", key);
+
+            jtok_parser_init(&parser, tkns, TEST_TKN_COUNT, stack,
+                             TEST_STACK_DEPTH);
+            jtok_parser_set_hash_keys(&parser, hashed);
+            jtok_parser_parse(&parser, json, (size_t)len);
+            item = json_parse_lookup(&tkns[1]);
+            expect(key, item != NULL && strcmp(item->key, key) == 0 &&
+                            item->handler == test_commands[c].handler);
+
+            /* Same length and hash bucket spread, but not a command */
+            json[2] ^= 0x20;
+            jtok_parser_init(&parser, tkns, TEST_TKN_COUNT, stack,
+                             TEST_STACK_DEPTH);
+            jtok_parser_set_hash_keys(&parser, hashed);
+            jtok_parser_parse(&parser, json, (size_t)len);
+            expect(key, json_parse_lookup(&tkns[1]) == NULL);
+        }
+    }
+}
+
+
+/**
+ * @brief Every top-level key is dispatched in order, and a failed or unknown
+ * key doesn't stop the ones after it
+ */
+static void test_key_status(void)
+{
+    static const char batch[] = "{\"ping\":1,\"nope\":2,\"fail\":3,\"set\":{}}";
+    static const char empty[] = "{}";
+    static const int  want[]  = {0, -1, -1, 0};
+    json_parse_ctx_t *ctx     = malloc(sizeof(*ctx));
+    unsigned int      k;
+
+    if (ctx == NULL)
+    {
+        printf("FAIL key_status: no memory\n");
+        failures++;
+        return;
+    }
+    ctx->value_holder[0] = '\0';
+    expect("key_status batch fails",
+           json_parse_ctx(ctx, (const uint8_t *)batch, sizeof(batch) - 1) ==
+               -1);
+    expect("key_status count", ctx->key_cnt == 4);
+    for (k = 0; k < ctx->key_cnt && k < 4; k++)
+    {
+        expect("key_status of key", ctx->key_status[k] == want[k]);
+    }
+    expect("key_status order",
+           strcmp(ctx->value_holder, "ping;fail;set;") == 0);
+
+    ctx->value_holder[0] = '\0';
+    expect("key_status empty",
+           json_parse_ctx(ctx, (const uint8_t *)empty, sizeof(empty) - 1) ==
+                   0 &&
+               ctx->key_cnt == 0 && ctx->value_holder[0] == '\0');
+
+    /* As many keys as the token pool has room for */
+    char   full[JSON_KEY_CNT * 16];
+    size_t len = 0;
+    for (k = 0; k < (JSON_TKN_CNT - 1) / 2; k++)
+    {
+        len += (size_t)sprintf(&full[len], "%s\"ping\":%u", k ? "," : "{", k);
+    }
+    full[len++] = '}';
+    expect("key_status full pool",
+           json_parse_ctx(ctx, (const uint8_t *)full, len) == 0 &&
+               ctx->key_cnt == (JSON_TKN_CNT - 1) / 2);
+    free(ctx);
+}
+
+
+/**
+ * @brief Check if token j is in the subtree of token i, by its parents
+ */
+static bool in_subtree(const jtok_tkn_t *tkns, int i, int j)
+{
+    while (j != NO_PARENT_IDX && j > i)
+    {
+        j = tkns[j].parent;
+    }
+    return j == i;
+}
+
+
+/**
+ * @brief next skips exactly the subtree of each token, whether the json was
+ * parsed in one go or fed a byte at a time
+ */
+static void test_subtree_next(void)
+{
+    jtok_tkn_t    tkns[TEST_TKN_COUNT];
+    jtok_frame_t  stack[TEST_STACK_DEPTH];
+    jtok_parser_t parser;
+    size_t        d;
+
+    for (d = 0; d < sizeof(test_docs) / sizeof(*test_docs); d++)
+    {
+        const char *        json   = test_docs[d];
+        size_t              len    = strlen(json);
+        JTOK_PARSE_STATUS_t status = JTOK_PARSE_STATUS_PARTIAL_TOKEN;
+        size_t              at;
+        int                 i;
+
+        jtok_parser_init(&parser, tkns, TEST_TKN_COUNT, stack,
+                         TEST_STACK_DEPTH);
+        for (at = 0; at < len && status == JTOK_PARSE_STATUS_PARTIAL_TOKEN;
+             at++)
+        {
+            status = jtok_parser_feed(&parser, &json[at], 1);
+        }
+        if (status != JTOK_PARSE_STATUS_OK)
+        {
+            continue;
+        }
+        for (i = 0; i < parser.toknext; i++)
+        {
+            int want = i + 1;
+            while (want < parser.toknext && in_subtree(tkns, i, want))
+            {
+                want++;
+            }
+            if (tkns[i].next != want || jtok_tok_next(&tkns[i]) != want ||
+                (tkns[i].sibling != NO_SIBLING_IDX &&
+                 tkns[i].sibling != want))
+            {
+                printf("FAIL next of token %d of %s: %d, want %d\n", i, json,
+                       tkns[i].next, want);
+                failures++;
+            }
+        }
+    }
+}
+
+
+/**
+ * @brief jtok_array_at and jtok_elemidx_at find the element the sibling
+ * chain leads to, on flat and nested arrays, and nothing out of range
+ */
+static void test_array_at(void)
+{
+    static const char json[] =
+        "{\"flat\":[10,11,12,13,14,15,16,17,18,19],\"strs\":[\"a\",\"b\"],"
+        "\"arrs\":[[1],[2,3],[],[[4]]],\"objs\":[{\"a\":1},{\"b\":[1,2]},{}],"
+        "\"none\":[],\"num\":1}";
+    jtok_tkn_t     tkns[64];
+    int            elems[8];
+    jtok_elemidx_t idx;
+    jtok_elemidx_t small;
+    int            small_elems[2];
+    int            key;
+
+    expect_status("array_at parse",
+                  jtok_parse_n(json, sizeof(json) - 1, tkns, 64),
+                  JTOK_PARSE_STATUS_OK);
+    jtok_elemidx_init(&idx, elems, 8);
+    jtok_elemidx_init(&small, small_elems, 2);
+    for (key = 1; key != NO_SIBLING_IDX; key = tkns[key].sibling)
+    {
+        const jtok_tkn_t *arr  = &tkns[key + 1];
+        int               want = (arr->size > 0) ? key + 2 : NO_SIBLING_IDX;
+        int               i;
+
+        if (arr->type != JTOK_ARRAY)
+        {
+            expect("array_at of a non-array",
+                   jtok_array_at(arr, 0) == INVALID_ARRAY_INDEX &&
+                       jtok_elemidx_at(&idx, arr, 0) == INVALID_ARRAY_INDEX);
+            expect_status("elemidx of a non-array",
+                          jtok_elemidx_build(&idx, arr),
+                          JTOK_PARSE_STATUS_NON_ARRAY);
+            continue;
+        }
+        for (i = -1; i <= arr->size; i++)
+        {
+            int expected = (i < 0 || i >= arr->size) ? INVALID_ARRAY_INDEX
+                                                     : want;
+            if (jtok_array_at(arr, i) != expected ||
+                jtok_elemidx_at(&idx, arr, i) != expected ||
+                jtok_elemidx_at(&small, arr, i) != expected)
+            {
+                printf("FAIL array_at %d of key %d\n", i, key);
+                failures++;
+            }
+            if (i >= 0 && i < arr->size)
+            {
+                want = tkns[want].sibling;
+            }
+        }
+    }
+}
+
+
+/**
+ * @brief JSON pointers find the value they name, with ~0 and ~1 escapes,
+ * wildcards, and array indices that are out of range or not indices at all
+ */
+static void test_path(void)
+{
+    static const char json[] =
+        "{\"a/b\":1,\"m~n\":2,\"~01\":3,\"arr\":[5,6,7],"
+        "\"wheels\":[{\"pwm\":10},{\"pwm\":20}],\"09\":{\"x\":4}}";
+    static const struct
+    {
+        const char *path;
+        const char *want; /* text of the match, NULL for none */
+    } cases[] = {
+        {"/a~1b", "1"},
+        {"/m~0n", "2"},
+        {"/~001", "3"},
+        {"/arr/0", "5"},
+        {"/arr/2", "7"},
+        {"/arr/3", NULL},
+        {"/arr/-", NULL},
+        {"/arr/-1", NULL},
+        {"/arr/01", NULL},
+        {"/arr/99999999999", NULL},
+        {"/wheels/1/pwm", "20"},
+        {"/wheels/2/pwm", NULL},
+        {"/09/x", "4"},
+        {"/a/b", NULL},
+        {"/m~1n", NULL},
+        {"/nope", NULL},
+        {"/arr/0/x", NULL},
+    };
+    static const char *const bad[] = {"a", "/a~2b", "/a~", "/~"};
+    jtok_tkn_t      tkns[TEST_TKN_COUNT];
+    jtok_path_seg_t segs[4];
+    jtok_path_t     path;
+    int             matches[4];
+    size_t          i;
+
+    expect_status("path parse",
+                  jtok_parse_n(json, sizeof(json) - 1, tkns, TEST_TKN_COUNT),
+                  JTOK_PARSE_STATUS_OK);
+    jtok_path_init(&path, segs, 4);
+    for (i = 0; i < sizeof(cases) / sizeof(*cases); i++)
+    {
+        int found;
+        expect_status(cases[i].path,
+                      jtok_path_compile(&path, cases[i].path,
+                                        strlen(cases[i].path)),
+                      JTOK_PARSE_STATUS_OK);
+        found = jtok_path_get(&path, &tkns[0]);
+        if (cases[i].want == NULL ? found != INVALID_ARRAY_INDEX
+                                  : (found == INVALID_ARRAY_INDEX ||
+                                     !jtok_tokcmp(cases[i].want, &tkns[found])))
+        {
+            printf("FAIL path %s: found %d\n", cases[i].path, found);
+            failures++;
+        }
+    }
+
+    expect_status("path whole json", jtok_path_compile(&path, "", 0),
+                  JTOK_PARSE_STATUS_OK);
+    expect("path whole json", jtok_path_get(&path, &tkns[0]) == 0);
+    jtok_path_compile(&path, "/wheels/*/pwm", 13);
+    expect("path wildcard",
+           jtok_path_find(&path, &tkns[0], NULL, NULL, matches, 4) == 2 &&
+               jtok_tokcmp("10", &tkns[matches[0]]) &&
+               jtok_tokcmp("20", &tkns[matches[1]]));
+    for (i = 0; i < sizeof(bad) / sizeof(*bad); i++)
+    {
+        expect_status(bad[i], jtok_path_compile(&path, bad[i], strlen(bad[i])),
+                      JTOK_PARSE_STATUS_INVAL);
+    }
+    expect_status("path too long", jtok_path_compile(&path, "/a/b/c/d/e", 10),
+                  JTOK_PARSE_STATUS_NOMEM);
+}
+
+
+/**
+ * @brief Only json whitespace is skipped before and between documents. \v,
+ * \f and bytes that are spaces in some locales (0x85, 0xA0) start a bad
+ * document.
+ */
+static void test_parse_many_whitespace(void)
+{
+    static const char *const lead[] = {"\v", "\f", "\x85", "\xA0"};
+    char                     json[32];
+    jtok_tkn_t               tkns[TEST_TKN_COUNT];
+    jtok_frame_t             stack[TEST_STACK_DEPTH];
+    jtok_parser_t            parser;
+    jtok_doc_t               doc;
+    size_t                   i;
+
+    expect_status("json whitespace",
+                  jtok_parse_n(" \t\r\n{\"a\":1}", 11, tkns, TEST_TKN_COUNT),
+                  JTOK_PARSE_STATUS_OK);
+    for (i = 0; i < sizeof(lead) / sizeof(*lead); i++)
+    {
+        size_t offset = 0;
+        int    len    = snprintf(json, sizeof(json), "%s{\"a\":1}\n{\"b\":2}",
+                                 lead[i]);
+
+        expect("not json whitespace",
+               jtok_parse_n(json, (size_t)len, tkns, TEST_TKN_COUNT) !=
+                   JTOK_PARSE_STATUS_OK);
+        jtok_parser_init(&parser, tkns, TEST_TKN_COUNT, stack,
+                         TEST_STACK_DEPTH);
+        expect("not json whitespace, first document",
+               jtok_parse_many(&parser, json, (size_t)len, &offset, &doc) &&
+                   doc.start == 0 && doc.status != JTOK_PARSE_STATUS_OK);
+        expect("not json whitespace, next line",
+               jtok_parse_many(&parser, json, (size_t)len, &offset, &doc) &&
+                   doc.status == JTOK_PARSE_STATUS_OK &&
+                   doc.start == (size_t)len - 7);
+    }
+}
+
+
+int main(void)
+{
+    test_parse_n_embedded_nul();
+    test_feed_embedded_nul();
+    test_parse_n_too_long();
+    test_unescape();
+    test_parse_parallel_offsets();
+    test_toktokcmp();
+    test_token_size();
+    test_phash_collision();
+    test_utf8();
+    test_feed_number();
+    test_index();
+    test_string_scan();
+    test_parse_n_length();
+    test_tape();
+    test_nesting();
+    test_pool_growth();
+    test_value_types();
+    test_atod();
+    test_state_machines();
+    test_parse_many();
+    test_validate();
+    test_utf8_paths();
+    test_string_flags();
+    test_parse_ctx_threads();
+    test_keymap();
+    test_phash_commands();
+    test_key_status();
+    test_subtree_next();
+    test_array_at();
+    test_path();
+    test_parse_many_whitespace();
+    if (failures != 0)
+    {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
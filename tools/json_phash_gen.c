@@ -0,0 +1,303 @@
+/**
+ * @file json_phash_gen.c
+ * @brief Build step that turns json_commands.def into json_parse_table.h, a
+ * perfect hash table of the json_parse command keys (hash and displace).
+ *
+ * Usage: json_phash_gen > json_parse_table.h
+ *
+ * @copyright Copyright (c) 2020 DSS - LORIS project
+ *
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "../JTOK/src/inc/jtok_shared.h"
+#include "../json_phash.h"
+
+/* Displacements tried per bucket before the table is made bigger */
+#define DISP_TRIES (1u << 20)
+
+/* Average number of keys per bucket */
+#define KEYS_PER_BUCKET 4
+
+/* Command list to build the table of, relative to this file */
+#ifndef JSON_COMMANDS_DEF
+#define JSON_COMMANDS_DEF "../json_commands.def"
+#endif
+
+typedef struct
+{
+    const char *key;
+    const char *handler;
+    uint32_t    hash;
+    int         first; /* earlier key with the same hash, -1 if none */
+    int         entry; /* index of the key in the table */
+} command_t;
+
+static command_t commands[] = {
+#define JSON_COMMAND(key, handler) {key, #handler, 0, -1, -1},
+#include JSON_COMMANDS_DEF
+#undef JSON_COMMAND
+    {NULL, NULL, 0, -1, -1}, /* the list may be empty */
+};
+
+
+/**
+ * @brief Sort buckets by number of keys, biggest first, so the hardest
+ * ones are placed while the table is still empty
+ */
+static size_t *bucket_count;
+static int     bucket_cmp(const void *a, const void *b)
+{
+    size_t ca = bucket_count[*(const size_t *)a];
+    size_t cb = bucket_count[*(const size_t *)b];
+    return (ca < cb) - (ca > cb);
+}
+
+
+/**
+ * @brief Try to place every key in a table of size slots. Keys that hash
+ * the same as an earlier key can't be told apart by any displacement, so
+ * only the first of them is placed.
+ *
+ * @return true if each placed key got a slot of its own, with disp and
+ * slot_of filled in
+ */
+static bool place(size_t count, size_t size, size_t buckets, uint32_t *disp,
+                  int *slot_of)
+{
+    size_t  i;
+    size_t *order = malloc(buckets * sizeof(*order));
+    bool *  taken = calloc(size, sizeof(*taken));
+    size_t *slots = malloc((count + 1) * sizeof(*slots));
+    bool    ok    = true;
+
+    bucket_count = calloc(buckets, sizeof(*bucket_count));
+    for (i = 0; i < count; i++)
+    {
+        if (commands[i].first < 0)
+        {
+            bucket_count[JSON_PHASH_BUCKET(commands[i].hash, buckets)]++;
+        }
+    }
+    for (i = 0; i < buckets; i++)
+    {
+        order[i] = i;
+        disp[i]  = 0;
+    }
+    qsort(order, buckets, sizeof(*order), bucket_cmp);
+
+    for (i = 0; i < buckets && ok && bucket_count[order[i]] > 0; i++)
+    {
+        size_t   b = order[i];
+        uint32_t d;
+        ok = false;
+        for (d = 0; d < DISP_TRIES && !ok; d++)
+        {
+            size_t k;
+            size_t n = 0;
+            ok       = true;
+            for (k = 0; k < count && ok; k++)
+            {
+                if (commands[k].first < 0 &&
+                    JSON_PHASH_BUCKET(commands[k].hash, buckets) == b)
+                {
+                    size_t s = JSON_PHASH_SLOT(commands[k].hash, d, size);
+                    size_t j;
+                    ok = !taken[s];
+                    for (j = 0; j < n && ok; j++)
+                    {
+                        ok = (slots[j] != s);
+                    }
+                    slots[n++] = s;
+                }
+            }
+            if (ok)
+            {
+                disp[b] = d;
+                for (k = 0; k < count; k++)
+                {
+                    if (commands[k].first < 0 &&
+                        JSON_PHASH_BUCKET(commands[k].hash, buckets) == b)
+                    {
+                        size_t s   = JSON_PHASH_SLOT(commands[k].hash, d, size);
+                        taken[s]   = true;
+                        slot_of[s] = (int)k;
+                    }
+                }
+            }
+        }
+    }
+
+    free(bucket_count);
+    free(slots);
+    free(taken);
+    free(order);
+    return ok;
+}
+
+
+/**
+ * @brief Print key as a C string literal
+ */
+static void print_key(const char *key)
+{
+    putchar('\"');
+    for (; *key != '\0'; key++)
+    {
+        unsigned char c = (unsigned char)*key;
+        if (c == '\"' || c == '\\')
+        {
+            printf("\\%c", c);
+        }
+        else if (c < 0x20 || c >= 0x7F)
+        {
+            printf("\\%03o", c);
+        }
+        else
+        {
+            putchar(c);
+        }
+    }
+    putchar('\"');
+}
+
+
+int main(void)
+{
+    size_t count   = sizeof(commands) / sizeof(*commands) - 1;
+    size_t chained = 0;
+    size_t i;
+    size_t j;
+
+    for (i = 0; i < count; i++)
+    {
+        commands[i].hash = jtok_hash(commands[i].key, strlen(commands[i].key));
+        for (j = 0; j < i; j++)
+        {
+            if (strcmp(commands[i].key, commands[j].key) == 0)
+            {
+                fprintf(stderr, "json_phash_gen: duplicate key \"%s\"\n",
+                        commands[i].key);
+                return EXIT_FAILURE;
+            }
+            else if (commands[i].hash == commands[j].hash &&
+                     commands[i].first < 0)
+            {
+                /* Chained to the first key with the hash, lookups compare
+                 * the text of every key on the chain */
+                commands[i].first = (int)j;
+                chained++;
+            }
+        }
+    }
+
+    /* Start minimal and only grow the table if no displacements fit */
+    size_t    buckets = count / KEYS_PER_BUCKET + 1;
+    size_t    size    = (count > chained) ? count - chained : 1;
+    uint32_t *disp    = malloc(buckets * sizeof(*disp));
+    int *     slot_of = malloc((count * 2 + 1) * sizeof(*slot_of));
+    for (;;)
+    {
+        for (i = 0; i < size; i++)
+        {
+            slot_of[i] = -1;
+        }
+        if (place(count, size, buckets, disp, slot_of))
+        {
+            break;
+        }
+        else if (size >= count * 2)
+        {
+            fprintf(stderr, "json_phash_gen: no perfect hash found\n");
+            return EXIT_FAILURE;
+        }
+        size++;
+    }
+
+    /* Keys sharing a hash go after the perfect hash slots, each linked
+     * from the key before it with the same hash */
+    size_t entries = size;
+    for (i = 0; i < size; i++)
+    {
+        if (slot_of[i] >= 0)
+        {
+            commands[slot_of[i]].entry = (int)i;
+        }
+    }
+    for (i = 0; i < count; i++)
+    {
+        if (commands[i].first >= 0)
+        {
+            commands[i].entry = (int)entries++;
+        }
+    }
+
+    printf("/* Generated by tools/json_phash_gen.c from %s. Do not edit. */\n",
+           JSON_COMMANDS_DEF);
+    printf("#ifndef __JSON_PARSE_TABLE_H__\n");
+    printf("#define __JSON_PARSE_TABLE_H__\n\n");
+    printf("#define JSON_PARSE_SLOT_COUNT %zu\n", size);
+    printf("#define JSON_PARSE_TABLE_SIZE %zu\n", entries);
+    printf("#define JSON_PARSE_DISP_SIZE %zu\n\n", buckets);
+
+    printf("/* clang-format off */\n");
+    printf("static const uint32_t json_parse_disp[JSON_PARSE_DISP_SIZE] = {\n");
+    for (i = 0; i < buckets; i++)
+    {
+        printf("    %uu,\n", (unsigned)disp[i]);
+    }
+    printf("};\n\n");
+
+    printf("static const json_parse_table_item "
+           "json_parse_table[JSON_PARSE_TABLE_SIZE] = {\n");
+    for (i = 0; i < entries; i++)
+    {
+        int k = -1;
+        if (i < size)
+        {
+            k = slot_of[i];
+        }
+        else
+        {
+            for (j = 0; j < count && k < 0; j++)
+            {
+                k = (commands[j].entry == (int)i) ? (int)j : -1;
+            }
+        }
+
+        if (k < 0)
+        {
+            printf("    {.key = NULL, .len = 0, .hash = 0, .handler = NULL, "
+                   ".next = -1},\n");
+        }
+        else
+        {
+            /* The next key with the same hash, if any */
+            const command_t *cmd  = &commands[k];
+            int              next = -1;
+            for (j = (size_t)k + 1; j < count && next < 0; j++)
+            {
+                if (commands[j].hash == cmd->hash)
+                {
+                    next = commands[j].entry;
+                }
+            }
+            printf("    {.key = ");
+            print_key(cmd->key);
+            printf(", .len = %zu, .hash = 0x%08Xu, .handler = %s, .next = %d},\n",
+                   strlen(cmd->key), (unsigned)cmd->hash, cmd->handler, next);
+        }
+    }
+    printf("};\n");
+    printf("/* clang-format on */\n\n");
+    printf("#endif /* __JSON_PARSE_TABLE_H__ */\n");
+
+    free(slot_of);
+    free(disp);
+    return EXIT_SUCCESS;
+}